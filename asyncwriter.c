@@ -0,0 +1,502 @@
+/*
+ * This file is part of the CCD_Capture project.
+ * Copyright 2026 Edward V. Emelianov <edward.emelianoff@gmail.com>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// asynchronous writing of ready files: caller forms file in one of AW_NBUFFERS buffers, opens file
+// and returns immediately; data are written by io_uring (buffers are registered, completions are
+// reaped by separate thread) or, if io_uring is unavailable, by pool of writing threads
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#ifdef IOURING_FOUND
+#include <linux/io_uring.h>
+#endif
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <usefull_macros.h>
+
+#include "asyncwriter.h"
+#include "cmdlnopts.h"
+
+// amount of threads in fallback mode
+#define AW_NWORKERS     2
+// max length of one write request
+#define AW_MAXREQ       (1<<30)
+
+#define ROUNDUP(x, n)   (((x) + (n) - 1) / (n) * (n))
+
+typedef enum{
+    AW_NONE,
+    AW_URING,
+    AW_THREADS
+} aw_backend_t;
+
+// buffer and its writing job
+typedef struct{
+    uint8_t *data;      // buffer
+    int busy;           // taken by aw_getbuf() or being written
+    int fd;             // file descriptor
+    char *name;         // file name
+    size_t len;         // length of file
+    size_t directlen;   // length to write (aligned length in O_DIRECT mode)
+    size_t done;        // bytes written
+} awjob;
+
+static awjob jobs[AW_NBUFFERS];
+static size_t bufsize = 0;  // size of each buffer
+static int nbusy = 0;       // amount of busy buffers
+static int nwriting = 0;    // amount of buffers being written
+static aw_backend_t backend = AW_NONE;
+static pthread_mutex_t poolmutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t poolcond = PTHREAD_COND_INITIALIZER;
+
+#ifdef IOURING_FOUND
+// io_uring rings
+static struct{
+    int fd;
+    unsigned *sqtail, *sqmask, *sqarray;
+    unsigned *cqhead, *cqtail, *cqmask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sqring, *cqring;
+    size_t sqringsz, cqringsz, sqessz;
+    int registered;     // buffers are registered
+    pthread_mutex_t sqmutex;
+} ring = {.fd = -1, .sqmutex = PTHREAD_MUTEX_INITIALIZER};
+#endif
+static pthread_t reaper;
+
+// fallback: queue of jobs (numbers of buffers)
+static int queue[AW_NBUFFERS + 1];
+static int qhead = 0, qtail = 0, stopping = FALSE;
+static pthread_cond_t qcond = PTHREAD_COND_INITIALIZER;
+static pthread_t workers[AW_NWORKERS];
+
+static const char *backendnames[] = {
+    [AW_NONE] = "none",
+    [AW_URING] = "io_uring",
+    [AW_THREADS] = "threads",
+};
+
+int aw_running(){
+    return (backend != AW_NONE);
+}
+
+const char *aw_backend(){
+    return backendnames[backend];
+}
+
+// finish job: truncate alignment tail, close file and free buffer
+static void finish(int n, int ok){
+    awjob *j = &jobs[n];
+    if(ok && j->directlen != j->len && ftruncate(j->fd, j->len)) ok = FALSE;
+    if(close(j->fd)) ok = FALSE;
+    if(!ok){
+        WARN(_("Can't write file %s"), j->name);
+        LOGERR("Can't write file %s", j->name);
+        unlink(j->name);
+    }else{ // synchronous savers log it by themselves
+        LOGMSG("Save file '%s'", j->name);
+        verbose(VERBOSE_PRIMARY, _("File saved as '%s'"), j->name);
+    }
+    FREE(j->name);
+    pthread_mutex_lock(&poolmutex);
+    --nwriting;
+    pthread_mutex_unlock(&poolmutex);
+    aw_release(n);
+}
+
+// clear O_DIRECT flag if filesystem don't support it
+static int nodirect(awjob *j){
+    int fl = fcntl(j->fd, F_GETFL);
+    if(fl < 0 || fcntl(j->fd, F_SETFL, fl & ~O_DIRECT) < 0) return FALSE;
+    DBG("O_DIRECT write failed, continue in buffered mode");
+    j->directlen = j->len;
+    return TRUE;
+}
+
+#ifdef IOURING_FOUND
+/******************************** io_uring ********************************/
+
+static int uring_enter(unsigned to_submit, unsigned min_complete, unsigned flags){
+    return (int)syscall(__NR_io_uring_enter, ring.fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int uring_register(unsigned opcode, void *arg, unsigned nr_args){
+    return (int)syscall(__NR_io_uring_register, ring.fd, opcode, arg, nr_args);
+}
+
+// register all buffers (poolmutex is locked, all buffers are free)
+static void uring_regbufs(){
+    if(ring.registered) uring_register(IORING_UNREGISTER_BUFFERS, NULL, 0);
+    ring.registered = FALSE;
+    if(!bufsize) return;
+    struct iovec iov[AW_NBUFFERS];
+    for(int i = 0; i < AW_NBUFFERS; ++i){
+        iov[i].iov_base = jobs[i].data;
+        iov[i].iov_len = bufsize;
+    }
+    if(uring_register(IORING_REGISTER_BUFFERS, iov, AW_NBUFFERS)) DBG("Can't register buffers: %s", strerror(errno));
+    else ring.registered = TRUE;
+}
+
+// submit writing of rest of job `n` (n == -1 - stop reaper)
+static int uring_submit(int n){
+    pthread_mutex_lock(&ring.sqmutex);
+    unsigned tail = *ring.sqtail, idx = tail & *ring.sqmask;
+    struct io_uring_sqe *sqe = &ring.sqes[idx];
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    if(n < 0) sqe->opcode = IORING_OP_NOP;
+    else{
+        awjob *j = &jobs[n];
+        size_t rest = j->directlen - j->done;
+        sqe->opcode = ring.registered ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE;
+        sqe->fd = j->fd;
+        sqe->addr = (uint64_t)(uintptr_t)(j->data + j->done);
+        sqe->len = (rest > AW_MAXREQ) ? AW_MAXREQ : (unsigned)rest;
+        sqe->off = j->done;
+        sqe->buf_index = n;
+        sqe->user_data = n + 1; // 0 is for stop
+    }
+    ring.sqarray[idx] = idx;
+    __atomic_store_n(ring.sqtail, tail + 1, __ATOMIC_RELEASE);
+    int r;
+    while((r = uring_enter(1, 0, 0)) < 0 && errno == EINTR);
+    pthread_mutex_unlock(&ring.sqmutex);
+    if(r != 1){
+        WARN("io_uring_enter()");
+        return FALSE;
+    }
+    return TRUE;
+}
+
+// reap completions: resubmit partial writes, finish done jobs
+static void *reaperthread(void _U_ *arg){
+    while(1){
+        unsigned head = *ring.cqhead;
+        if(head == __atomic_load_n(ring.cqtail, __ATOMIC_ACQUIRE)){
+            if(uring_enter(0, 1, IORING_ENTER_GETEVENTS) < 0 && errno != EINTR){
+                WARN("io_uring_enter()");
+                break;
+            }
+            continue;
+        }
+        struct io_uring_cqe *cqe = &ring.cqes[head & *ring.cqmask];
+        uint64_t ud = cqe->user_data;
+        int res = cqe->res;
+        __atomic_store_n(ring.cqhead, head + 1, __ATOMIC_RELEASE);
+        if(ud == 0) break; // stop
+        int n = (int)ud - 1;
+        awjob *j = &jobs[n];
+        if(res == -EINVAL && j->directlen != j->len && j->done == 0){ // O_DIRECT isn't supported
+            if(nodirect(j) && uring_submit(n)) continue;
+        }
+        if(res <= 0){
+            if(res < 0) errno = -res;
+            finish(n, FALSE);
+            continue;
+        }
+        j->done += res;
+        if(j->done < j->directlen){
+            if(!uring_submit(n)) finish(n, FALSE);
+            continue;
+        }
+        finish(n, TRUE);
+    }
+    return NULL;
+}
+
+static void uring_close(){
+    if(ring.sqes) munmap(ring.sqes, ring.sqessz);
+    if(ring.cqring && ring.cqring != ring.sqring) munmap(ring.cqring, ring.cqringsz);
+    if(ring.sqring) munmap(ring.sqring, ring.sqringsz);
+    if(ring.fd > -1) close(ring.fd);
+    ring.sqes = NULL; ring.sqring = ring.cqring = NULL;
+    ring.fd = -1;
+    ring.registered = FALSE;
+}
+
+static int uring_init(){
+    struct io_uring_params p = {0};
+    ring.fd = (int)syscall(__NR_io_uring_setup, 2 * AW_NBUFFERS, &p);
+    if(ring.fd < 0){
+        DBG("io_uring_setup(): %s", strerror(errno));
+        return FALSE;
+    }
+    ring.sqringsz = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    ring.cqringsz = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    int single = (p.features & IORING_FEAT_SINGLE_MMAP);
+    if(single){
+        if(ring.cqringsz > ring.sqringsz) ring.sqringsz = ring.cqringsz;
+        ring.cqringsz = ring.sqringsz;
+    }
+    ring.sqring = mmap(NULL, ring.sqringsz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_SQ_RING);
+    if(ring.sqring == MAP_FAILED){
+        ring.sqring = NULL;
+        goto bad;
+    }
+    if(single) ring.cqring = ring.sqring;
+    else{
+        ring.cqring = mmap(NULL, ring.cqringsz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_CQ_RING);
+        if(ring.cqring == MAP_FAILED){
+            ring.cqring = NULL;
+            goto bad;
+        }
+    }
+    ring.sqessz = p.sq_entries * sizeof(struct io_uring_sqe);
+    ring.sqes = mmap(NULL, ring.sqessz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_SQES);
+    if(ring.sqes == MAP_FAILED){
+        ring.sqes = NULL;
+        goto bad;
+    }
+    uint8_t *sq = ring.sqring, *cq = ring.cqring;
+    ring.sqtail = (unsigned*)(sq + p.sq_off.tail);
+    ring.sqmask = (unsigned*)(sq + p.sq_off.ring_mask);
+    ring.sqarray = (unsigned*)(sq + p.sq_off.array);
+    ring.cqhead = (unsigned*)(cq + p.cq_off.head);
+    ring.cqtail = (unsigned*)(cq + p.cq_off.tail);
+    ring.cqmask = (unsigned*)(cq + p.cq_off.ring_mask);
+    ring.cqes = (struct io_uring_cqe*)(cq + p.cq_off.cqes);
+    if(pthread_create(&reaper, NULL, reaperthread, NULL)) goto bad;
+    return TRUE;
+bad:
+    WARN("io_uring");
+    uring_close();
+    return FALSE;
+}
+#else
+// system headers have no io_uring: only pool of threads
+static int uring_init(){ return FALSE; }
+static void uring_regbufs(){}
+static int uring_submit(_U_ int n){ return FALSE; }
+static void uring_close(){}
+#endif
+
+/******************************** threads ********************************/
+
+static void *workerthread(void _U_ *arg){
+    while(1){
+        pthread_mutex_lock(&poolmutex);
+        while(qhead == qtail && !stopping) pthread_cond_wait(&qcond, &poolmutex);
+        if(qhead == qtail){ // stopping and queue is empty
+            pthread_mutex_unlock(&poolmutex);
+            break;
+        }
+        int n = queue[qhead];
+        qhead = (qhead + 1) % (AW_NBUFFERS + 1);
+        pthread_mutex_unlock(&poolmutex);
+        awjob *j = &jobs[n];
+        int ok = TRUE;
+        while(j->done < j->directlen){
+            size_t rest = j->directlen - j->done;
+            ssize_t w = pwrite(j->fd, j->data + j->done, (rest > AW_MAXREQ) ? AW_MAXREQ : rest, j->done);
+            if(w < 0){
+                if(errno == EINTR) continue;
+                if(errno == EINVAL && j->directlen != j->len && j->done == 0 && nodirect(j)) continue;
+                ok = FALSE;
+                break;
+            }
+            if(w == 0){
+                ok = FALSE;
+                break;
+            }
+            j->done += w;
+        }
+        finish(n, ok);
+    }
+    return NULL;
+}
+
+static int threads_init(){
+    stopping = FALSE;
+    qhead = qtail = 0;
+    for(int i = 0; i < AW_NWORKERS; ++i){
+        if(pthread_create(&workers[i], NULL, workerthread, NULL)){
+            WARN("pthread_create()");
+            pthread_mutex_lock(&poolmutex);
+            stopping = TRUE;
+            pthread_cond_broadcast(&qcond);
+            pthread_mutex_unlock(&poolmutex);
+            for(int j = 0; j < i; ++j) pthread_join(workers[j], NULL);
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+/******************************** API ********************************/
+
+/**
+ * @brief aw_start - start asynchronous writer (io_uring if available or threads)
+ * @return TRUE if started
+ */
+int aw_start(){
+    if(backend != AW_NONE) return TRUE;
+    if(uring_init()) backend = AW_URING;
+    else if(threads_init()) backend = AW_THREADS;
+    else return FALSE;
+    static int atexitset = FALSE; // wait for all files on exit
+    if(!atexitset){
+        atexit(aw_stop);
+        atexitset = TRUE;
+    }
+    verbose(VERBOSE_SECONDARY, _("Asynchronous writer started (%s)"), aw_backend());
+    LOGMSG("Asynchronous writer started (%s)", aw_backend());
+    return TRUE;
+}
+
+/**
+ * @brief aw_getbuf - get free buffer (wait if all are busy)
+ * @param size - required size
+ * @param data (o) - buffer (aligned by AW_ALIGN)
+ * @return number of buffer or -1 if failed
+ */
+int aw_getbuf(size_t size, uint8_t **data){
+    if(backend == AW_NONE || !data) return -1;
+    pthread_mutex_lock(&poolmutex);
+    if(size > bufsize){ // all buffers should be free to reallocate them
+        while(nbusy) pthread_cond_wait(&poolcond, &poolmutex);
+        size_t al = ROUNDUP(size, AW_ALIGN);
+        for(int i = 0; i < AW_NBUFFERS; ++i){
+            FREE(jobs[i].data);
+            if(posix_memalign((void**)&jobs[i].data, AW_ALIGN, al)){
+                WARN("posix_memalign()");
+                jobs[i].data = NULL;
+                for(int j = 0; j < i; ++j) FREE(jobs[j].data);
+                bufsize = 0;
+                if(backend == AW_URING) uring_regbufs();
+                pthread_mutex_unlock(&poolmutex);
+                return -1;
+            }
+        }
+        bufsize = al;
+        if(backend == AW_URING) uring_regbufs();
+    }
+    while(nbusy == AW_NBUFFERS) pthread_cond_wait(&poolcond, &poolmutex);
+    int n = 0;
+    while(jobs[n].busy) ++n;
+    jobs[n].busy = TRUE;
+    ++nbusy;
+    pthread_mutex_unlock(&poolmutex);
+    *data = jobs[n].data;
+    return n;
+}
+
+/**
+ * @brief aw_release - free buffer without writing
+ * @param nbuf - number of buffer
+ */
+void aw_release(int nbuf){
+    if(nbuf < 0 || nbuf >= AW_NBUFFERS) return;
+    pthread_mutex_lock(&poolmutex);
+    if(jobs[nbuf].busy){
+        jobs[nbuf].busy = FALSE;
+        --nbusy;
+        pthread_cond_broadcast(&poolcond);
+    }
+    pthread_mutex_unlock(&poolmutex);
+}
+
+/**
+ * @brief aw_write - open file and queue writing of buffer into it
+ * @param nbuf - number of buffer (from aw_getbuf)
+ * @param fnam - file name
+ * @param rewrite - rewrite existing file
+ * @param len - length of file
+ * @param directlen - aligned length (to write with O_DIRECT) or `len`
+ * @return FALSE if file can't be created or job can't be queued (buffer is released); errors of
+ *      writing are reported by writer (and file is removed)
+ */
+int aw_write(int nbuf, const char *fnam, int rewrite, size_t len, size_t directlen){
+    if(nbuf < 0 || nbuf >= AW_NBUFFERS || !fnam) return FALSE;
+    awjob *j = &jobs[nbuf];
+    int fd = open(fnam, O_WRONLY | O_CREAT | O_CLOEXEC | (rewrite ? O_TRUNC : O_EXCL), 0666);
+    if(fd < 0){
+        WARN(_("Can't create file %s"), fnam);
+        aw_release(nbuf);
+        return FALSE;
+    }
+    if(directlen != len){ // try to bypass page cache
+        int fl = fcntl(fd, F_GETFL);
+        if(fl < 0 || fcntl(fd, F_SETFL, fl | O_DIRECT) < 0) directlen = len;
+    }
+    j->fd = fd;
+    j->name = strdup(fnam);
+    j->len = len;
+    j->directlen = directlen;
+    j->done = 0;
+    pthread_mutex_lock(&poolmutex);
+    ++nwriting;
+    pthread_mutex_unlock(&poolmutex);
+    if(backend == AW_URING){
+        if(!uring_submit(nbuf)){
+            pthread_mutex_lock(&poolmutex);
+            --nwriting;
+            pthread_mutex_unlock(&poolmutex);
+            close(fd);
+            unlink(fnam);
+            FREE(j->name);
+            aw_release(nbuf);
+            return FALSE;
+        }
+    }else{
+        pthread_mutex_lock(&poolmutex);
+        queue[qtail] = nbuf;
+        qtail = (qtail + 1) % (AW_NBUFFERS + 1);
+        pthread_cond_signal(&qcond);
+        pthread_mutex_unlock(&poolmutex);
+    }
+    return TRUE;
+}
+
+/**
+ * @brief aw_flush - wait until all queued files are written
+ */
+void aw_flush(){
+    pthread_mutex_lock(&poolmutex);
+    while(nwriting) pthread_cond_wait(&poolcond, &poolmutex);
+    pthread_mutex_unlock(&poolmutex);
+}
+
+/**
+ * @brief aw_stop - wait for all files and stop writer
+ */
+void aw_stop(){
+    if(backend == AW_NONE) return;
+    aw_flush();
+    if(backend == AW_URING){
+        if(uring_submit(-1)) pthread_join(reaper, NULL);
+        else pthread_cancel(reaper);
+        uring_close();
+    }else{
+        pthread_mutex_lock(&poolmutex);
+        stopping = TRUE;
+        pthread_cond_broadcast(&qcond);
+        pthread_mutex_unlock(&poolmutex);
+        for(int i = 0; i < AW_NWORKERS; ++i) pthread_join(workers[i], NULL);
+    }
+    for(int i = 0; i < AW_NBUFFERS; ++i) FREE(jobs[i].data);
+    bufsize = 0;
+    backend = AW_NONE;
+    DBG("Asynchronous writer stopped");
+}
@@ -0,0 +1,36 @@
+/*
+ * This file is part of the CCD_Capture project.
+ * Copyright 2026 Edward V. Emelianov <edward.emelianoff@gmail.com>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// amount of buffers (max amount of files being written simultaneously)
+#define AW_NBUFFERS     4
+// alignment of buffers
+#define AW_ALIGN        4096
+
+int aw_start();
+int aw_running();
+const char *aw_backend();
+int aw_getbuf(size_t size, uint8_t **data);
+int aw_write(int nbuf, const char *fnam, int rewrite, size_t len, size_t directlen);
+void aw_release(int nbuf);
+void aw_flush();
+void aw_stop();
@@ -0,0 +1,397 @@
+/*
+ * This file is part of the CCD_Capture project.
+ * Copyright 2026 Edward V. Emelianov <edward.emelianoff@gmail.com>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Pipeline benchmark: run the server in-process with given plugin (by default - devdummy.so),
+ * attach K SHM readers and M image socket readers and report sustained framerate, latency
+ * percentiles of each stage, CPU time and dropped frames as JSON.
+ */
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <usefull_macros.h>
+
+#include "ccdfunc.h"
+#include "cmdlnopts.h"
+#include "server.h"
+#include "socket.h"
+
+typedef struct{
+    char *plugin;       // camera plugin
+    char *port;         // command port
+    char *saveprefix;   // save frames of first SHM reader with this prefix
+    char *output;       // output JSON file (stdout by default)
+    int width, height;  // frame size (only for plugins allowing to change `array`, like dummy)
+    int _8bit;          // 8-bit mode
+    int shmreaders;     // amount of SHM readers
+    int sockreaders;    // amount of image socket readers
+    int shmkey;         // SHM key (differs from default to not interfere with working server)
+    int verbose;        // verbose level of server messages
+    int help;
+    double exptime;     // exposure time
+    double duration;    // test duration (seconds)
+} bench_pars;
+
+static bench_pars B = {
+    .plugin = "devdummy.so",
+    .port = "34560",
+    .shmreaders = 1,
+    .sockreaders = 1,
+    .shmkey = 7777780,
+    .exptime = 0.001,
+    .duration = 10.,
+};
+
+static sl_option_t benchopts[] = {
+    {"plugin",  NEED_ARG,   NULL,   'p',    arg_string, APTR(&B.plugin),    "camera plugin (default: devdummy.so)"},
+    {"port",    NEED_ARG,   NULL,   'P',    arg_string, APTR(&B.port),      "command port (image port is next one; default: 34560)"},
+    {"width",   NEED_ARG,   NULL,   'w',    arg_int,    APTR(&B.width),     "frame width (default: plugin's array width)"},
+    {"height",  NEED_ARG,   NULL,   'H',    arg_int,    APTR(&B.height),    "frame height (default: plugin's array height)"},
+    {"8bit",    NO_ARGS,    NULL,   '8',    arg_int,    APTR(&B._8bit),     "run in 8-bit mode"},
+    {"exptime", NEED_ARG,   NULL,   'x',    arg_double, APTR(&B.exptime),   "exposure time, seconds (default: 0.001)"},
+    {"duration",NEED_ARG,   NULL,   'd',    arg_double, APTR(&B.duration),  "duration of test, seconds (default: 10)"},
+    {"shmreaders",NEED_ARG, NULL,   'k',    arg_int,    APTR(&B.shmreaders),"amount of SHM readers (default: 1)"},
+    {"sockreaders",NEED_ARG,NULL,   'm',    arg_int,    APTR(&B.sockreaders),"amount of image socket readers (default: 1)"},
+    {"shmkey",  NEED_ARG,   NULL,   'K',    arg_int,    APTR(&B.shmkey),    "shared memory key (default: 7777780)"},
+    {"save",    NEED_ARG,   NULL,   's',    arg_string, APTR(&B.saveprefix),"save frames got by first SHM reader with given prefix"},
+    {"output",  NEED_ARG,   NULL,   'o',    arg_string, APTR(&B.output),    "write JSON into this file instead of stdout"},
+    {"verbose", NO_ARGS,    NULL,   'V',    arg_none,   APTR(&B.verbose),   "verbose level of server messages"},
+    {"help",    NO_ARGS,    NULL,   'h',    arg_int,    APTR(&B.help),      "show this help"},
+    end_option
+};
+
+// pipeline stages
+enum{
+    STAGE_EXPOSE,       // exposition overhead: from `startexposition` to `capture` minus exposure time
+    STAGE_READOUT,      // plugin's `capture`
+    STAGE_PERIOD,       // time between subsequent `capture` calls
+    STAGE_PUBLISH,      // from image timestamp to reader noticed new image number
+    STAGE_SHMCOPY,      // from image timestamp to end of SHM copy
+    STAGE_SOCKET,       // from image timestamp to end of receiving over image socket
+    STAGE_SAVE,         // saveFITS()
+    STAGE_AMOUNT
+};
+
+typedef struct{
+    const char *name;
+    double *val;
+    size_t N, size;
+    pthread_mutex_t mutex;
+} stage_t;
+
+static stage_t stages[STAGE_AMOUNT] = {
+    [STAGE_EXPOSE]  = {.name = "expose_overhead"},
+    [STAGE_READOUT] = {.name = "readout"},
+    [STAGE_PERIOD]  = {.name = "frame_period"},
+    [STAGE_PUBLISH] = {.name = "publish"},
+    [STAGE_SHMCOPY] = {.name = "shm_copy"},
+    [STAGE_SOCKET]  = {.name = "socket_transfer"},
+    [STAGE_SAVE]    = {.name = "save"},
+};
+
+typedef struct{
+    pthread_t thread;
+    int issock;         // socket (TRUE) or SHM (FALSE) reader
+    int save;           // save got frames
+    size_t received;    // amount of frames got
+    size_t dropped;     // frames lost
+    size_t errors;      // failed reads
+} reader_t;
+
+static atomic_int measuring = 0, stopreaders = 0;
+static int (*plugin_capture)(cc_IMG *ima) = NULL;
+static int (*plugin_startexp)() = NULL;
+static double Texpstart = 0., Tlastcapture = 0.;
+
+// the server calls `signals()` from main.c in case of errors
+void signals(int signo){
+    stop_server();
+    exit(signo);
+}
+
+static void addsample(int stage, double val){
+    if(!atomic_load(&measuring)) return;
+    stage_t *s = &stages[stage];
+    pthread_mutex_lock(&s->mutex);
+    if(s->N == s->size){
+        s->size += 1024;
+        double *nv = realloc(s->val, s->size * sizeof(double));
+        if(!nv){
+            pthread_mutex_unlock(&s->mutex);
+            return;
+        }
+        s->val = nv;
+    }
+    s->val[s->N++] = val;
+    pthread_mutex_unlock(&s->mutex);
+}
+
+static int bench_startexp(){
+    Texpstart = sl_dtime();
+    return plugin_startexp();
+}
+
+static int bench_capture(cc_IMG *ima){
+    double t0 = sl_dtime();
+    if(Texpstart > 0.) addsample(STAGE_EXPOSE, t0 - Texpstart - B.exptime);
+    if(Tlastcapture > 0.) addsample(STAGE_PERIOD, t0 - Tlastcapture);
+    Tlastcapture = t0;
+    int r = plugin_capture(ima);
+    addsample(STAGE_READOUT, sl_dtime() - t0);
+    return r;
+}
+
+// read exactly N bytes with timeout
+static int readall(int fd, uint8_t *buf, size_t N){
+    double t0 = sl_dtime();
+    while(N && sl_dtime() - t0 < CC_CLIENT_TIMEOUT){
+        ssize_t rd = read(fd, buf, N);
+        if(rd == 0) return FALSE;
+        if(rd < 0){
+            if(errno == EAGAIN || errno == EINTR) continue;
+            return FALSE;
+        }
+        buf += rd; N -= rd;
+        t0 = sl_dtime();
+    }
+    return (N == 0);
+}
+
+// get next image over image socket; return its number or 0 if failed
+static size_t sockimage(cc_IMG *hdr, uint8_t **data, size_t *datasize){
+    int fd = cc_open_socket(FALSE, GP->imageport, 1);
+    if(fd < 0) return 0;
+    size_t ret = 0;
+    if(!readall(fd, (uint8_t*)hdr, sizeof(cc_IMG)) || hdr->MAGICK != CC_SHM_MAGIC) goto rtn;
+    if(*datasize < hdr->bytelen){
+        uint8_t *n = realloc(*data, hdr->bytelen);
+        if(!n) goto rtn;
+        *data = n;
+        *datasize = hdr->bytelen;
+    }
+    if(readall(fd, *data, hdr->bytelen)) ret = hdr->imnumber;
+rtn:
+    close(fd);
+    return ret;
+}
+
+// SHM or socket reader; both use SHM header to know when new image is ready
+static void *reader(void *arg){
+    reader_t *r = (reader_t*)arg;
+    cc_IMG *shm = cc_getshm(GP->shmkey, 0);
+    if(!shm){
+        WARNX("Reader can't attach SHM");
+        return NULL;
+    }
+    cc_IMG *loc = cc_newimage(16, 1, 1), hdr;
+    uint8_t *sockdata = NULL;
+    size_t sockdatasize = 0;
+    size_t last = shm->imnumber;
+    while(!atomic_load(&stopreaders)){
+        if(*(volatile size_t*)&shm->imnumber == last){
+            usleep(100);
+            continue;
+        }
+        double tnotice = sl_dtime(), tstamp;
+        size_t got;
+        if(r->issock){
+            got = sockimage(&hdr, &sockdata, &sockdatasize);
+            tstamp = hdr.timestamp;
+        }else{
+            got = cc_copyimage(loc, shm, TRUE) ? loc->imnumber : 0;
+            tstamp = loc->timestamp;
+        }
+        if(!got){
+            ++r->errors;
+            continue;
+        }
+        double tgot = sl_dtime();
+        if(!atomic_load(&measuring)){
+            last = got;
+            continue;
+        }
+        if(r->received && got > last + 1) r->dropped += got - last - 1;
+        last = got;
+        ++r->received;
+        if(r->issock) addsample(STAGE_SOCKET, tgot - tstamp);
+        else{
+            addsample(STAGE_PUBLISH, tnotice - tstamp);
+            addsample(STAGE_SHMCOPY, tgot - tstamp);
+            if(r->save){
+                tgot = sl_dtime();
+                saveFITS(loc, NULL);
+                addsample(STAGE_SAVE, sl_dtime() - tgot);
+            }
+        }
+    }
+    shmdt(shm);
+    cc_freeimage(&loc);
+    FREE(sockdata);
+    return NULL;
+}
+
+static void *servthread(void *arg){
+    int *socks = (int*)arg;
+    server(socks[0], socks[1]);
+    return NULL;
+}
+
+static int cmpdbl(const void *a, const void *b){
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+// print stage statistics (in milliseconds)
+static void printstage(FILE *f, stage_t *s, int last){
+    fprintf(f, "    \"%s\": {\"n\": %zd", s->name, s->N);
+    if(s->N){
+        qsort(s->val, s->N, sizeof(double), cmpdbl);
+        double sum = 0.;
+        for(size_t i = 0; i < s->N; ++i) sum += s->val[i];
+#define PCT(p)  (1e3 * s->val[(size_t)((s->N - 1) * (p))])
+        fprintf(f, ", \"mean_ms\": %.4f, \"p50_ms\": %.4f, \"p90_ms\": %.4f, \"p99_ms\": %.4f, \"max_ms\": %.4f",
+                1e3 * sum / s->N, PCT(0.5), PCT(0.9), PCT(0.99), 1e3 * s->val[s->N - 1]);
+#undef PCT
+    }
+    fprintf(f, "}%s\n", last ? "" : ",");
+}
+
+static double rusage_time(struct rusage *u, int sys){
+    struct timeval *t = sys ? &u->ru_stime : &u->ru_utime;
+    return (double)t->tv_sec + t->tv_usec / 1e6;
+}
+
+int main(int argc, char **argv){
+    sl_init();
+    char *fakeargv[] = {argv[0], NULL};
+    parse_args(1, fakeargv); // init GP with defaults
+    sl_helpstring("Usage: %s [args]\n\tRun capture server in-process and report its performance as JSON\n\tArgs are:\n");
+    sl_parseargs(&argc, &argv, benchopts);
+    if(B.help) sl_showhelp(-1, benchopts);
+    if(B.duration <= 0.) ERRX("Duration should be positive");
+    if(B.exptime < 1e-6) ERRX("Exposure time should be positive");
+    if(B.shmreaders < 0 || B.sockreaders < 0) ERRX("Amount of readers can't be negative");
+    int port = atoi(B.port);
+    if(port < CC_PORTN_MIN || port >= CC_PORTN_MAX) ERRX("Wrong port value: %s", B.port);
+    GP->verbose = B.verbose;
+    GP->commondev = B.plugin;
+    GP->shmkey = B.shmkey;
+    GP->exptime = B.exptime;
+    GP->_8bit = B._8bit;
+    GP->port = B.port;
+    GP->imageport = MALLOC(char, 32);
+    snprintf(GP->imageport, 31, "%d", port + 1);
+    if(B.saveprefix) GP->outfileprefix = B.saveprefix;
+    // the server will get the same plugin structure, so we can modify it here
+    cc_Camera *cam = cc_open_camera(B.plugin);
+    if(!cam) ERRX("Can't open plugin %s", B.plugin);
+    if(!cam->capture || !cam->startexposition) ERRX("Plugin %s have no capture functions", B.plugin);
+    if(B.width > 0 || B.height > 0){
+        if(B.width > 0) cam->array.w = cam->field.w = B.width;
+        if(B.height > 0) cam->array.h = cam->field.h = B.height;
+        cam->array.xoff = cam->array.yoff = cam->field.xoff = cam->field.yoff = 0;
+    }
+    plugin_capture = cam->capture;
+    plugin_startexp = cam->startexposition;
+    cam->capture = bench_capture;
+    cam->startexposition = bench_startexp;
+    // run server
+    int socks[2];
+    socks[0] = cc_open_socket(TRUE, GP->port, 1);
+    socks[1] = cc_open_socket(TRUE, GP->imageport, 2);
+    if(socks[0] < 0 || socks[1] < 0) ERRX("Can't open server sockets");
+    pthread_t srv;
+    if(pthread_create(&srv, NULL, servthread, socks)) ERR("pthread_create()");
+    // control connection
+    int ctrl = -1;
+    double t0 = sl_dtime();
+    while((ctrl = cc_open_socket(FALSE, GP->port, 1)) < 0 && sl_dtime() - t0 < 5.) usleep(10000);
+    if(ctrl < 0) ERRX("Can't connect to server");
+    cc_strbuff *cbuf = cc_strbufnew(BUFSIZ, 256);
+    int key = 0;
+    t0 = sl_dtime();
+    while(CC_RESULT_OK != cc_getint(ctrl, cbuf, CC_CMD_SHMEMKEY, &key) && sl_dtime() - t0 < 5.) usleep(10000);
+    if(key != B.shmkey) ERRX("Server didn't create SHM");
+    if(CC_RESULT_OK != cc_setfloat(ctrl, cbuf, CC_CMD_EXPOSITION, (float)B.exptime)) ERRX("Can't set exposure time");
+    if(CC_RESULT_OK != cc_setint(ctrl, cbuf, CC_CMD_8BIT, B._8bit)) WARNX("Can't change bit depth");
+    // run readers
+    int nreaders = B.shmreaders + B.sockreaders;
+    reader_t *readers = MALLOC(reader_t, nreaders + 1);
+    for(int i = 0; i < nreaders; ++i){
+        readers[i].issock = (i >= B.shmreaders);
+        readers[i].save = (i == 0 && B.saveprefix && B.shmreaders);
+        if(pthread_create(&readers[i].thread, NULL, reader, &readers[i])) ERR("pthread_create()");
+    }
+    if(CC_RESULT_OK != cc_setint(ctrl, cbuf, CC_CMD_INFTY, 1)) ERRX("Can't run infinity loop");
+    // wait for first frame and start measurement
+    int imno0 = 0, imno1 = 0;
+    t0 = sl_dtime();
+    while(sl_dtime() - t0 < 5. + B.exptime){
+        if(CC_RESULT_OK == cc_getint(ctrl, cbuf, CC_CMD_IMNUMBER, &imno0) && imno0 > 0) break;
+        usleep(1000);
+    }
+    if(imno0 < 1) ERRX("Server didn't produce any frame");
+    struct rusage ru0, ru1;
+    getrusage(RUSAGE_SELF, &ru0);
+    atomic_store(&measuring, 1);
+    double tstart = sl_dtime();
+    while(sl_dtime() - tstart < B.duration){
+        usleep(100000);
+        if(cc_refreshbuf(ctrl, cbuf)) while(cc_getline(cbuf)); // drop all unwanted messages
+    }
+    if(CC_RESULT_OK != cc_getint(ctrl, cbuf, CC_CMD_IMNUMBER, &imno1)) WARNX("Can't get last image number");
+    double tend = sl_dtime();
+    atomic_store(&measuring, 0);
+    getrusage(RUSAGE_SELF, &ru1);
+    cc_setint(ctrl, cbuf, CC_CMD_INFTY, 0);
+    atomic_store(&stopreaders, 1);
+    for(int i = 0; i < nreaders; ++i) pthread_join(readers[i].thread, NULL);
+    close(ctrl);
+    stop_server();
+    pthread_join(srv, NULL);
+    // report
+    FILE *f = stdout;
+    if(B.output && !(f = fopen(B.output, "w"))) ERR("Can't open %s", B.output);
+    double wall = tend - tstart;
+    double utime = rusage_time(&ru1, 0) - rusage_time(&ru0, 0), stime = rusage_time(&ru1, 1) - rusage_time(&ru0, 1);
+    size_t frames = (imno1 > imno0) ? (size_t)(imno1 - imno0) : 0, dropped = 0;
+    fprintf(f, "{\n  \"config\": {\"plugin\": \"%s\", \"width\": %d, \"height\": %d, \"bitpix\": %d, "
+            "\"exptime\": %g, \"duration\": %g, \"shm_readers\": %d, \"socket_readers\": %d, \"save\": %s},\n",
+            B.plugin, cam->array.w, cam->array.h, B._8bit ? 8 : 16, B.exptime, wall,
+            B.shmreaders, B.sockreaders, B.saveprefix ? "true" : "false");
+    fprintf(f, "  \"frames\": %zd,\n  \"fps\": %.3f,\n", frames, frames / wall);
+    fprintf(f, "  \"cpu\": {\"user_s\": %.3f, \"sys_s\": %.3f, \"load\": %.3f, \"per_frame_ms\": %.4f},\n",
+            utime, stime, (utime + stime) / wall, frames ? 1e3 * (utime + stime) / frames : 0.);
+    fprintf(f, "  \"stages\": {\n");
+    for(int i = 0; i < STAGE_AMOUNT; ++i) printstage(f, &stages[i], i == STAGE_AMOUNT - 1);
+    fprintf(f, "  },\n  \"readers\": [\n");
+    for(int i = 0; i < nreaders; ++i){
+        reader_t *r = &readers[i];
+        dropped += r->dropped;
+        fprintf(f, "    {\"type\": \"%s\", \"received\": %zd, \"dropped\": %zd, \"errors\": %zd}%s\n",
+                r->issock ? "socket" : "shm", r->received, r->dropped, r->errors, (i == nreaders - 1) ? "" : ",");
+    }
+    fprintf(f, "  ],\n  \"dropped\": %zd\n}\n", dropped);
+    if(f != stdout) fclose(f);
+    FREE(readers);
+    return 0;
+}
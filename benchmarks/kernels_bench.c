@@ -0,0 +1,260 @@
+/*
+ * This file is part of the CCD_Capture project.
+ * Copyright 2026 Edward V. Emelianov <edward.emelianoff@gmail.com>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Micro-benchmarks of image kernels: statistics, histogram, cuts, equalization, colour mapping
+ * and FITS byte swap.
+ * Each kernel runs over synthetic 8- and 16-bit frames of several sizes with different
+ * amount of threads; results (ns per pixel and GB/s of input data) are printed as JSON.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <usefull_macros.h>
+
+#include "ccdfunc.h"
+#include "cmdlnopts.h"
+#include "imfunc.h"
+#include "sources.h"
+
+#ifdef OMP_FOUND
+// local omp.h hides system one
+void omp_set_num_threads(int num_threads);
+int omp_get_num_procs(void);
+#endif
+
+typedef struct{
+    char *sizes;        // comma-separated list of frame sizes
+    char *output;       // output JSON file (stdout by default)
+    int maxthreads;     // max amount of threads
+    int help;
+    double mintime;     // minimal time of each measurement
+} bench_pars;
+
+static bench_pars B = {
+    .sizes = "1024,2048,4096",
+    .mintime = 0.2,
+};
+
+static sl_option_t benchopts[] = {
+    {"sizes",   NEED_ARG,   NULL,   's',    arg_string, APTR(&B.sizes),     "comma-separated list of square frame sizes (default: 1024,2048,4096)"},
+    {"threads", NEED_ARG,   NULL,   't',    arg_int,    APTR(&B.maxthreads),"max amount of threads (default: amount of CPUs)"},
+    {"mintime", NEED_ARG,   NULL,   'm',    arg_double, APTR(&B.mintime),   "minimal duration of each measurement, seconds (default: 0.2)"},
+    {"output",  NEED_ARG,   NULL,   'o',    arg_string, APTR(&B.output),    "write JSON into this file instead of stdout"},
+    {"help",    NO_ARGS,    NULL,   'h',    arg_int,    APTR(&B.help),      "show this help"},
+    end_option
+};
+
+typedef enum{
+    KERNEL_STAT,
+    KERNEL_HISTO,
+    KERNEL_CUTS,
+    KERNEL_EQUALIZE,
+    KERNEL_GRAY,
+    KERNEL_COLOR,
+    KERNEL_SWAP16,
+    KERNEL_CALIB,
+    KERNEL_BIN2,
+    KERNEL_BIN3,
+    KERNEL_SOURCES,
+    KERNEL_AMOUNT
+} kernel_t;
+
+static const char *kernelnames[KERNEL_AMOUNT] = {
+    [KERNEL_STAT] = "stat",
+    [KERNEL_HISTO] = "histogram",
+    [KERNEL_CUTS] = "cuts",
+    [KERNEL_EQUALIZE] = "equalize",
+    [KERNEL_GRAY] = "colorize_gray",
+    [KERNEL_COLOR] = "colorize_color",
+    [KERNEL_SWAP16] = "swap16_bzero",
+    [KERNEL_CALIB] = "calibrate",
+    [KERNEL_BIN2] = "binning_2x2",
+    [KERNEL_BIN3] = "binning_3x3",
+    [KERNEL_SOURCES] = "sources",
+};
+
+static displaylut *lut = NULL;
+static uint8_t *rgb = NULL;
+static uint32_t hist[0x10000];
+static sourcetable srctab;
+static float *cbias = NULL, *cdark = NULL, *cgain = NULL; // master frames for `calibrate`
+
+// kernels could call `signals()` from main.c in case of errors
+void signals(int signo){
+    exit(signo);
+}
+
+// synthetic frame: gaussian-like noise over slope background with some "stars"
+static cc_IMG *mkframe(int size, int bitpix){
+    int nbytes = (bitpix + 7) / 8;
+    cc_IMG *img = MALLOC(cc_IMG, 1);
+    img->w = img->h = size;
+    img->bitpix = bitpix;
+    img->bytelen = (size_t)size * size * nbytes;
+    img->datasize = img->bytelen;
+    img->data = malloc(img->bytelen);
+    if(!img->data) ERR("malloc()");
+    int max = (1 << bitpix) - 1;
+    uint32_t rnd = 12345;
+    for(int y = 0; y < size; ++y){
+        for(int x = 0; x < size; ++x){
+            rnd = rnd * 1664525u + 1013904223u;
+            int noise = (int)((rnd >> 24) & 0x3f) - 32;
+            int val = max / 8 + (x + y) * (max / 16) / size + noise * (max / 1024 + 1);
+            if(((x * 31 + y * 17) & 0xffff) == 0) val = max; // some saturated pixels
+            if(val < 0) val = 0; else if(val > max) val = max;
+            if(nbytes == 1) ((uint8_t*)img->data)[y*size + x] = (uint8_t)val;
+            else ((uint16_t*)img->data)[y*size + x] = (uint16_t)val;
+        }
+    }
+    return img;
+}
+
+static void freeframe(cc_IMG **img){
+    if(!img || !*img) return;
+    FREE((*img)->data);
+    FREE(*img);
+}
+
+static void runkernel(kernel_t k, cc_IMG *img){
+    switch(k){
+        case KERNEL_STAT:
+            img->gotstat = 0;
+            calculate_stat(img);
+        break;
+        case KERNEL_HISTO:
+            histogram(img, hist);
+        break;
+        case KERNEL_CUTS:
+            lut->low = -1; // force levels recalculation
+            mkcuts(img, lut);
+        break;
+        case KERNEL_EQUALIZE:
+            equalize(img, lut);
+        break;
+        case KERNEL_GRAY:
+            set_palette(lut, COLORFN_BWLINEAR);
+            colorize(img, lut, rgb);
+        break;
+        case KERNEL_COLOR:
+            set_palette(lut, COLORFN_SQRT);
+            colorize(img, lut, rgb);
+        break;
+        case KERNEL_SWAP16: // output buffer of 3*w*h bytes is enough
+            swap16_bzero((const uint16_t*)img->data, (uint16_t*)rgb, (size_t)img->w * img->h);
+        break;
+        case KERNEL_CALIB:{
+            cc_IMG out = *img;
+            out.data = rgb;
+            calibrate(img, &out, cbias, cdark, 2.f, cgain);
+        }
+        break;
+        case KERNEL_BIN2:
+        case KERNEL_BIN3:{
+            cc_IMG out = *img;
+            out.data = rgb;
+            int b = (k == KERNEL_BIN2) ? 2 : 3;
+            binimage(img, &out, b, b, 0);
+        }
+        break;
+        case KERNEL_SOURCES:
+            findsources(img, SOURCES_NSIGMA, SOURCES_MINPIX, &srctab);
+        break;
+        default:
+        break;
+    }
+}
+
+// run kernel at least B.mintime seconds; return mean time of one pass
+static double measure(kernel_t k, cc_IMG *img){
+    runkernel(k, img); // warm up
+    size_t N = 0;
+    double t0 = sl_dtime(), t;
+    do{
+        runkernel(k, img);
+        ++N;
+    }while((t = sl_dtime() - t0) < B.mintime);
+    return t / N;
+}
+
+int main(int argc, char **argv){
+    sl_init();
+    char *fakeargv[] = {argv[0], NULL};
+    parse_args(1, fakeargv); // init GP with defaults
+    sl_helpstring("Usage: %s [args]\n\tMeasure image processing kernels and report results as JSON\n\tArgs are:\n");
+    sl_parseargs(&argc, &argv, benchopts);
+    if(B.help) sl_showhelp(-1, benchopts);
+    if(B.mintime <= 0.) ERRX("Measurement time should be positive");
+    GP->verbose = 0; // don't print statistics
+    int nproc = 1;
+#ifdef OMP_FOUND
+    nproc = omp_get_num_procs();
+#endif
+    if(B.maxthreads < 1 || B.maxthreads > nproc) B.maxthreads = nproc;
+    lut = new_displaylut();
+    FILE *f = stdout;
+    if(B.output && !(f = fopen(B.output, "w"))) ERR("Can't open %s", B.output);
+    fprintf(f, "{\n  \"config\": {\"max_threads\": %d, \"min_time\": %g, \"swap16\": \"%s\"},\n  \"results\": [\n",
+            B.maxthreads, B.mintime, swap16_bzero_impl());
+    char *sizes = strdup(B.sizes), *saveptr = NULL;
+    int first = TRUE;
+    for(char *tok = strtok_r(sizes, ",", &saveptr); tok; tok = strtok_r(NULL, ",", &saveptr)){
+        int size = atoi(tok);
+        if(size < 16 || size > 32768){
+            WARNX("Wrong frame size: %s", tok);
+            continue;
+        }
+        size_t s = (size_t)size * size;
+        rgb = MALLOC(uint8_t, s * 3);
+        cbias = MALLOC(float, s); cdark = MALLOC(float, s); cgain = MALLOC(float, s);
+        for(size_t i = 0; i < s; ++i){
+            cbias[i] = 10.f + (i & 7);
+            cdark[i] = 0.5f * (i & 3);
+            cgain[i] = 0.9f + 0.01f * (i & 15);
+        }
+        for(int bitpix = 8; bitpix <= 16; bitpix += 8){
+            cc_IMG *img = mkframe(size, bitpix);
+            mkcuts(img, lut); // initial levels for colorize
+            for(int nth = 1; nth <= B.maxthreads; nth = (nth < B.maxthreads && nth * 2 > B.maxthreads) ? B.maxthreads : nth * 2){
+#ifdef OMP_FOUND
+                omp_set_num_threads(nth);
+#endif
+                for(kernel_t k = 0; k < KERNEL_AMOUNT; ++k){
+                    if(k == KERNEL_SWAP16 && bitpix != 16) continue;
+                    double t = measure(k, img);
+                    size_t inbytes = img->bytelen;
+                    fprintf(f, "%s    {\"kernel\": \"%s\", \"size\": %d, \"bitpix\": %d, \"threads\": %d, "
+                            "\"time_ms\": %.4f, \"ns_per_pixel\": %.4f, \"gb_per_s\": %.3f}",
+                            first ? "" : ",\n", kernelnames[k], size, bitpix, nth,
+                            t * 1e3, t * 1e9 / s, inbytes / t / 1e9);
+                    first = FALSE;
+                }
+                if(nth == B.maxthreads) break;
+            }
+            freeframe(&img);
+        }
+        FREE(rgb);
+        FREE(cbias); FREE(cdark); FREE(cgain);
+    }
+    FREE(sizes);
+    FREE(lut);
+    fprintf(f, "\n  ]\n}\n");
+    if(f != stdout) fclose(f);
+    return 0;
+}
@@ -0,0 +1,386 @@
+/*
+ * This file is part of the CCD_Capture project.
+ * Copyright 2026 Edward V. Emelianov <edward.emelianoff@gmail.com>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <fitsio.h>
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <usefull_macros.h>
+
+#include "calib.h"
+#include "cmdlnopts.h"
+#include "imfunc.h"
+#include "omp.h"
+
+/**
+ * @brief readmaster - read 2D FITS image as float array
+ * @param fnam    - file name
+ * @param w, h    (io) - image size (if *w == 0 - any size)
+ * @param exptime (o) - EXPTIME value or NAN if absent
+ * @return allocated array or NULL if failed
+ */
+static float *readmaster(const char *fnam, int *w, int *h, double *exptime){
+    fitsfile *fp;
+    int status = 0, naxis = 0, bitpix;
+    long naxes[2] = {0};
+    float *data = NULL;
+    if(fits_open_image(&fp, fnam, READONLY, &status)){
+        fits_report_error(stderr, status);
+        LOGERR("Can't open master %s", fnam);
+        return NULL;
+    }
+    if(fits_get_img_param(fp, 2, &bitpix, &naxis, naxes, &status) || naxis != 2){
+        WARNX(_("%s isn't a 2D image"), fnam);
+        goto ret;
+    }
+    if(*w && (naxes[0] != *w || naxes[1] != *h)){
+        WARNX(_("Size of %s (%ldx%ld) differs from %dx%d"), fnam, naxes[0], naxes[1], *w, *h);
+        goto ret;
+    }
+    size_t n = naxes[0] * naxes[1];
+    data = MALLOC(float, n);
+    if(fits_read_img(fp, TFLOAT, 1, n, NULL, data, NULL, &status)){
+        fits_report_error(stderr, status);
+        FREE(data);
+        goto ret;
+    }
+    if(fits_read_key(fp, TDOUBLE, "EXPTIME", exptime, NULL, &status)){
+        *exptime = NAN;
+        status = 0;
+    }
+    *w = naxes[0]; *h = naxes[1];
+ret:
+    status = 0;
+    fits_close_file(fp, &status);
+    return data;
+}
+
+/**
+ * @brief calib_load - load master frames
+ * if bias is pointed, it's subtracted from dark and flat; dark is scaled by exposure time only if it has EXPTIME and bias pointed
+ * @param bias - master bias file name or NULL
+ * @param dark - master dark file name or NULL
+ * @param flat - master flat file name or NULL
+ * @return allocated structure or NULL if failed or no masters pointed
+ */
+calmasters *calib_load(const char *bias, const char *dark, const char *flat){
+    if(!bias && !dark && !flat) return NULL;
+    int w = 0, h = 0;
+    double texp, tdark = NAN;
+    float *b = NULL, *d = NULL, *f = NULL;
+    if(bias && !(b = readmaster(bias, &w, &h, &texp))) return NULL;
+    if(dark && !(d = readmaster(dark, &w, &h, &tdark))) goto err;
+    if(flat && !(f = readmaster(flat, &w, &h, &texp))) goto err;
+    size_t n = w * h;
+    calmasters *C = MALLOC(calmasters, 1);
+    C->w = w; C->h = h;
+    if(!b) b = MALLOC(float, n); // zeros
+    if(!d) d = MALLOC(float, n);
+    else if(bias){ // dark current per second
+        C->scaledark = (isfinite(tdark) && tdark > 0.);
+        float k = C->scaledark ? 1./tdark : 1.;
+        OMP_FOR()
+        for(size_t i = 0; i < n; ++i) d[i] = (d[i] - b[i]) * k;
+    }else{
+        WARNX(_("No master bias: dark would be subtracted without scaling"));
+        OMP_FOR()
+        for(size_t i = 0; i < n; ++i) d[i] -= b[i];
+    }
+    if(f){ // gain = mean(flat) / flat, bad (non-positive) pixels are zeroed
+        double sum = 0.;
+        #pragma omp parallel for reduction(+:sum)
+        for(size_t i = 0; i < n; ++i){
+            f[i] -= b[i];
+            sum += f[i];
+        }
+        float mean = sum / n;
+        if(mean <= 0.f){
+            WARNX(_("Bad master flat %s: mean level %g"), flat, mean);
+            FREE(C);
+            goto err;
+        }
+        OMP_FOR()
+        for(size_t i = 0; i < n; ++i) f[i] = (f[i] > 0.f) ? mean / f[i] : 0.f;
+    }else{
+        f = MALLOC(float, n);
+        for(size_t i = 0; i < n; ++i) f[i] = 1.f;
+    }
+    C->bias = b; C->dark = d; C->gain = f;
+    verbose(1, _("Calibration masters loaded: %dx%d"), w, h);
+    LOGMSG("Calibration masters: bias=%s, dark=%s, flat=%s (%dx%d)", bias ? bias : "-",
+           dark ? dark : "-", flat ? flat : "-", w, h);
+    return C;
+err:
+    FREE(b); FREE(d); FREE(f);
+    return NULL;
+}
+
+/**
+ * @brief calib_apply - calibrate raw image and put result into `cal` (header copied from `raw`)
+ * @param C   - master frames
+ * @param raw (i) - raw image
+ * @param cal (o) - calibrated image (its `data` should be large enough)
+ * @return FALSE if geometry of `raw` differs from masters
+ */
+int calib_apply(calmasters *C, cc_IMG *raw, cc_IMG *cal){
+    static int warned = FALSE;
+    if(!C || !raw || !cal) return FALSE;
+    if(raw->w != C->w || raw->h != C->h || cal->datasize < raw->bytelen){
+        if(!warned){
+            WARNX(_("Image size %dx%d differs from masters' %dx%d: not calibrated"), raw->w, raw->h, C->w, C->h);
+            LOGWARN("Image size %dx%d differs from masters' %dx%d: not calibrated", raw->w, raw->h, C->w, C->h);
+            warned = TRUE;
+        }
+        return FALSE;
+    }
+    warned = FALSE;
+    copyfields(cal, raw);
+    return calibrate(raw, cal, C->bias, C->dark, C->scaledark ? raw->exposure_time : 1.f, C->gain);
+}
+
+void calib_free(calmasters **C){
+    if(!C || !*C) return;
+    FREE((*C)->bias);
+    FREE((*C)->dark);
+    FREE((*C)->gain);
+    FREE(*C);
+}
+
+static const char *stacknames[STACK_AMOUNT] = {
+    [STACK_MEAN] = "mean",
+    [STACK_CLIP] = "clip",
+    [STACK_MEDIAN] = "median",
+};
+
+/**
+ * @brief stack_method_byname - get stacking method by its name
+ * @return method or STACK_AMOUNT if wrong name
+ */
+stack_method stack_method_byname(const char *name){
+    if(!name) return STACK_AMOUNT;
+    for(stack_method m = 0; m < STACK_AMOUNT; ++m)
+        if(0 == strcasecmp(name, stacknames[m])) return m;
+    return STACK_AMOUNT;
+}
+
+const char *stack_method_name(stack_method m){
+    if(m >= STACK_AMOUNT) return "unknown";
+    return stacknames[m];
+}
+
+/**
+ * @brief stack_open - start building master frame
+ * @param S   - stacker
+ * @param m   - method
+ * @param img - first image (to get its size)
+ * @param scratchdir - directory for scratch file (for median and clipping)
+ * @return FALSE if failed
+ */
+int stack_open(stacker *S, stack_method m, cc_IMG *img, const char *scratchdir){
+    if(!S || !img || m >= STACK_AMOUNT) return FALSE;
+    bzero(S, sizeof(stacker));
+    S->fd = -1;
+    S->method = m;
+    S->w = img->w; S->h = img->h;
+    S->bitpix = img->bitpix;
+    S->framesize = (size_t)img->w * img->h * cc_getNbytes(img);
+    if(m == STACK_MEAN){
+        S->sum = MALLOC(uint32_t, (size_t)img->w * img->h);
+        return TRUE;
+    }
+    if(!scratchdir || !*scratchdir) scratchdir = ".";
+    // unnamed file: nothing to clean after crash
+    S->fd = open(scratchdir, O_TMPFILE | O_RDWR, 0600);
+    if(S->fd < 0){ // filesystem don't support O_TMPFILE
+        char tmpl[PATH_MAX];
+        snprintf(tmpl, PATH_MAX, "%s/.stackXXXXXX", scratchdir);
+        S->fd = mkstemp(tmpl);
+        if(S->fd > -1) unlink(tmpl);
+    }
+    if(S->fd < 0){
+        WARN(_("Can't create scratch file in %s"), scratchdir);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+/**
+ * @brief stack_add - add next frame
+ * @return FALSE if failed (size changed or write error)
+ */
+int stack_add(stacker *S, cc_IMG *img){
+    if(!S || !img || (!S->sum && S->fd < 0)) return FALSE;
+    if(img->w != S->w || img->h != S->h || img->bitpix != S->bitpix){
+        WARNX(_("Frame %dx%d (%d bit) can't be stacked with %dx%d (%d bit)"), img->w, img->h, img->bitpix,
+              S->w, S->h, S->bitpix);
+        return FALSE;
+    }
+    if(S->sum){
+        if(S->nframes > 0xffff){
+            WARNX(_("Too many frames to stack"));
+            return FALSE;
+        }
+        size_t n = (size_t)S->w * S->h;
+        uint32_t *sum = S->sum;
+        if(S->bitpix > 8){
+            const uint16_t *d = (const uint16_t*)img->data;
+            OMP_FOR()
+            for(size_t i = 0; i < n; ++i) sum[i] += d[i];
+        }else{
+            const uint8_t *d = (const uint8_t*)img->data;
+            OMP_FOR()
+            for(size_t i = 0; i < n; ++i) sum[i] += d[i];
+        }
+    }else{
+        const uint8_t *d = (const uint8_t*)img->data;
+        off_t off = (off_t)S->nframes * S->framesize;
+        size_t rest = S->framesize;
+        while(rest){
+            ssize_t w = pwrite(S->fd, d, rest, off);
+            if(w < 0){
+                if(errno == EINTR) continue;
+                WARN(_("Can't write scratch file"));
+                return FALSE;
+            }
+            d += w; off += w; rest -= w;
+        }
+    }
+    S->exptime += img->exposure_time;
+    ++S->nframes;
+    return TRUE;
+}
+
+// quickselect: k-th smallest value of v[0..n-1] (array is reordered)
+static float select_k(float *v, int n, int k){
+    int l = 0, r = n - 1;
+    while(l < r){
+        float pivot = v[(l + r) / 2];
+        int i = l, j = r;
+        while(i <= j){
+            while(v[i] < pivot) ++i;
+            while(v[j] > pivot) --j;
+            if(i <= j){
+                float t = v[i]; v[i] = v[j]; v[j] = t;
+                ++i; --j;
+            }
+        }
+        if(k <= j) r = j;
+        else if(k >= i) l = i;
+        else break;
+    }
+    return v[k];
+}
+
+// median of v[0..n-1] (array is reordered)
+static float median(float *v, int n){
+    int k = n / 2;
+    float m = select_k(v, n, k);
+    if(n & 1) return m;
+    float lo = v[0]; // max of lower half
+    for(int i = 1; i < k; ++i) if(v[i] > lo) lo = v[i];
+    return (lo + m) / 2.f;
+}
+
+// sigma-clipped mean of v[0..n-1]: values farther than kappa*std from median are rejected (array is reordered)
+static float clipmean(float *v, int n, double kappa, float *tmp){
+    double sum = 0.;
+    for(int iter = 0; iter < STACK_CLIPITER && n > 2; ++iter){
+        memcpy(tmp, v, n * sizeof(float));
+        float med = median(tmp, n);
+        double s = 0., s2 = 0.;
+        for(int i = 0; i < n; ++i){ s += v[i]; s2 += (double)v[i] * v[i]; }
+        double mean = s / n, sigma = sqrt(fmax(s2 / n - mean * mean, 0.)) * kappa;
+        int nkept = 0;
+        for(int i = 0; i < n; ++i) if(fabs(v[i] - med) <= sigma) v[nkept++] = v[i];
+        if(nkept == n || nkept == 0) break;
+        n = nkept;
+    }
+    for(int i = 0; i < n; ++i) sum += v[i];
+    return sum / n;
+}
+
+/**
+ * @brief stack_result - calculate master frame
+ * Frames are processed by stripes of rows in parallel: each row of all frames is read from scratch file
+ * into per-pixel buffers, then each pixel is combined by its values
+ * @param S     - stacker
+ * @param kappa - clipping level (STACK_CLIP)
+ * @return allocated master frame (w*h floats) or NULL if failed; S->exptime is sum of exposure times (mean is S->exptime / S->nframes)
+ */
+float *stack_result(stacker *S, double kappa){
+    if(!S || S->nframes < 1) return NULL;
+    int w = S->w, h = S->h, N = S->nframes;
+    size_t npix = (size_t)w * h;
+    float *master = MALLOC(float, npix);
+    if(S->sum){
+        float k = 1.f / N;
+        OMP_FOR()
+        for(size_t i = 0; i < npix; ++i) master[i] = S->sum[i] * k;
+        return master;
+    }
+    size_t flen = S->framesize * N;
+    uint8_t *map = mmap(NULL, flen, PROT_READ, MAP_SHARED, S->fd, 0);
+    if(map == MAP_FAILED){
+        WARN(_("Can't map scratch file"));
+        FREE(master);
+        return NULL;
+    }
+    madvise(map, flen, MADV_WILLNEED);
+    int is16 = (S->bitpix > 8);
+    size_t rowlen = (size_t)w * (is16 ? 2 : 1);
+    #pragma omp parallel
+    {
+        float *vals = MALLOC(float, (size_t)w * N); // values of each pixel of row: vals[x*N + frame]
+        float *tmp = MALLOC(float, N);
+        #pragma omp for schedule(static)
+        for(int y = 0; y < h; ++y){
+            for(int f = 0; f < N; ++f){
+                const uint8_t *row = map + f * S->framesize + y * rowlen;
+                if(is16){
+                    const uint16_t *r = (const uint16_t*)row;
+                    for(int x = 0; x < w; ++x) vals[x*N + f] = r[x];
+                }else{
+                    for(int x = 0; x < w; ++x) vals[x*N + f] = row[x];
+                }
+            }
+            float *m = master + (size_t)y * w;
+            if(S->method == STACK_MEDIAN){
+                for(int x = 0; x < w; ++x) m[x] = median(vals + x*N, N);
+            }else{
+                for(int x = 0; x < w; ++x) m[x] = clipmean(vals + x*N, N, kappa, tmp);
+            }
+        }
+        FREE(tmp);
+        FREE(vals);
+    }
+    munmap(map, flen);
+    return master;
+}
+
+void stack_close(stacker *S){
+    if(!S) return;
+    FREE(S->sum);
+    if(S->fd > -1) close(S->fd);
+    S->fd = -1;
+    S->nframes = 0;
+}
@@ -0,0 +1,66 @@
+/*
+ * This file is part of the CCD_Capture project.
+ * Copyright 2026 Edward V. Emelianov <edward.emelianoff@gmail.com>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "ccdcapture.h"
+
+// master frames for real-time calibration of captured images
+typedef struct{
+    int w, h;           // size of master frames
+    float *bias;        // master bias (zeros if absent)
+    float *dark;        // master dark current per second (bias subtracted; zeros if absent)
+    float *gain;        // inverted normalized flat (ones if absent)
+    int scaledark;      // dark could be scaled by exposure time
+} calmasters;
+
+calmasters *calib_load(const char *bias, const char *dark, const char *flat);
+int calib_apply(calmasters *C, cc_IMG *raw, cc_IMG *cal);
+void calib_free(calmasters **C);
+
+// max amount of iterations of sigma-clipping
+#define STACK_CLIPITER      5
+// default clipping level (in sigmas)
+#define STACK_KAPPA         3.
+
+// methods of combining frames into master
+typedef enum{
+    STACK_MEAN,         // mean value
+    STACK_CLIP,         // sigma-clipped mean
+    STACK_MEDIAN,       // median
+    STACK_AMOUNT
+} stack_method;
+
+// builder of master frame: running sum for mean or scratch file with all frames for median/clipping
+typedef struct{
+    stack_method method;
+    int w, h;           // frame size
+    int bitpix;         // 8 or 16
+    int nframes;        // amount of frames added
+    double exptime;     // sum of exposure times
+    uint32_t *sum;      // running sum (STACK_MEAN)
+    int fd;             // scratch file with raw frames one after another (STACK_CLIP, STACK_MEDIAN), -1 if none
+    size_t framesize;   // size of frame in bytes
+} stacker;
+
+stack_method stack_method_byname(const char *name);
+const char *stack_method_name(stack_method m);
+int stack_open(stacker *S, stack_method m, cc_IMG *img, const char *scratchdir);
+int stack_add(stacker *S, cc_IMG *img);
+float *stack_result(stacker *S, double kappa);
+void stack_close(stacker *S);
@@ -265,6 +265,10 @@ typedef enum{
 #define CC_CMD_IMHEIGHT    "imheight"
 // get shared memory key
 #define CC_CMD_SHMEMKEY    "shmemkey"
+// regions of interest published in separate shared memory segments
+#define CC_CMD_ROI         "roi"
+// detection of sources on each frame
+#define CC_CMD_SOURCES     "sources"
 
 // CCD/CMOS
 #define CC_CMD_IMNUMBER    "imnumber"
@@ -293,6 +297,8 @@ typedef enum{
 #define CC_CMD_FASTSPD     "fastspeed"
 #define CC_CMD_DARK        "dark"
 #define CC_CMD_INFTY       "infty"
+#define CC_CMD_PLAN        "plan"
+#define CC_CMD_CAMERAS     "cameras"
 
 // focuser
 #define CC_CMD_FOCLIST     "foclist"
@@ -301,6 +307,7 @@ typedef enum{
 #define CC_CMD_FMINPOS     "focminpos"
 #define CC_CMD_FMAXPOS     "focmaxpos"
 #define CC_CMD_FTEMP       "foctemp"
+#define CC_CMD_AUTOFOCUS   "autofocus"
 
 // wheel
 #define CC_CMD_WLIST       "wlist"
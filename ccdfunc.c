@@ -16,16 +16,27 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <fitsio.h>
+#include <limits.h>
 #include <math.h>
 #include <stdio.h>
 #include <string.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <time.h>
+#include <unistd.h>
 
+#include "asyncwriter.h"
+#include "calib.h"
 #include "ccdfunc.h"
 #include "cmdlnopts.h"
+#include "fitsdirect.h"
+#include "fitshdr.h"
+#include "imfunc.h"
+#include "serfile.h"
 #include "socket.h"
 #ifdef IMAGEVIEW
 #include "imageview.h"
@@ -48,11 +59,6 @@ do{ int status = 0;                         \
         LOGERR("Fits error %d", status);    \
         fitserror = status;}                \
 }while(0)
-#define WRITEKEY(...)                           \
-do{ int status = 0;                             \
-    fits_update_key(__VA_ARGS__, &status);       \
-    if(status) fits_report_error(stderr, status);\
-}while(0)
 
 #define TMBUFSIZ 40
 
@@ -62,28 +68,224 @@ static size_t curtime(char *s_time){ // current date/time
     return strftime(s_time, TMBUFSIZ, "%d/%m/%Y,%H:%M:%S", localtime(&tm));
 }*/
 
-// check if I can create file prefix_XXXX.fits
-static int check_filenameprefix(char *buff, int buflen){
-    for(int num = 1; num < 1000000; num++){
-        if(snprintf(buff, buflen-1, "%s_%06d.fits", GP->outfileprefix, num) < 1)
-            return FALSE;
-        struct stat filestat;
-        if(stat(buff, &filestat)) // no such file or can't stat()
-            return TRUE;
-    }
-    return FALSE;
+// max number of file in directory `dir` with name like `base`_XXXXXX`suffix`
+static int maxfilenumber(const char *dir, const char *base, const char *suffix){
+    DIR *d = opendir(dir);
+    if(!d){
+        WARN(_("Can't open directory %s"), dir);
+        return 0;
+    }
+    size_t blen = strlen(base);
+    int max = 0;
+    struct dirent *de;
+    while((de = readdir(d))){
+        const char *n = de->d_name;
+        if(strncmp(n, base, blen) || n[blen] != '_') continue;
+        n += blen + 1;
+        if(*n < '0' || *n > '9') continue;
+        char *eptr;
+        long num = strtol(n, &eptr, 10);
+        if(strcmp(eptr, suffix) || num < 0 || num > INT_MAX) continue;
+        if(num > max) max = (int)num;
+    }
+    closedir(d);
+    DBG("Max number of %s/%s_XXXXXX%s is %d", dir, base, suffix, max);
+    return max;
 }
 
-// save FITS file `img` into GP->outfile or GP->outfileprefix_XXXX.fits
-// if outp != NULL, put into it strdup() of last file name
-// return FALSE if failed
-int saveFITS(cc_IMG *img, char **outp){
+// find name prefix_XXXXXX`suffix` for new file and reserve it (put into buff name with '!' to rewrite
+// reserved empty file); the counter is seeded once by directory scan and then only incremented
+static int check_filenameprefix(char *buff, int buflen, const char *suffix){
+    static char *lastprefix = NULL;
+    static char *lastsuffix = NULL;
+    static int lastnum = 0;
+    static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER; // called from saver and plan threads
     int ret = FALSE;
-    if(!img || !img->data){
-        WARNX("Bad data");
+    pthread_mutex_lock(&mutex);
+    if(!lastprefix || strcmp(lastprefix, GP->outfileprefix) || strcmp(lastsuffix, suffix)){
+        FREE(lastprefix);
+        FREE(lastsuffix);
+        lastprefix = strdup(GP->outfileprefix);
+        lastsuffix = strdup(suffix);
+        char *dir = strdup(GP->outfileprefix), *base = strrchr(dir, '/');
+        if(base){
+            *base++ = 0;
+            lastnum = maxfilenumber(*dir ? dir : "/", base, suffix);
+        }else lastnum = maxfilenumber(".", dir, suffix);
+        FREE(dir);
+    }
+    while(++lastnum < 1000000){
+        if(snprintf(buff, buflen-1, "!%s_%06d%s", GP->outfileprefix, lastnum, suffix) < 1) break;
+        int fd = open(buff + 1, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0666);
+        if(fd > -1){
+            close(fd);
+            ret = TRUE;
+            break;
+        }
+        if(errno != EEXIST){
+            WARN(_("Can't create file %s"), buff + 1);
+            break;
+        } // else file created by other process -> try next number
+    }
+    pthread_mutex_unlock(&mutex);
+    return ret;
+}
+
+// FITS header parts: static part of series (head and tail) and per-frame records
+static fitshdr hdrhead = {0}, hdrtail = {0}, hdrframe = {0}, hdrfull = {0};
+static pthread_mutex_t hdrmutex = PTHREAD_MUTEX_INITIALIZER;
+
+// add parameters of static header part to signature `sig` of length `l`
+#define ADDSIG(...) do{ if(l < (int)sizeof(sig)) l += snprintf(sig + l, sizeof(sig) - l, __VA_ARGS__); }while(0)
+
+/**
+ * @brief mkhdrtemplate - build static part of FITS header (the same for all series)
+ * Records are formatted only when something of them changed: camera model, pixel size,
+ * user's keywords or contents of files with additional records.
+ * @param img - image
+ */
+static void mkhdrtemplate(cc_IMG *img){
+    static char *lastsig = NULL;
+    char sig[4096];
+    int l = 0;
+    ADDSIG("%s|%g|%g|%s|%s|%s|%s|%s", img->model, img->pixel_x, img->pixel_y, GP->instrument ? GP->instrument : "",
+           GP->observers ? GP->observers : "", GP->prog_id ? GP->prog_id : "", GP->author ? GP->author : "",
+           GP->objname ? GP->objname : "");
+    if(GP->addhdr) for(char **f = GP->addhdr; *f; ++f){
+        struct stat st = {0};
+        stat(*f, &st);
+        ADDSIG("|%s:%ld.%09ld:%zd", *f, (long)st.st_mtim.tv_sec, st.st_mtim.tv_nsec, (ssize_t)st.st_size);
+    }
+    if(lastsig && 0 == strcmp(lastsig, sig)) return;
+    DBG("Rebuild FITS header template");
+    FREE(lastsig);
+    lastsig = strdup(sig);
+    fitshdr_clear(&hdrhead);
+    fitshdr_clear(&hdrtail);
+    fitshdr_addtempl(&hdrhead, "ORIGIN = 'SAO RAS' / Organization responsible for the data");
+    fitshdr_addtempl(&hdrhead, "OBSERVAT = 'Special Astrophysical Observatory, Russia' / Observatory name");
+    if(img->model[0]) fitshdr_addstr(&hdrhead, "DETECTOR", img->model, "Detector model");
+    if(GP->instrument) fitshdr_addstr(&hdrhead, "INSTRUME", GP->instrument, "Instrument");
+    else fitshdr_addtempl(&hdrhead, "INSTRUME = 'direct imaging'  / Instrument");
+    // pixel size
+    if(!isnan(img->pixel_x)){
+        fitshdr_addflt(&hdrhead, "PIXSIZEX", img->pixel_x, "Pixel size X (um)");
+        if(!isnan(img->pixel_y)){
+            char bufc[FLEN_CARD];
+            fitshdr_addflt(&hdrhead, "PIXSIZEY", img->pixel_y, "Pixel size Y (um)");
+            snprintf(bufc, FLEN_CARD, "%.1f x %.1f", img->pixel_x, img->pixel_y);
+            fitshdr_addstr(&hdrhead, "PIXSIZE", bufc, "Pixel size (h x v), um");
+        }
+    }
+    if(GP->addhdr){ // add records from server-side files
+        char **nxtfile = GP->addhdr;
+        while(*nxtfile){
+            int got = fitshdr_addfile(&hdrtail, *nxtfile);
+            if(got == 0) WARNX(_("Added 0 FITS records from %s"), *nxtfile);
+            else verbose(VERBOSE_SECONDARY, _("Added %d FITS records from %s"), got, *nxtfile);
+            ++nxtfile;
+        }
+        // these records are always formed when saving
+        const char *service[] = {"SIMPLE", "BITPIX", "NAXIS", "NAXIS1", "NAXIS2", "EXTEND", "BZERO", "BSCALE",
+                                 "DATE", "UNIXTIME", "DATE-OBS", "TIME", NULL};
+        for(const char **k = service; *k; ++k) fitshdr_delkey(&hdrtail, *k);
+    }
+    // add these keywords after all to override records from files
+    if(GP->observers) fitshdr_addstr(&hdrtail, "OBSERVER", GP->observers, "Observers");
+    if(GP->prog_id) fitshdr_addstr(&hdrtail, "PROG-ID", GP->prog_id, "Observation program identifier");
+    if(GP->author) fitshdr_addstr(&hdrtail, "AUTHOR", GP->author, "Author of the program");
+    if(GP->objname) fitshdr_addstr(&hdrtail, "OBJECT", GP->objname, "Object name");
+}
+#undef ADDSIG
+
+// per-frame records of FITS header
+static void mkhdrframe(cc_IMG *img){
+    char bufc[FLEN_CARD];
+    fitshdr_clear(&hdrframe);
+    fitshdr_addflt(&hdrframe, "EXPTIME", img->exposure_time, "Actual exposition time (sec)");
+    // BINNING / Binning
+    snprintf(bufc, FLEN_CARD, "%d x %d", img->bin_x, img->bin_y);
+    fitshdr_addstr(&hdrframe, "BINNING", bufc, "Binning (hbin x vbin)");
+    fitshdr_addint(&hdrframe, "XBINNING", img->bin_x, "Binning factor used on X axis");
+    fitshdr_addint(&hdrframe, "YBINNING", img->bin_y, "Binning factor used on Y axis");
+    // imtype
+    if(img->flags.dark) sprintf(bufc, "dark");
+    else if(GP->objtype) snprintf(bufc, FLEN_CARD, "%s", GP->objtype);
+    else sprintf(bufc, "light");
+    fitshdr_addstr(&hdrframe, "IMAGETYP", bufc, "Image type");
+    // geometry
+    snprintf(bufc, FLEN_CARD, "(%d, %d)(%d, %d)", img->field.xoff, img->field.yoff,
+             img->field.xoff + img->field.w - 1, img->field.yoff + img->field.h - 1);
+    fitshdr_addstr(&hdrframe, "VIEWFLD", bufc, "Camera maximal field of view");
+    snprintf(bufc, FLEN_CARD, "(%d, %d)(%d, %d)", img->array.xoff, img->array.yoff,
+             img->array.xoff + img->array.w - 1, img->array.yoff + img->array.h - 1);
+    fitshdr_addstr(&hdrframe, "ARRAYFLD", bufc, "Camera full array size (with overscans)");
+    snprintf(bufc, FLEN_CARD, "(%d, %d)(%d, %d)", img->geometry.xoff, img->geometry.yoff,
+             img->geometry.xoff + img->geometry.w - 1, img->geometry.yoff + img->geometry.h - 1);
+    fitshdr_addstr(&hdrframe, "GEOMETRY", bufc, "Camera current frame geometry");
+    fitshdr_addint(&hdrframe, "X0", img->geometry.xoff, "Subframe left border without binning");
+    fitshdr_addint(&hdrframe, "Y0", img->geometry.yoff, "Subframe upper border without binning");
+    // stat
+    fitshdr_addint(&hdrframe, "DATAMIN", 0, "Min pixel value");
+    fitshdr_addint(&hdrframe, "DATAMAX", (1<<img->bitpix) - 1, "Max pixel value");
+    if(img->gotstat){
+        fitshdr_addint(&hdrframe, "STATMIN", img->min, "Min data value");
+        fitshdr_addint(&hdrframe, "STATMAX", img->max, "Max data value");
+        fitshdr_addflt(&hdrframe, "STATAVR", img->avr, "Average data value");
+        fitshdr_addflt(&hdrframe, "STATSTD", img->std, "Std. of data value");
+    }
+    // camera parameters
+    if(!isnan(img->gain)) fitshdr_addflt(&hdrframe, "CAMGAIN", img->gain, "CMOS gain value");
+    if(!isnan(img->brightness)) fitshdr_addflt(&hdrframe, "CAMBRIGH", img->brightness, "CMOS brightness value");
+    if(!isnan(img->ccd_temp)) fitshdr_addflt(&hdrframe, "CAMTEMP", img->ccd_temp, "Camera temperature at exp. end, degr C");
+    if(!isnan(img->tbody)) fitshdr_addflt(&hdrframe, "BODYTEMP", img->tbody, "Camera body temperature at exp. end, degr C");
+    if(!isnan(img->thot)) fitshdr_addflt(&hdrframe, "HOTTEMP", img->thot, "Camera peltier hot side temperature at exp. end, degr C");
+    // wheel
+    if(img->flags.havewheel){
+        if(img->wmodel[0]) fitshdr_addstr(&hdrframe, "WHEEL", img->wmodel, "Filter wheel model");
+        if(img->wheelmax > 0) fitshdr_addint(&hdrframe, "FILTMAX", img->wheelmax, "Amount of filter positions");
+        fitshdr_addint(&hdrframe, "FILTER", img->wheelpos, "Current filter position");
+        if(!isnan(img->wheel_temp)) fitshdr_addflt(&hdrframe, "FILTTEMP", img->wheel_temp, "Filter wheel body temperature, degr C");
+    }
+    // focuser
+    if(img->flags.havefocuser){
+        if(img->fmodel[0]) fitshdr_addstr(&hdrframe, "FOCUSER", img->fmodel, "Focuser model");
+        if(!isnan(img->focpos)) fitshdr_addflt(&hdrframe, "FOCUS", img->focpos, "Current focuser position, mm");
+        if(!isnan(img->focmin)) fitshdr_addflt(&hdrframe, "FOCMIN", img->focmin, "Minimal focuser position, mm");
+        if(!isnan(img->focmax)) fitshdr_addflt(&hdrframe, "FOCMAX", img->focmax, "Maximal focuser position, mm");
+        if(!isnan(img->foc_temp)) fitshdr_addflt(&hdrframe, "FOCTEMP", img->foc_temp, "Focuser body temperature, degr C");
+    }
+    snprintf(bufc, FLEN_CARD, "%.6f", img->timestamp);
+    fitshdr_addval(&hdrframe, "TIMESTAM", bufc, "Time of acquisition end (UNIX)");
+    fitshdr_addint(&hdrframe, "IMSEQNO", (long)img->imnumber, "Number of image in full sequence");
+}
+
+// save file by cfitsio (for files with extended names like "file.fits[compress]")
+static int cfitsio_save(const char *fnam, const fitshdr *h, cc_IMG *img){
+    long naxes[2] = {img->w, img->h};
+    fitsfile *fp;
+    fitserror = 0;
+    TRYFITS(fits_create_file, &fp, fnam);
+    if(fitserror){
+        fitserror = 0;
         return FALSE;
     }
-    char fnam[PATH_MAX+1];
+    int nbytes = cc_getNbytes(img);
+    if(nbytes == 1) TRYFITS(fits_create_img, fp, BYTE_IMG, 2, naxes);
+    else TRYFITS(fits_create_img, fp, USHORT_IMG, 2, naxes);
+    if(fitserror) goto cloerr;
+    if(fitshdr_write(fp, h)) fitserror = 1;
+    if(nbytes == 1) TRYFITS(fits_write_img, fp, TBYTE, 1, naxes[0] * naxes[1], img->data);
+    else TRYFITS(fits_write_img, fp, TUSHORT, 1, naxes[0] * naxes[1], img->data);
+cloerr:
+    TRYFITS(fits_close_file, fp);
+    int ret = (fitserror == 0);
+    fitserror = 0;
+    return ret;
+}
+
+// get name of next file (GP->outfile or GP->outfileprefix_XXXX`suffix`) into fnam[PATH_MAX+1]
+static int getfilename(char *fnam, const char *suffix){
     if(!GP->outfile && !GP->outfileprefix){
         LOGWARN("Image not saved: neither filename nor filename prefix pointed");
         WARNX(_("Image not saved: neither filename nor filename prefix pointed"));
@@ -104,174 +306,375 @@ int saveFITS(cc_IMG *img, char **outp){
         }
         DBG("Will save as %s", GP->outfile);
     }else{ // user pointed output file prefix
-        if(!check_filenameprefix(fnam, PATH_MAX)){
+        if(!check_filenameprefix(fnam, PATH_MAX, suffix)){
             WARNX(_("Can't save file with prefix %s"), GP->outfileprefix);
             LOGERR("Can't save image with prefix %s", GP->outfileprefix);
             return FALSE;
         }
         DBG("Will save with prefix %s", GP->outfileprefix);
     }
-    pthread_mutex_lock(&img->mutex);
-    int width = img->w, height = img->h;
-    long naxes[2] = {width, height};
-    struct tm *tm_time;
+    return TRUE;
+}
+
+// add creation date/time records (override records from files)
+static void adddates(fitshdr *h){
+    char bufc[FLEN_CARD];
     double dsavetime = sl_dtime();
     time_t savetime = time(NULL);
+    struct tm *tm_time = gmtime(&savetime);
+    strftime(bufc, FLEN_CARD, "%Y-%m-%dT%H:%M:%S", tm_time);
+    fitshdr_addstr(h, "DATE", bufc, "file creation date (YYYY-MM-DDThh:mm:ss UT)");
+    snprintf(bufc, FLEN_CARD, "%.6f", dsavetime);
+    fitshdr_addval(h, "UNIXTIME", bufc, "File creation time (UNIX)");
+    tm_time = localtime(&savetime);
+    strftime(bufc, FLEN_CARD, "%Y/%m/%d", tm_time);
+    fitshdr_addstr(h, "DATE-OBS", bufc, "Date of observation (YYYY/MM/DD, local)");
+    strftime(bufc, FLEN_CARD, "%H:%M:%S", tm_time);
+    fitshdr_addstr(h, "TIME", bufc, "Creation time (hh:mm:ss, local)");
+}
+
+// add FILE / Input file original name
+static void addfilename(fitshdr *h, const char *fnam){
+    if(*fnam == '!') ++fnam;
+    fitshdr_addcomment(h, "Input file original name:");
+    fitshdr_addcomment(h, fnam);
+}
+
+// current multi-extension file of series (GP->mef) and SER file (GP->ser)
+static fitsseries series = {.fd = -1};
+static serfile ser = {.fd = -1};
+// master frame being built (GP->stack) and its file name
+static stacker stack = {.fd = -1};
+static char *stackname = NULL;
+
+// save master frame `data` (float) by cfitsio
+static int savemaster(const char *fnam, const fitshdr *h, float *data, int w, int ht){
+    long naxes[2] = {w, ht};
     fitsfile *fp;
     fitserror = 0;
     TRYFITS(fits_create_file, &fp, fnam);
+    if(fitserror){
+        fitserror = 0;
+        return FALSE;
+    }
+    TRYFITS(fits_create_img, fp, FLOAT_IMG, 2, naxes);
     if(fitserror) goto cloerr;
-    int nbytes = cc_getNbytes(img);
-    if(nbytes == 1) TRYFITS(fits_create_img, fp, BYTE_IMG, 2, naxes);
-    else TRYFITS(fits_create_img, fp, USHORT_IMG, 2, naxes);
-    if(fitserror) goto cloerr;
-    // write header
-    char card[FLEN_CARD], templ[2*FLEN_CARD], bufc[FLEN_CARD];
-    calculate_stat(img);
-#define FORMKW(in)                              \
-    do{ int status = 0, kt = 0;                      \
-            fits_parse_template(in, card, &kt, &status);  \
-            if(status) fits_report_error(stderr, status);\
-            else cc_addrecord(fp, card); \
-    }while(0)
-#define FORMINT(key, val, comment) do{ \
-        snprintf(templ, FLEN_CARD, "%s = %d / %s", key, val, comment); \
-        FORMKW(templ); \
-}while(0)
-#define FORMFLT(key, val, comment) do{ \
-    snprintf(templ, FLEN_CARD, "%s = %g / %s", key, val, comment); \
-    FORMKW(templ); \
-}while(0)
-#define FORMSTR(key, val, comment) do{ \
-    snprintf(templ, 2*FLEN_CARD, "%s = '%s' / %s", key, val, comment); \
-    FORMKW(templ); \
-}while(0)
+    if(fitshdr_write(fp, h)) fitserror = 1;
+    TRYFITS(fits_write_img, fp, TFLOAT, 1, naxes[0] * naxes[1], data);
+cloerr:
+    TRYFITS(fits_close_file, fp);
+    int ret = (fitserror == 0);
+    fitserror = 0;
+    return ret;
+}
 
-    FORMKW("ORIGIN = 'SAO RAS' / Organization responsible for the data");
-    FORMKW("OBSERVAT = 'Special Astrophysical Observatory, Russia' / Observatory name");
-    if(img->model[0]) FORMSTR("DETECTOR", img->model, "Detector model");
-    if(GP->instrument) FORMSTR("INSTRUME", GP->instrument, "Instrument");
-    else FORMKW("INSTRUME = 'direct imaging'  / Instrument");
-    FORMFLT("EXPTIME", img->exposure_time, "Actual exposition time (sec)");
-    // BINNING / Binning
-    snprintf(templ, FLEN_CARD, "BINNING = '%d x %d' / Binning (hbin x vbin)", img->bin_x, img->bin_y);
-    FORMKW(templ);
-    FORMINT("XBINNING", img->bin_x, "Binning factor used on X axis");
-    FORMINT("YBINNING", img->bin_y, "Binning factor used on Y axis");
-    // pixel size
-    if(!isnan(img->pixel_x)){
-        FORMFLT("PIXSIZEX", img->pixel_x, "Pixel size X (um)");
-        if(!isnan(img->pixel_y)){
-            FORMFLT("PIXSIZEY", img->pixel_y, "Pixel size Y (um)");
-            snprintf(templ, FLEN_CARD, "PIXSIZE = '%.1f x %.1f' / Pixel size (h x v), um", img->pixel_x, img->pixel_y);
-            FORMKW(templ);
-        }
+// calculate master frame, save it and stop stacking; hdrmutex is locked
+static void finishstack(){
+    if(!stackname) return;
+    const char *name = (*stackname == '!') ? stackname + 1 : stackname;
+    int n = stack.nframes;
+    double t0 = sl_dtime();
+    float *master = stack_result(&stack, GP->stackkappa);
+    int ret = FALSE;
+    if(master){
+        verbose(VERBOSE_SECONDARY, _("Master frame calculated by %d frames in %.2fs"), n, sl_dtime() - t0);
+        fitshdr_clear(&hdrfull);
+        fitshdr_append(&hdrfull, &hdrhead);
+        fitshdr_append(&hdrfull, &hdrframe);
+        fitshdr_append(&hdrfull, &hdrtail);
+        // records of last frame which have no sense for master
+        const char *framekeys[] = {"DATAMIN", "DATAMAX", "STATMIN", "STATMAX", "STATAVR", "STATSTD",
+                                   "TIMESTAM", "IMSEQNO", NULL};
+        for(const char **k = framekeys; *k; ++k) fitshdr_delkey(&hdrfull, *k);
+        fitshdr_addflt(&hdrfull, "EXPTIME", stack.exptime / n, "Mean exposition time of combined frames (sec)");
+        fitshdr_addint(&hdrfull, "NCOMBINE", n, "Amount of combined frames");
+        fitshdr_addstr(&hdrfull, "COMBTYPE", stack_method_name(stack.method), "Method of frames combining");
+        if(stack.method == STACK_CLIP) fitshdr_addflt(&hdrfull, "CLIPSIG", GP->stackkappa, "Clipping level, sigma");
+        adddates(&hdrfull);
+        addfilename(&hdrfull, stackname);
+        ret = savemaster(stackname, &hdrfull, master, stack.w, stack.h);
+        FREE(master);
+    }
+    if(ret){
+        LOGMSG("Master frame (%s of %d frames) saved as '%s'", stack_method_name(stack.method), n, name);
+        verbose(VERBOSE_PRIMARY, _("Master frame (%s of %d frames) saved as '%s'"), stack_method_name(stack.method), n, name);
+    }else{
+        LOGERR("Can't save master frame %s", name);
+        WARNX(_("Error saving master frame %s"), name);
+        if(!GP->outfile) unlink(name);
     }
-    // imtype
-    if(img->flags.dark) sprintf(bufc, "dark");
-    else if(GP->objtype) strncpy(bufc, GP->objtype, FLEN_CARD);
-    else sprintf(bufc, "light");
-    FORMSTR("IMAGETYP", bufc, "Image type");
-    // geometry
-    snprintf(templ, FLEN_CARD, "VIEWFLD = '(%d, %d)(%d, %d)' / Camera maximal field of view", img->field.xoff, img->field.yoff,
-             img->field.xoff + img->field.w - 1, img->field.yoff + img->field.h - 1);
-    FORMKW(templ);
-    snprintf(templ, FLEN_CARD, "ARRAYFLD = '(%d, %d)(%d, %d)' / Camera full array size (with overscans)", img->array.xoff, img->array.yoff,
-             img->array.xoff + img->array.w - 1, img->array.yoff + img->array.h - 1);
-    FORMKW(templ);
-    snprintf(templ, FLEN_CARD, "GEOMETRY = '(%d, %d)(%d, %d)' / Camera current frame geometry", img->geometry.xoff, img->geometry.yoff,
-             img->geometry.xoff + img->geometry.w - 1, img->geometry.yoff + img->geometry.h - 1);
-    FORMKW(templ);
-    FORMINT("X0", img->geometry.xoff, "Subframe left border without binning");
-    FORMINT("Y0", img->geometry.yoff, "Subframe upper border without binning");
-    // stat
-    FORMINT("DATAMIN", 0, "Min pixel value");
-    FORMINT("DATAMAX", (1<<img->bitpix) - 1, "Max pixel value");
-    if(img->gotstat){
-        FORMINT("STATMIN", img->min, "Min data value");
-        FORMINT("STATMAX", img->max, "Max data value");
-        FORMFLT("STATAVR", img->avr, "Average data value");
-        FORMFLT("STATSTD", img->std, "Std. of data value");
+    stack_close(&stack);
+    FREE(stackname);
+}
+
+/**
+ * @brief closeFITSseries - finish current multi-extension or SER file or master frame (if any)
+ */
+void closeFITSseries(){
+    pthread_mutex_lock(&hdrmutex);
+    if(series.fd > -1){
+        char *name = strdup(series.name);
+        int n = series.nframes;
+        if(fitsseries_close(&series)){
+            LOGMSG("Series file '%s' closed, %d frames", name, n);
+            verbose(VERBOSE_PRIMARY, _("Series of %d frames saved as '%s'"), n, name);
+        }else LOGERR("Can't close series file %s", name);
+        FREE(name);
+    }
+    if(ser.fd > -1){
+        char *name = strdup(ser.name);
+        int n = (int)ser.nframes;
+        if(ser_close(&ser)){
+            LOGMSG("SER file '%s' closed, %d frames", name, n);
+            verbose(VERBOSE_PRIMARY, _("Series of %d frames saved as '%s'"), n, name);
+        }else LOGERR("Can't close SER file %s", name);
+        FREE(name);
+    }
+    finishstack();
+    pthread_mutex_unlock(&hdrmutex);
+}
+
+// exit() could be called from signal handler while hdrmutex is locked
+static void closeonexit(){
+    if(pthread_mutex_trylock(&hdrmutex)){
+        fitsseries_close(&series);
+        ser_close(&ser);
+        stack_close(&stack);
+        return;
     }
-    // camera parameters
-    if(!isnan(img->gain)) FORMFLT("CAMGAIN", img->gain, "CMOS gain value");
-    if(!isnan(img->brightness)) FORMFLT("CAMBRIGH", img->brightness, "CMOS brightness value");
-    if(!isnan(img->ccd_temp)) FORMFLT("CAMTEMP", img->ccd_temp, "Camera temperature at exp. end, degr C");
-    if(!isnan(img->tbody)) FORMFLT("BODYTEMP", img->tbody, "Camera body temperature at exp. end, degr C");
-    if(!isnan(img->thot)) FORMFLT("HOTTEMP", img->thot, "Camera peltier hot side temperature at exp. end, degr C");
-    // wheel
-    if(img->flags.havewheel){
-        if(img->wmodel[0]) FORMSTR("WHEEL", img->wmodel, "Filter wheel model");
-        if(img->wheelmax > 0) FORMINT("FILTMAX", img->wheelmax, "Amount of filter positions");
-        FORMINT("FILTER", img->wheelpos, "Current filter position");
-        if(!isnan(img->wheel_temp)) FORMFLT("FILTTEMP", img->wheel_temp, "Filter wheel body temperature, degr C");
+    pthread_mutex_unlock(&hdrmutex);
+    closeFITSseries();
+}
+
+// register closeonexit() once
+static void setatexit(){
+    static int atexitset = FALSE; // close file on exit() from signal handlers
+    if(!atexitset){
+        atexit(closeonexit);
+        atexitset = TRUE;
     }
-    // focuser
-    if(img->flags.havefocuser){
-        if(img->fmodel[0]) FORMSTR("FOCUSER", img->fmodel, "Focuser model");
-        if(!isnan(img->focpos)) FORMFLT("FOCUS", img->focpos, "Current focuser position, mm");
-        if(!isnan(img->focmin)) FORMFLT("FOCMIN", img->focmin, "Minimal focuser position, mm");
-        if(!isnan(img->focmax)) FORMFLT("FOCMAX", img->focmax, "Maximal focuser position, mm");
-        if(!isnan(img->foc_temp)) FORMFLT("FOCTEMP", img->foc_temp, "Focuser body temperature, degr C");
-    }
-    snprintf(templ, 2*FLEN_CARD, "TIMESTAM = %.6f / Time of acquisition end (UNIX)", img->timestamp);
-    FORMKW(templ);
-    FORMINT("IMSEQNO", (int)img->imnumber, "Number of image in full sequence");
+}
 
-    if(GP->addhdr){ // add records from server-side files
-        char **nxtfile = GP->addhdr;
-        while(*nxtfile){
-            int got = cc_kwfromfile(fp, *nxtfile);
-            if(got == 0) WARNX(_("Added 0 FITS records from %s"), *nxtfile);
-            else verbose(VERBOSE_SECONDARY, _("Added %d FITS records from %s"), got, *nxtfile);
-            ++nxtfile;
+// add `img` to SER file (create it on first call); hdrmutex and img->mutex are locked
+static int addtoser(cc_IMG *img){
+    if(ser.fd < 0){
+        char fnam[PATH_MAX+1];
+        if(!getfilename(fnam, ".ser")) return FALSE;
+        if(!ser_open(&ser, fnam, img, GP->observers, img->model, GP->instrument)){
+            LOGERR("Can't create SER file %s", fnam);
+            return FALSE;
         }
+        setatexit();
+        LOGMSG("SER file '%s' created", ser.name);
     }
-    // add these keywords after all to override records from files
-    if(GP->observers) FORMSTR("OBSERVER", GP->observers, "Observers");
-    if(GP->prog_id) FORMSTR("PROG-ID", GP->prog_id, "Observation program identifier");
-    if(GP->author) FORMSTR("AUTHOR", GP->author, "Author of the program");
-    if(GP->objname) FORMSTR("OBJECT", GP->objname, "Object name");
+    return ser_add(&ser, img);
+}
 
-    // creation date/time
-    int s = 0;
-    fits_write_date(fp, &s);
+// add `img` to master frame (start building on first call); hdrmutex and img->mutex are locked
+static int addtostack(cc_IMG *img){
+    if(!stackname){
+        char fnam[PATH_MAX+1], dir[PATH_MAX+1];
+        if(!getfilename(fnam, ".fits")) return FALSE;
+        // scratch file is placed near master
+        snprintf(dir, PATH_MAX, "%s", (*fnam == '!') ? fnam + 1 : fnam);
+        char *slash = strrchr(dir, '/');
+        if(slash) *slash = 0;
+        else sprintf(dir, ".");
+        if(!stack_open(&stack, stack_method_byname(GP->stack), img, dir)){
+            LOGERR("Can't start stacking into %s", fnam);
+            if(!GP->outfile) unlink((*fnam == '!') ? fnam + 1 : fnam);
+            return FALSE;
+        }
+        stackname = strdup(fnam);
+        setatexit();
+        LOGMSG("Start building master '%s' (%s)", stackname, stack_method_name(stack.method));
+    }
+    return stack_add(&stack, img);
+}
 
-    tm_time = localtime(&savetime);
-    WRITEKEY(fp, TDOUBLE, "UNIXTIME", &dsavetime, "File creation time (UNIX)");
-    strftime(bufc, FLEN_VALUE, "%Y/%m/%d", tm_time);
-    WRITEKEY(fp, TSTRING, "DATE-OBS", bufc, "Date of observation (YYYY/MM/DD, local)");
-    strftime(bufc, FLEN_VALUE, "%H:%M:%S", tm_time);
-    WRITEKEY(fp, TSTRING, "TIME", bufc, "Creation time (hh:mm:ss, local)");
-    // FILE / Input file original name
-    char *n = fnam;
-    if(*n == '!') ++n;
-    s = 0; fits_write_comment(fp, "Input file original name:", &s);
-    s = 0; fits_write_comment(fp, n, &s);
-    //WRITEKEY(fp, TSTRING, "FILE", n, "Input file original name");
-    if(nbytes == 1) TRYFITS(fits_write_img, fp, TBYTE, 1, width * height, img->data);
-    else TRYFITS(fits_write_img, fp, TUSHORT, 1, width * height, img->data);
+// add `img` as next extension of series file (create it on first call); hdrmutex and img->mutex are locked
+static int addtoseries(cc_IMG *img){
+    if(series.fd < 0){
+        char fnam[PATH_MAX+1];
+        if(!getfilename(fnam, ".fits")) return FALSE;
+        const char *name = (*fnam == '!') ? fnam + 1 : fnam;
+        if(!fitsdirect_supported(fnam)){
+            WARNX(_("Multi-extension mode supports only simple FITS files, not %s"), fnam);
+            if(!GP->outfile) unlink(name); // remove file reserved by check_filenameprefix()
+            return FALSE;
+        }
+        // primary HDU: only static part of header
+        fitshdr_clear(&hdrfull);
+        fitshdr_append(&hdrfull, &hdrhead);
+        fitshdr_append(&hdrfull, &hdrtail);
+        adddates(&hdrfull);
+        addfilename(&hdrfull, fnam);
+        if(!fitsseries_open(&series, fnam, &hdrfull, img, GP->nframes)){
+            LOGERR("Can't create series file %s", fnam);
+            if(!GP->outfile) unlink(name);
+            return FALSE;
+        }
+        setatexit();
+        LOGMSG("Series file '%s' created", series.name);
+    }
+    // extension: per-frame part of header
+    char extname[FLEN_VALUE];
+    snprintf(extname, FLEN_VALUE, "FRAME%d", series.nframes + 1);
+    fitshdr_clear(&hdrfull);
+    fitshdr_append(&hdrfull, &hdrframe);
+    adddates(&hdrfull);
+    fitshdr_addstr(&hdrfull, "EXTNAME", extname, "number of frame in series");
+    return fitsseries_add(&series, &hdrfull, img);
+}
 
-cloerr:
-    TRYFITS(fits_close_file, fp);
+// save FITS file `img` into GP->outfile or GP->outfileprefix_XXXX.fits
+// (or as next extension of one file for all series if GP->mef is set, or as next frame of SER file if GP->ser is set,
+// or add to master frame if GP->stack is set)
+// if outp != NULL, put into it strdup() of last file name
+// return FALSE if failed
+int saveFITS(cc_IMG *img, char **outp){
+    int ret = FALSE;
+    if(!img || !img->data){
+        WARNX("Bad data");
+        return FALSE;
+    }
+    char fnam[PATH_MAX+1];
+    if(GP->stack){ // accumulate frames for master
+        pthread_mutex_lock(&img->mutex);
+        pthread_mutex_lock(&hdrmutex);
+        mkhdrtemplate(img);
+        mkhdrframe(img);
+        ret = addtostack(img);
+        int n = stack.nframes;
+        pthread_mutex_unlock(&hdrmutex);
+        pthread_mutex_unlock(&img->mutex);
+        if(ret) verbose(VERBOSE_SECONDARY, _("Frame %d added to master"), n);
+        else WARNX(_("Can't add frame to master"));
+        return ret;
+    }
+    if(GP->ser){ // raw frames without headers
+        pthread_mutex_lock(&img->mutex);
+        pthread_mutex_lock(&hdrmutex);
+        ret = addtoser(img);
+        if(ser.name) snprintf(fnam, PATH_MAX, "%s", ser.name);
+        else *fnam = 0;
+        int n = (int)ser.nframes;
+        pthread_mutex_unlock(&hdrmutex);
+        pthread_mutex_unlock(&img->mutex);
+        if(ret){
+            verbose(VERBOSE_SECONDARY, _("Frame %d added to '%s'"), n, fnam);
+            if(outp){
+                FREE(*outp);
+                *outp = strdup(fnam);
+            }
+        }else{
+            LOGERR("Can't add frame to SER file %s", fnam);
+            WARNX(_("Error saving frame into %s"), fnam);
+        }
+        return ret;
+    }
+    if(GP->mef){
+        pthread_mutex_lock(&img->mutex);
+        calculate_stat(img);
+        pthread_mutex_lock(&hdrmutex);
+        mkhdrtemplate(img);
+        mkhdrframe(img);
+        ret = addtoseries(img);
+        if(series.name) snprintf(fnam, PATH_MAX, "%s", series.name);
+        else *fnam = 0;
+        int n = series.nframes;
+        pthread_mutex_unlock(&hdrmutex);
+        pthread_mutex_unlock(&img->mutex);
+        if(ret){
+            verbose(VERBOSE_PRIMARY, _("Frame %d added to '%s'"), n, fnam);
+            if(outp){
+                FREE(*outp);
+                *outp = strdup(fnam);
+            }
+        }else{
+            LOGERR("Can't add frame to series file %s", fnam);
+            WARNX(_("Error saving frame into %s"), fnam);
+        }
+        return ret;
+    }
+    if(!getfilename(fnam, ".fits")) return FALSE;
+    if(GP->asyncsave && !aw_running() && !aw_start()) GP->asyncsave = 0;
+    pthread_mutex_lock(&img->mutex);
+    calculate_stat(img);
+    pthread_mutex_lock(&hdrmutex);
+    mkhdrtemplate(img);
+    mkhdrframe(img);
+    // records from static template override records of frame (like in files pointed by user)
+    fitshdr_clear(&hdrfull);
+    fitshdr_append(&hdrfull, &hdrhead);
+    fitshdr_append(&hdrfull, &hdrframe);
+    fitshdr_append(&hdrfull, &hdrtail);
+    adddates(&hdrfull);
+    addfilename(&hdrfull, fnam);
+    // simple files are saved by native writer, others (gzipped, extended names) - by cfitsio
+    if(!fitsdirect_supported(fnam)) ret = cfitsio_save(fnam, &hdrfull, img);
+    else if(GP->rice) ret = fitsdirect_save_rice(fnam, &hdrfull, img);
+    else ret = fitsdirect_save(fnam, &hdrfull, img);
+    pthread_mutex_unlock(&hdrmutex);
     pthread_mutex_unlock(&img->mutex);
-    if(fitserror == 0){
-        LOGMSG("Save file '%s'", fnam);
-        verbose(VERBOSE_PRIMARY, _("File saved as '%s'"), fnam);
-        DBG("file %s saved", fnam);
+    const char *name = (*fnam == '!') ? fnam + 1 : fnam;
+    if(ret){
+        if(ret == FITSDIRECT_QUEUED) DBG("file %s queued", name);
+        else{
+            LOGMSG("Save file '%s'", name);
+            verbose(VERBOSE_PRIMARY, _("File saved as '%s'"), name);
+            DBG("file %s saved", name);
+        }
         if(outp){
             FREE(*outp);
-            *outp = strdup(fnam);
+            *outp = strdup(name);
         }
-        ret = TRUE;
     }else{
-        LOGERR("Can't save %s", fnam);
-        WARNX(_("Error saving file %s"), fnam);
-        fitserror = 0;
+        LOGERR("Can't save %s", name);
+        WARNX(_("Error saving file %s"), name);
+        if(!GP->outfile) unlink(name); // remove file reserved by check_filenameprefix()
     }
     return ret;
 }
 
+/**
+ * @brief ser2fits - convert SER file into FITS files (GP->outfile/GP->outfileprefix, one file with GP->mef)
+ * @param fnam - SER file name
+ * @return TRUE if all frames converted
+ */
+int ser2fits(const char *fnam){
+    serreader r;
+    if(!ser_read_open(&r, fnam)) return FALSE;
+    cc_IMG *img = cc_newimage(r.bitpix, r.w, r.h);
+    if(!img){
+        ser_read_close(&r);
+        return FALSE;
+    }
+    // SER have no camera data
+    img->pixel_x = img->pixel_y = img->gain = img->brightness = NAN;
+    img->ccd_temp = img->tbody = img->thot = NAN;
+    img->exposure_time = (GP->exptime > 0.) ? GP->exptime : 0.f;
+    img->bin_x = img->bin_y = 1;
+    img->field.w = img->array.w = img->geometry.w = r.w;
+    img->field.h = img->array.h = img->geometry.h = r.h;
+    snprintf(img->model, MODELNM_SZ, "%s", r.instrument);
+    if(!GP->observers && *r.observer) GP->observers = strdup(r.observer);
+    if(!GP->instrument && *r.telescope) GP->instrument = strdup(r.telescope);
+    GP->ser = 0; // don't write into SER again
+    GP->nframes = r.nframes;
+    verbose(VERBOSE_PRIMARY, _("Convert %d frames %dx%d (%d bits) from %s"), r.nframes, r.w, r.h, r.bitpix, fnam);
+    int i = 0;
+    for(; i < r.nframes; ++i){
+        if(!ser_read_frame(&r, i, img)) break;
+        img->imnumber = i + 1;
+        if(!saveFITS(img, NULL)) break;
+    }
+    closeFITSseries();
+    cc_freeimage(&img);
+    ser_read_close(&r);
+    return (i == r.nframes);
+}
+
 static void stat8(cc_IMG *image){
     double sum = 0., sum2 = 0.;
     size_t size = image->w * image->h;
@@ -573,6 +976,80 @@ void closecam(){
     camera = NULL;
 }
 
+// software binning (when camera can't bin by itself) and buffer for full-resolution frames
+static int swhbin = 1, swvbin = 1;
+static cc_IMG *swbinraw = NULL;
+
+/**
+ * @brief setbinning - set binning by camera or, if it can't, by software (camera reads full resolution)
+ * @param hbin, vbin - binning factors
+ * @return FALSE if bad values
+ */
+int setbinning(int hbin, int vbin){
+    if(!camera || hbin < 1 || vbin < 1) return FALSE;
+    if(camera->setbin && camera->setbin(hbin, vbin)){
+        swhbin = swvbin = 1;
+        return TRUE;
+    }
+    if(hbin == 1 && vbin == 1){ // camera can't even set 1x1 - think that it always works without binning
+        swhbin = swvbin = 1;
+        return TRUE;
+    }
+    if(camera->setbin) camera->setbin(1, 1);
+    swhbin = hbin; swvbin = vbin;
+    verbose(VERBOSE_SECONDARY, _("Camera can't bin %dx%d, use software binning"), hbin, vbin);
+    LOGMSG("Software binning %dx%d (%s)", hbin, vbin, GP->swbinavg ? "mean" : "sum");
+    return TRUE;
+}
+
+/**
+ * @brief getbinning - get current binning (software if it's on)
+ * @return FALSE if can't get
+ */
+int getbinning(int *hbin, int *vbin){
+    if(!hbin || !vbin) return FALSE;
+    if(swhbin > 1 || swvbin > 1){
+        *hbin = swhbin; *vbin = swvbin;
+        return TRUE;
+    }
+    if(!camera || !camera->getbin) return FALSE;
+    return camera->getbin(hbin, vbin);
+}
+
+/**
+ * @brief binnedbitpix - bitpix of captured images for camera's `bitpix`
+ * (software binning by sum always gives 16-bit images)
+ */
+uint8_t binnedbitpix(uint8_t bitpix){
+    if((swhbin > 1 || swvbin > 1) && !GP->swbinavg) return 16;
+    return bitpix;
+}
+
+/**
+ * @brief capturebinned - camera->capture() with software binning (if it's on)
+ * @param ima - image to fill (its size and bitpix are changed according to binning)
+ * @return FALSE if failed
+ */
+int capturebinned(cc_IMG *ima){
+    if(!camera || !camera->capture || !ima) return FALSE;
+    if(swhbin == 1 && swvbin == 1) return camera->capture(ima);
+    int w = camera->geometry.w, h = camera->geometry.h;
+    if(!swbinraw || swbinraw->datasize < (size_t)w * h * 2){
+        cc_freeimage(&swbinraw);
+        swbinraw = cc_newimage(16, w, h); // buffer enough for 16 bit
+        if(!swbinraw) return FALSE;
+    }
+    swbinraw->w = w; swbinraw->h = h;
+    if(!camera->getbitpix || !camera->getbitpix(&swbinraw->bitpix)) swbinraw->bitpix = 16;
+    swbinraw->bytelen = (size_t)w * h * cc_getNbytes(swbinraw);
+    if(!camera->capture(swbinraw)) return FALSE;
+    if(!binimage(swbinraw, ima, swhbin, swvbin, GP->swbinavg)){
+        WARNX(_("Can't bin image %dx%d by %dx%d"), swbinraw->w, swbinraw->h, swhbin, swvbin);
+        return FALSE;
+    }
+    return TRUE;
+}
+
 // make base settings; return TRUE if all OK
 int prepare_ccds(){
     FNAME();
@@ -715,9 +1192,9 @@ int prepare_ccds(){
     /*********************** expose control ***********************/
     if(GP->hbin < 1) GP->hbin = 1;
     if(GP->vbin < 1) GP->vbin = 1;
-    if(!camera->setbin || !camera->setbin(GP->hbin, GP->vbin)){
+    if(!setbinning(GP->hbin, GP->vbin)){
         WARNX(_("Can't set binning %dx%d"), GP->hbin, GP->vbin);
-        if(camera->getbin) camera->getbin(&GP->hbin, &GP->vbin);
+        getbinning(&GP->hbin, &GP->vbin);
     }
     if(GP->X0 < x0) GP->X0 = x0; // default values
     else if(GP->X0 > x1-1) GP->X0 = x1-1;
@@ -749,7 +1226,7 @@ int prepare_ccds(){
     else verbose(VERBOSE_PRIMARY, _("Readout mode: %s"), GP->fast ? "fast" : "normal");
     if(!GP->outfile) verbose(VERBOSE_PRIMARY, _("Only show statistics"));
     // GET binning should be AFTER setgeometry!
-    if(!camera->getbin || !camera->getbin(&GP->hbin, &GP->vbin))
+    if(!getbinning(&GP->hbin, &GP->vbin))
         WARNX(_("Can't get current binning"));
     verbose(VERBOSE_SECONDARY, "Binning: %d x %d", GP->hbin, GP->vbin);
     rtn = TRUE;
@@ -793,31 +1270,36 @@ int image_init_camdata(cc_IMG *ima){
     return TRUE;
 }
 
-// fill base fields of fresh image
-void fill_image_fields(cc_IMG *ima){
-    if(!ima) return;
+// fill fields of fresh image from camera `cam`
+void fill_camera_fields(cc_Camera *cam, cc_IMG *ima){
+    if(!cam || !ima) return;
     ima->gotstat = 0; // fresh image without statistics - recalculate when save
     ima->timestamp = sl_dtime(); // set timestamp
-    if(!camera->getgain || !camera->getgain(&ima->gain)) ima->gain = NAN;
-    if(!camera->getbrightness || !camera->getbrightness(&ima->brightness)) ima->brightness = NAN;
-    if(!camera->getTcold || !camera->getTcold(&ima->ccd_temp)){
+    if(!cam->getgain || !cam->getgain(&ima->gain)) ima->gain = NAN;
+    if(!cam->getbrightness || !cam->getbrightness(&ima->brightness)) ima->brightness = NAN;
+    if(!cam->getTcold || !cam->getTcold(&ima->ccd_temp)){
         DBG("Can't get CCD temperature");
         ima->ccd_temp = NAN;
     }else DBG("CCD Temperature=%g", ima->ccd_temp);
-    if(!camera->getTbody || !camera->getTbody(&ima->tbody)){
+    if(!cam->getTbody || !cam->getTbody(&ima->tbody)){
         DBG("Can't get body temperature");
         ima->tbody = NAN;
     }else DBG("Body Temperature=%g", ima->tbody);
-    if(!camera->getThot || !camera->getThot(&ima->thot)){
+    if(!cam->getThot || !cam->getThot(&ima->thot)){
         DBG("Can't get Thot");
         ima->thot = NAN;
     }else DBG("Hot Temperature=%g", ima->thot);
     ima->flags.dark = GP->dark;
-    ima->field = camera->field;
-    ima->array = camera->array;
-    ima->geometry = camera->geometry;
+    ima->field = cam->field;
+    ima->array = cam->array;
+    ima->geometry = cam->geometry;
     DBG("Geom: off(%d, %d), size(%d, %d)", ima->geometry.xoff, ima->geometry.yoff,
             ima->geometry.w, ima->geometry.h);
+}
+
+// fill wheel and focuser fields of fresh image (could be called before readout if devices are to be moved)
+void fill_device_fields(cc_IMG *ima){
+    if(!ima) return;
     if(wheel){
         int i;
         ima->flags.havewheel = 1;
@@ -834,6 +1316,12 @@ void fill_image_fields(cc_IMG *ima){
     }
 }
 
+// fill base fields of fresh image
+void fill_image_fields(cc_IMG *ima){
+    fill_camera_fields(camera, ima);
+    fill_device_fields(ima);
+}
+
 /*
  * Main CCD process in standalone mode without viewer: get N images and save them
  */
@@ -844,7 +1332,7 @@ void ccds(){
     DBG("w=%d, h=%d", raw_width, raw_height);
     uint8_t bitpix = 16;
     if(camera->getbitpix) camera->getbitpix(&bitpix);
-    cc_IMG *image = cc_newimage(bitpix, raw_width, raw_height);
+    cc_IMG *image = cc_newimage(binnedbitpix(bitpix), raw_width, raw_height);
     if(!image) ERRX(_("Can't allocate image memory"));
     if(!image_init_camdata(image)) WARNX(_("Can't fill headers with camera data"));
     image->exposure_time = GP->exptime;
@@ -868,7 +1356,7 @@ void ccds(){
         verbose(VERBOSE_SECONDARY, _("Read grabbed image"));
         TIMESTAMP("Read grabbed");
         if(!camera->capture) ERRX(_("Camera plugin have no function `capture`"));
-        if(!camera->capture(image)){
+        if(!capturebinned(image)){
             WARNX(_("Can't grab image"));
             break;
         }
@@ -892,8 +1380,10 @@ void ccds(){
             }
         }
     }
+    closeFITSseries();
     DBG("FREE img");
     cc_freeimage(&image);
+    cc_freeimage(&swbinraw);
     closecam();
 }
 
@@ -946,7 +1436,7 @@ static void *grabnext(void *arg){
         if(cs != CAPTURE_READY){ WARNX(_("Some error when capture")); return NULL;}
         TIMESTAMP("get");
         if(!camera->capture) ERRX(_("Camera plugin have no function `capture`"));
-        if(!camera->capture(ima)){ WARNX(_("Can't grab image")); continue; }
+        if(!capturebinned(ima)){ WARNX(_("Can't grab image")); continue; }
         ++ima->imnumber;
         //calculate_stat(ima);
         TIMESTAMP("OK");
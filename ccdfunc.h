@@ -26,8 +26,16 @@ extern cc_Wheel *wheel;
 void calculate_stat(cc_IMG *image);
 size_t fillFITSheader(cc_IMG *img);
 int saveFITS(cc_IMG *img, char **outp); // for imageview module
+void closeFITSseries();
+int ser2fits(const char *fnam);
 
+void fill_camera_fields(cc_Camera *cam, cc_IMG *ima);
+void fill_device_fields(cc_IMG *ima);
 void fill_image_fields(cc_IMG *ima);
+int setbinning(int hbin, int vbin);
+int getbinning(int *hbin, int *vbin);
+uint8_t binnedbitpix(uint8_t bitpix);
+int capturebinned(cc_IMG *ima);
 int image_init_camdata(cc_IMG *ima);
 
 void focusers();
@@ -19,6 +19,7 @@
 // client-side functions
 #include <stdatomic.h>
 #include <math.h>  // isnan
+#include <pthread.h>
 #include <signal.h>
 #include <stdio.h>
 #include <string.h>
@@ -38,6 +39,8 @@ extern double answer_timeout;
 
 static char sendbuf[BUFSIZ];
 static char *lastfilename = NULL;
+// amount of images in client's save pool (besides receiving one)
+#define CLIENT_SAVEQUEUE    2
 // send message and wait any answer
 #define SENDMSG(...) do{DBG("SENDMSG"); snprintf(sendbuf, BUFSIZ-1, __VA_ARGS__); verbose(VERBOSE_SECONDARY, "\t> %s", sendbuf); if(!cc_sendstrmessage(sock, sendbuf)) ERRX(_("Server disconnected")); getans(sock, NULL);} while(0)
 // send message and wait answer starting with 'cmd'
@@ -216,6 +219,7 @@ static void send_headers(int sock){
     if(!isnan(GP->gotopos)){
         SENDMSGW(CC_CMD_FGOTO, "=%g", GP->gotopos);
     }
+    if(GP->autofocus) SENDMSGW(CC_CMD_AUTOFOCUS, "=%s", GP->autofocus);
     // wheel
     if(GP->listdevices) SENDCMDW(CC_CMD_WLIST);
     if(GP->whldevno > -1) SENDMSGW(CC_CMD_WDEVNO, "=%d", GP->whldevno);
@@ -263,6 +267,14 @@ static void send_headers(int sock){
         if(GP->dark) SENDMSGW(CC_CMD_DARK, "=1");
         else SENDMSGW(CC_CMD_DARK, "=0");
     }
+    if(GP->plan){ // server reads plan file itself
+        if(strcmp(GP->plan, "stop") == 0) SENDMSGW(CC_CMD_PLAN, "=stop");
+        else{
+            char *path = makeabspath(GP->plan, TRUE);
+            if(!path) WARNX(_("Can't find plan file %s"), GP->plan);
+            else SENDMSGW(CC_CMD_PLAN, "=%s", path);
+        }
+    }
 }
 
 /**
@@ -483,6 +495,105 @@ static int curImNo(int sock){
     return N;
 }
 
+// pool of images saved by separate thread while next image is received into `locima`
+static struct{
+    cc_IMG *free[CLIENT_SAVEQUEUE];     // free images
+    int nfree;
+    cc_IMG *queue[CLIENT_SAVEQUEUE];    // images waiting for saving (FIFO)
+    int qhead, qlen;
+    int saving;                         // saver is busy
+    int failed;                         // amount of images failed to save
+    int stop;
+    int running;
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+} savepool = {.mutex = PTHREAD_MUTEX_INITIALIZER, .cond = PTHREAD_COND_INITIALIZER};
+
+static void *saverthread(void _U_ *arg){
+    pthread_mutex_lock(&savepool.mutex);
+    while(1){
+        while(!savepool.qlen && !savepool.stop) pthread_cond_wait(&savepool.cond, &savepool.mutex);
+        if(!savepool.qlen) break;
+        cc_IMG *img = savepool.queue[savepool.qhead];
+        savepool.qhead = (savepool.qhead + 1) % CLIENT_SAVEQUEUE;
+        --savepool.qlen;
+        savepool.saving = TRUE;
+        pthread_mutex_unlock(&savepool.mutex);
+        int ok = saveFITS(img, &lastfilename);
+        pthread_mutex_lock(&savepool.mutex);
+        if(!ok) ++savepool.failed;
+        savepool.free[savepool.nfree++] = img;
+        savepool.saving = FALSE;
+        pthread_cond_broadcast(&savepool.cond);
+    }
+    pthread_mutex_unlock(&savepool.mutex);
+    return NULL;
+}
+
+/**
+ * @brief savequeued - give `locima` to saver thread and take free image for next receiving
+ *        (wait if all images of pool are still being saved)
+ * @return FALSE if saver can't be started (image should be saved synchronously)
+ */
+static int savequeued(){
+    if(!savepool.running){
+        for(; savepool.nfree < CLIENT_SAVEQUEUE; ++savepool.nfree){
+            cc_IMG *img = cc_newimage(16, 1024, 1024);
+            if(!img) break;
+            savepool.free[savepool.nfree] = img;
+        }
+        if(!savepool.nfree) return FALSE;
+        savepool.stop = FALSE;
+        if(pthread_create(&savepool.thread, NULL, saverthread, NULL)){
+            WARN("pthread_create()");
+            return FALSE;
+        }
+        savepool.running = TRUE;
+    }
+    pthread_mutex_lock(&savepool.mutex);
+    while(!savepool.nfree) pthread_cond_wait(&savepool.cond, &savepool.mutex);
+    cc_IMG *img = savepool.free[--savepool.nfree];
+    savepool.queue[(savepool.qhead + savepool.qlen) % CLIENT_SAVEQUEUE] = locima;
+    ++savepool.qlen;
+    locima = img;
+    pthread_cond_broadcast(&savepool.cond);
+    pthread_mutex_unlock(&savepool.mutex);
+    return TRUE;
+}
+
+/**
+ * @brief savefailed - get amount of images failed to save since last call
+ * @param wait - wait until all queued images are saved
+ */
+static int savefailed(int wait){
+    if(!savepool.running) return 0;
+    pthread_mutex_lock(&savepool.mutex);
+    if(wait) while(savepool.qlen || savepool.saving) pthread_cond_wait(&savepool.cond, &savepool.mutex);
+    int failed = savepool.failed;
+    savepool.failed = 0;
+    pthread_mutex_unlock(&savepool.mutex);
+    return failed;
+}
+
+/**
+ * @brief saveflush - wait until all queued images are saved, stop saver thread and free pool
+ * @return amount of images failed to save
+ */
+static int saveflush(){
+    if(!savepool.running) return 0;
+    pthread_mutex_lock(&savepool.mutex);
+    savepool.stop = TRUE;
+    pthread_cond_broadcast(&savepool.cond);
+    pthread_mutex_unlock(&savepool.mutex);
+    pthread_join(savepool.thread, NULL);
+    savepool.running = FALSE;
+    for(; savepool.nfree > 0; --savepool.nfree) cc_freeimage(&savepool.free[savepool.nfree - 1]);
+    int failed = savepool.failed;
+    savepool.failed = 0;
+    return failed;
+}
+
 void client(int sock){
     if(sock < 0) ERRX(_("Can't run without command socket"));
     if(!GP->forceimsock) refresh_shm(); // init shm buffer if user don't ask to force workign through image socket
@@ -536,6 +647,12 @@ void client(int sock){
         if(curst == CAMERA_FRAMERDY || cur != lastImNo){
             atomic_store(&expstate, CAMERA_IDLE);
             DBG("Current imno: %d", cur);
+            int nfailed = savefailed(FALSE); // frames failed to save in background should be taken again
+            if(nfailed){
+                WARNX(_("%d images weren't saved, take them again"), nfailed);
+                Nremain += nfailed;
+                nframe -= nfailed;
+            }
             if(Nremain > 1){ // start next capture
                 verbose(VERBOSE_PRIMARY, _("Exposing frame %d..."), nframe);
                 SENDMSGW(CC_CMD_EXPSTATE, "=%d", CAMERA_CAPTURE);
@@ -547,8 +664,8 @@ void client(int sock){
                 verbose(VERBOSE_SECONDARY, _("Frame ready, try to grab"));
                 if(!getimage(/*TRUE*/)){
                     WARNX(_("Can't get next image"));
-                }else{
-                    if(saveFITS(locima, &lastfilename)){
+                }else{ // save in background while next image is received
+                    if(savequeued() || saveFITS(locima, &lastfilename)){
                         --Nremain;
                         ++nframe;
                         failed = FALSE;
@@ -572,6 +689,13 @@ void client(int sock){
                         else usleep((int)(delta*1e6 + 1));
                     }
                 }
+            }else if((nfailed = savefailed(TRUE))){ // last images failed to save -> re-expose
+                WARNX(_("%d images weren't saved, take them again"), nfailed);
+                Nremain = nfailed;
+                nframe -= nfailed;
+                verbose(VERBOSE_PRIMARY, _("Exposing frame %d..."), nframe);
+                SENDMSGW(CC_CMD_EXPSTATE, "=%d", CAMERA_CAPTURE);
+                tstart = sl_dtime();
             }else{
                 verbose(VERBOSE_SECONDARY, "Got all images, closing...");
                 break;
@@ -579,6 +703,9 @@ void client(int sock){
         }
     }
     if(Nremain > 0) WARNX(_("Server timeout"));
+    int nfailed = saveflush();
+    if(nfailed) WARNX(_("%d images weren't saved"), nfailed);
+    closeFITSseries();
 }
 
 #ifdef IMAGEVIEW
@@ -48,7 +48,8 @@ static glob_pars  G = {
     .fanspeed = -1,
     .shmkey = 7777777,
     .anstmout = -1,
-    .infty = -1
+    .infty = -1,
+    .stackkappa = 3.
 };
 
 // need this to proper work with only-long args
@@ -72,6 +73,13 @@ sl_option_t cmdlnopts[] = {
     {"focdevno",NEED_ARG,   NULL,    NA,    arg_int,    APTR(&G.focdevno),  N_("focuser device number (if many: 0, 1, 2 etc)")},
     {"help",    NO_ARGS,    &help,   1,     arg_none,   NULL,               N_("show this help")},
     {"rewrite", NO_ARGS,    &G.rewrite,1,   arg_none,   NULL,               N_("rewrite output file if exists")},
+    {"rice",    NO_ARGS,    &G.rice, 1,     arg_none,   NULL,               N_("save lossless tile-compressed (Rice) FITS files (not for --mef)")},
+    {"asyncsave",NO_ARGS,   &G.asyncsave,1, arg_none,   NULL,               N_("write FITS files asynchronously (io_uring or writing threads)")},
+    {"ser",     NO_ARGS,    &G.ser,  1,     arg_none,   NULL,               N_("record series of raw frames into SER file instead of FITS")},
+    {"ser2fits",NEED_ARG,   NULL,    NA,    arg_string, APTR(&G.ser2fits),  N_("convert given SER file into FITS (use with -o, prefix or --mef)")},
+    {"stack",   NEED_ARG,   NULL,    NA,    arg_string, APTR(&G.stack),     N_("combine series into master frame by method: mean, clip (sigma-clipped mean) or median")},
+    {"stackkappa",NEED_ARG, NULL,    NA,    arg_double, APTR(&G.stackkappa),N_("clipping level for `--stack=clip`, sigma (default: 3)")},
+    {"mef",     NO_ARGS,    &G.mef,  1,     arg_none,   NULL,               N_("save all frames of series into one multi-extension FITS file")},
     {"verbose", NO_ARGS,    NULL,   'V',    arg_none,   APTR(&G.verbose),   N_("verbose level (-V - main messages, -VV - secondary messages, -VVV - debug)")},
     {"dark",    NO_ARGS,    NULL,   'd',    arg_int,    APTR(&G.dark),      N_("not open shutter, when exposing (\"dark frames\")")},
     {"8bit",    NO_ARGS,    NULL,   '8',    arg_int,    APTR(&G._8bit),     N_("run in 8-bit mode")},
@@ -91,6 +99,7 @@ sl_option_t cmdlnopts[] = {
     {"nflushes",NEED_ARG,   NULL,   'l',    arg_int,    APTR(&G.nflushes),  N_("N flushes before exposing (default: 1)")},
     {"hbin",    NEED_ARG,   NULL,   'h',    arg_int,    APTR(&G.hbin),      N_("horizontal binning to N pixels")},
     {"vbin",    NEED_ARG,   NULL,   'v',    arg_int,    APTR(&G.vbin),      N_("vertical binning to N pixels")},
+    {"swbinavg",NO_ARGS,    &G.swbinavg,1,  arg_none,   NULL,               N_("software binning (if camera can't bin) by mean instead of sum")},
     {"nframes", NEED_ARG,   NULL,   'n',    arg_int,    APTR(&G.nframes),   N_("make series of N frames")},
     {"pause",   NEED_ARG,   NULL,   'p',    arg_int,    APTR(&G.pause_len), N_("make pause for N seconds between expositions")},
     {"exptime", NEED_ARG,   NULL,   'x',    arg_double, APTR(&G.exptime),   N_("set exposure time to given value (seconds!)")},
@@ -111,6 +120,7 @@ sl_option_t cmdlnopts[] = {
     {"conf-ioport",NEED_ARG,NULL,   'c',    arg_int,    APTR(&G.confio),    N_("configure I/O port pins to given value (decimal number, pin1 is LSB, 1 == output, 0 == input)")},
 
     {"goto",    NEED_ARG,   NULL,   'g',    arg_double, APTR(&G.gotopos),   N_("move focuser to absolute position, mm")},
+    {"autofocus",NEED_ARG,  NULL,   NA,     arg_string, APTR(&G.autofocus), N_("run server autofocus over focuser positions \"start,end,step[,x0,y0,w,h]\" (stars are measured in given part of image), or \"stop\" it")},
     {"addsteps",NEED_ARG,   NULL,   'a',    arg_double, APTR(&G.addsteps),  N_("move focuser to relative position, mm (only for standalone)")},
 
     {"wheel-set",NEED_ARG,  NULL,   'w',    arg_int,    APTR(&G.setwheel),  N_("set wheel position")},
@@ -129,6 +139,19 @@ sl_option_t cmdlnopts[] = {
     {"info",    NO_ARGS,    &G.info, 1,     arg_none,   NULL,               N_("get base information about connected hardware (also increasing text messages level to 2)")},
 
     {"shmkey", NEED_ARG,    NULL,   'k',    arg_int,    APTR(&G.shmkey),    N_("shared memory (with image data) key (default: 7777777)")},
+    {"calshmkey",NEED_ARG,  NULL,   NA,     arg_int,    APTR(&G.calshmkey), N_("shared memory key for calibrated images (default: shmkey+1)")},
+    {"coadd",   NEED_ARG,   NULL,   NA,     arg_int,    APTR(&G.coadd),     N_("publish mean of last N frames in separate SHM segment (server)")},
+    {"coaddema",NO_ARGS,    &G.coaddema,1,  arg_none,   NULL,               N_("use exponential moving average with weight 1/N instead of exact window for `--coadd`")},
+    {"coaddshmkey",NEED_ARG,NULL,   NA,     arg_int,    APTR(&G.coaddshmkey),N_("shared memory key for co-added images (default: shmkey+2)")},
+    {"masterbias",NEED_ARG, NULL,   NA,     arg_string, APTR(&G.masterbias),N_("master bias for real-time calibration (server)")},
+    {"masterdark",NEED_ARG, NULL,   NA,     arg_string, APTR(&G.masterdark),N_("master dark for real-time calibration, scaled by EXPTIME if master bias pointed (server)")},
+    {"masterflat",NEED_ARG, NULL,   NA,     arg_string, APTR(&G.masterflat),N_("master flat for real-time calibration (server)")},
+    {"roi",     MULT_PAR,   NULL,   NA,     arg_string, APTR(&G.roi),       N_("region of interest x0,y0,w,h (in image pixels) to publish in separate SHM segment (server, could be several)")},
+    {"roishmkey",NEED_ARG,  NULL,   NA,     arg_int,    APTR(&G.roishmkey), N_("shared memory key for first ROI, next ROIs have next keys (default: shmkey+10)")},
+    {"sources", NEED_ARG,   NULL,   NA,     arg_double, APTR(&G.sources),   N_("find sources over N sigma of background on each frame and publish their table in SHM (server)")},
+    {"srcshmkey",NEED_ARG,  NULL,   NA,     arg_int,    APTR(&G.srcshmkey), N_("shared memory key for sources table (default: shmkey+3)")},
+    {"addcamera",MULT_PAR,  NULL,   NA,     arg_string, APTR(&G.addcamera), N_("additional camera plugin[:devno[:shmkey]] served by the same server, images only in SHM (could be several, default shmkey: shmkey+100*N)")},
+    {"plan",    NEED_ARG,   NULL,   NA,     arg_string, APTR(&G.plan),      N_("run plan of series (file with steps) by server, \"stop\" to cancel it")},
     {"forceimsock",NO_ARGS, &G.forceimsock,1, arg_none, NULL,               N_("force using image through socket transition even if can use SHM")},
     {"infty", NEED_ARG,     NULL,   NA,     arg_int,    APTR(&G.infty),     N_("start (!=0) or stop(==0) infinity capturing loop")},
 
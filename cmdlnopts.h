@@ -50,6 +50,8 @@ typedef struct{
     char *imageport;    // port to send/receive images (by default == port+1)
     char **addhdr;      // list of files from which to add header records
     char **plugincmd;   // plugin commands
+    char **roi;         // regions of interest (server)
+    char **addcamera;   // additional cameras (server)
     int restart;        // restart server
     int cancelexpose;   // cancel exp (for Grasshopper - forbid forever)
     int client;         // run as client
@@ -78,16 +80,36 @@ typedef struct{
     int async;          // asynchronous moving
     int verbose;        // each '-V' increases it
     int rewrite;        // rewrite file
+    int mef;            // save series into one multi-extension FITS
+    int rice;           // save tile-compressed FITS
+    int ser;            // record series into SER file
+    int asyncsave;      // asynchronous writing of files
+    char *ser2fits;     // SER file to convert into FITS
+    char *stack;        // build master frame by given method
+    double stackkappa;  // clipping level for master frame
+    char *masterbias;   // master bias for server-side calibration
+    char *masterdark;   // master dark -//-
+    char *masterflat;   // master flat -//-
     int showimage;      // show image preview
     int shmkey;         // shared memory (with image data) key
+    int calshmkey;      // shared memory key for calibrated images
+    int coaddshmkey;    // shared memory key for co-added images
+    int roishmkey;      // shared memory key of first ROI
+    int srcshmkey;      // shared memory key for sources table
+    int coadd;          // co-adding window (frames)
+    int coaddema;       // exponential moving average instead of window
+    int swbinavg;       // software binning by mean instead of sum
     int forceimsock;    // force using image through socket transition even if can use SHM
     int infty;          // run (==1) or stop (==0) infinity loop
     float gain;         // gain level (only for CMOS)
     float brightness;   // brightness (only for CMOS)
     double anstmout;    // answer timeout by socket
     double exptime;     // time of exposition in seconds
+    double sources;     // threshold of sources detection (sigma)
     double temperature; // temperature of CCD
     double gotopos;     // move stepper motor of focuser to absolute position
+    char *autofocus;    // autofocus parameters (or "stop")
+    char *plan;         // plan file (or "stop")
     double addsteps;    // move stepper motor of focuser to relative position
 } glob_pars;
 
@@ -0,0 +1,123 @@
+/*
+ * This file is part of the CCD_Capture project.
+ * Copyright 2026 Edward V. Emelianov <edward.emelianoff@gmail.com>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <usefull_macros.h>
+
+#include "coadd.h"
+#include "imfunc.h"
+#include "omp.h"
+
+/**
+ * @brief coadd_init - init co-adder
+ * @param C   - co-adder
+ * @param N   - window length
+ * @param ema - !=0 for exponential moving average
+ * @return FALSE if N is wrong
+ */
+int coadd_init(coadder *C, int N, int ema){
+    if(!C || N < 1 || N > 0xffff) return FALSE;
+    bzero(C, sizeof(coadder));
+    C->N = N;
+    C->ema = ema;
+    return TRUE;
+}
+
+// (re)allocate buffers for frame size of `img`; return FALSE if there's not enough memory
+static int coadd_reset(coadder *C, cc_IMG *img){
+    FREE(C->sum); FREE(C->ring); FREE(C->avg);
+    C->w = img->w; C->h = img->h;
+    C->bitpix = img->bitpix;
+    C->framesize = (size_t)img->w * img->h * cc_getNbytes(img);
+    C->count = C->oldest = 0;
+    size_t n = (size_t)img->w * img->h;
+    // window of large frames could be too big: don't abort by MALLOC, turn co-adding off
+    if(C->ema) C->avg = calloc(n, sizeof(float));
+    else{
+        C->sum = calloc(n, sizeof(uint32_t));
+        if(C->framesize && (size_t)C->N <= SIZE_MAX / C->framesize) C->ring = malloc(C->framesize * C->N);
+    }
+    if(C->ema ? !!C->avg : (C->sum && C->ring)) return TRUE;
+    LOGERR("Can't allocate memory for co-adding of %d frames %dx%d, co-adding is off", C->N, C->w, C->h);
+    WARNX(_("Can't allocate memory for co-adding of %d frames, co-adding is off"), C->N);
+    coadd_free(C);
+    return FALSE;
+}
+
+// window: sum += new - oldest, out = sum / count
+#define WINDOW(T)  do{ const T *i = (const T*)in->data; const T *old = (const T*)(C->ring + C->oldest * C->framesize); \
+    T *o = (T*)out->data; uint32_t *sum = C->sum;                                   \
+    if(full){ OMP_FOR()                                                             \
+        for(size_t p = 0; p < n; ++p){ sum[p] += i[p] - old[p]; o[p] = sum[p] * k + 0.5f; } \
+    }else{ OMP_FOR()                                                                \
+        for(size_t p = 0; p < n; ++p){ sum[p] += i[p]; o[p] = sum[p] * k + 0.5f; }  \
+    }}while(0)
+// exponential average: avg += k*(new - avg)
+#define EMA(T)  do{ const T *i = (const T*)in->data; T *o = (T*)out->data; float *avg = C->avg; \
+    OMP_FOR()                                                                       \
+    for(size_t p = 0; p < n; ++p){ avg[p] += k * (i[p] - avg[p]); o[p] = avg[p] + 0.5f; } \
+    }while(0)
+
+/**
+ * @brief coadd_add - add next frame and put co-added image into `out` (header copied from `in`)
+ * buffers are reset if frame size changed
+ * @param C   - co-adder
+ * @param in  (i) - new frame
+ * @param out (o) - co-added image (its `data` should be large enough)
+ * @return FALSE if failed
+ */
+int coadd_add(coadder *C, cc_IMG *in, cc_IMG *out){
+    if(!C || !in || !out || C->N < 1 || out->datasize < in->bytelen) return FALSE;
+    if(in->w != C->w || in->h != C->h || in->bitpix != C->bitpix){
+        if(!coadd_reset(C, in)) return FALSE;
+    }
+    size_t n = (size_t)in->w * in->h;
+    int is16 = (cc_getNbytes(in) == 2);
+    if(C->ema){
+        if(C->count < C->N) ++C->count;
+        float k = 1.f / C->count; // the first N frames are simply averaged
+        if(is16) EMA(uint16_t);
+        else EMA(uint8_t);
+    }else{
+        int full = (C->count == C->N);
+        if(!full) ++C->count;
+        float k = 1.f / C->count;
+        if(is16) WINDOW(uint16_t);
+        else WINDOW(uint8_t);
+        // new frame replaces oldest
+        int idx = full ? C->oldest : C->count - 1;
+        memcpy(C->ring + idx * C->framesize, in->data, C->framesize);
+        if(full && ++C->oldest == C->N) C->oldest = 0;
+    }
+    copyfields(out, in);
+    out->imnumber = ++C->nout;
+    out->gotstat = 0;
+    return TRUE;
+}
+#undef WINDOW
+#undef EMA
+
+void coadd_free(coadder *C){
+    if(!C) return;
+    FREE(C->sum);
+    FREE(C->ring);
+    FREE(C->avg);
+    C->N = 0;
+}
@@ -0,0 +1,40 @@
+/*
+ * This file is part of the CCD_Capture project.
+ * Copyright 2026 Edward V. Emelianov <edward.emelianoff@gmail.com>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "ccdcapture.h"
+
+// running co-adding of last frames: exact sliding window mean or exponential moving average
+typedef struct{
+    int N;              // window length (frames)
+    int ema;            // exponential moving average with weight 1/N instead of exact window
+    int w, h;           // frame size
+    int bitpix;         // 8 or 16
+    int count;          // amount of frames in window (<= N)
+    int oldest;         // index of oldest frame in `ring`
+    size_t framesize;   // size of frame in bytes
+    size_t nout;        // counter of co-added images
+    uint32_t *sum;      // sum of frames in window
+    uint8_t *ring;      // last N raw frames
+    float *avg;         // exponential moving average
+} coadder;
+
+int coadd_init(coadder *C, int N, int ema);
+int coadd_add(coadder *C, cc_IMG *in, cc_IMG *out);
+void coadd_free(coadder *C);
@@ -0,0 +1,510 @@
+/*
+ * This file is part of the CCD_Capture project.
+ * Copyright 2026 Edward V. Emelianov <edward.emelianoff@gmail.com>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// native writer of simple 2D BYTE/USHORT FITS files: header and data are formed in one
+// aligned buffer and written by single write() (with O_DIRECT for large files);
+// also writes multi-extension series and Rice tile-compressed images
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <usefull_macros.h>
+
+#include "asyncwriter.h"
+#include "fitsdirect.h"
+#include "imfunc.h"
+#include "omp.h"
+
+// alignment of buffer and its size for O_DIRECT
+#define DIRECT_ALIGN    4096
+
+static uint8_t *buffer = NULL;
+static size_t bufsize = 0;
+static pthread_mutex_t bufmutex = PTHREAD_MUTEX_INITIALIZER;
+
+// amount of pixels in Rice block
+#define RICE_BLOCKSIZE  32
+
+// Rice encoders of cfitsio (declared only in its internal header fitsio2.h)
+int fits_rcomp_short(short a[], int nx, unsigned char *c, int clen, int nblock);
+int fits_rcomp_byte(signed char a[], int nx, unsigned char *c, int clen, int nblock);
+
+#define ROUNDUP(x, n)   (((x) + (n) - 1) / (n) * (n))
+
+/**
+ * @brief fitsdirect_supported - check if file could be saved by native writer
+ * @param fnam - file name
+ * @return FALSE for cfitsio extended file names (like "file.fits[compress]") or gzipped files
+ */
+int fitsdirect_supported(const char *fnam){
+    if(!fnam || !*fnam) return FALSE;
+    if(strchr(fnam, '[')) return FALSE;
+    size_t l = strlen(fnam);
+    if(l > 3 && 0 == strcmp(fnam + l - 3, ".gz")) return FALSE;
+    return TRUE;
+}
+
+// put card into header buffer
+static uint8_t *putcard(uint8_t *hdr, const char *card){
+    size_t l = strnlen(card, FITSHDR_CARDLEN);
+    memcpy(hdr, card, l); // rest is filled by spaces
+    return hdr + FITSHDR_CARDLEN;
+}
+
+// mandatory records of primary HDU (xtension == FALSE) or image extension
+static void mandatory(fitshdr *mand, cc_IMG *img, int xtension){
+    int nbytes = cc_getNbytes(img);
+    if(xtension) fitshdr_addstr(mand, "XTENSION", "IMAGE", "Image extension");
+    else fitshdr_addval(mand, "SIMPLE", "T", "file does conform to FITS standard");
+    fitshdr_addint(mand, "BITPIX", 8 * nbytes, "number of bits per data pixel");
+    fitshdr_addint(mand, "NAXIS", 2, "number of data axes");
+    fitshdr_addint(mand, "NAXIS1", img->w, "length of data axis 1");
+    fitshdr_addint(mand, "NAXIS2", img->h, "length of data axis 2");
+    if(xtension){
+        fitshdr_addint(mand, "PCOUNT", 0, "required keyword; must = 0");
+        fitshdr_addint(mand, "GCOUNT", 1, "required keyword; must = 1");
+    }else fitshdr_addval(mand, "EXTEND", "T", "FITS dataset may contain extensions");
+    if(nbytes == 2){
+        fitshdr_addint(mand, "BZERO", 32768, "offset data range to that of unsigned short");
+        fitshdr_addint(mand, "BSCALE", 1, "default scaling factor");
+    }
+}
+
+// realloc common buffer (bufmutex should be locked)
+static int bufalloc(size_t al){
+    if(bufsize >= al) return TRUE;
+    FREE(buffer);
+    bufsize = 0;
+    if(posix_memalign((void**)&buffer, DIRECT_ALIGN, al)){
+        WARN("posix_memalign()");
+        buffer = NULL;
+        return FALSE;
+    }
+    bufsize = al;
+    return TRUE;
+}
+
+// size of header with given records
+static size_t hdrsize(const fitshdr *mand, const fitshdr *h){
+    return ROUNDUP((size_t)(mand->ncards + h->ncards + 1) * FITSHDR_CARDLEN, FITS_BLOCK);
+}
+
+// put header into `dst`, return its size
+static size_t puthdr(uint8_t *dst, const fitshdr *mand, const fitshdr *h){
+    size_t hdrlen = hdrsize(mand, h);
+    memset(dst, ' ', hdrlen);
+    for(int i = 0; i < mand->ncards; ++i) dst = putcard(dst, fitshdr_card(mand, i));
+    for(int i = 0; i < h->ncards; ++i) dst = putcard(dst, fitshdr_card(h, i));
+    putcard(dst, "END");
+    return hdrlen;
+}
+
+// put image data into `dst` (in FITS byte order), return size of data padded to FITS block
+static size_t putdata(uint8_t *dst, cc_IMG *img){
+    if(!img) return 0;
+    int nbytes = cc_getNbytes(img);
+    size_t npix = (size_t)img->w * img->h, datalen = npix * nbytes, padded = ROUNDUP(datalen, FITS_BLOCK);
+    if(nbytes == 1) memcpy(dst, img->data, datalen);
+    else swap16_bzero((const uint16_t*)img->data, (uint16_t*)dst, npix);
+    memset(dst + datalen, 0, padded - datalen);
+    return padded;
+}
+
+// get buffer for `al` bytes: from asynchronous writer if it is running (*nbuf > -1)
+// or common buffer (bufmutex should be locked)
+static uint8_t *getbuf(size_t al, int *nbuf){
+    *nbuf = -1;
+    if(aw_running()){
+        uint8_t *data;
+        if((*nbuf = aw_getbuf(al, &data)) > -1) return data;
+    }
+    return bufalloc(al) ? buffer : NULL;
+}
+
+/**
+ * @brief mkhdu - form HDU in buffer got by getbuf() (bufmutex should be locked)
+ * @param mand - mandatory records
+ * @param h - other records
+ * @param img - image (or NULL for HDU without data)
+ * @param len (o) - length of HDU
+ * @param alen (o) - length of HDU aligned to DIRECT_ALIGN (the tail is filled by zeros)
+ * @param nbuf (o) - number of buffer of asynchronous writer or -1
+ * @return pointer to buffer or NULL if failed
+ */
+static uint8_t *mkhdu(const fitshdr *mand, const fitshdr *h, cc_IMG *img, size_t *len, size_t *alen, int *nbuf){
+    size_t datalen = img ? (size_t)img->w * img->h * cc_getNbytes(img) : 0;
+    size_t total = hdrsize(mand, h) + ROUNDUP(datalen, FITS_BLOCK);
+    size_t al = ROUNDUP(total, DIRECT_ALIGN);
+    uint8_t *buf = getbuf(al, nbuf);
+    if(!buf) return NULL;
+    size_t hdrlen = puthdr(buf, mand, h);
+    putdata(buf + hdrlen, img);
+    memset(buf + total, 0, al - total);
+    *len = total;
+    *alen = al;
+    return buf;
+}
+
+// write all data, if O_DIRECT write failed - clear this flag and continue
+static int writeall(int fd, const uint8_t *data, size_t len, size_t directlen){
+    size_t written = 0, total = directlen;
+    while(written < total){
+        ssize_t w = write(fd, data + written, total - written);
+        if(w < 0){
+            if(errno == EINTR) continue;
+            if(errno == EINVAL && total != len){ // O_DIRECT don't supported
+                DBG("O_DIRECT write failed, continue in buffered mode");
+                int fl = fcntl(fd, F_GETFL);
+                if(fl < 0 || fcntl(fd, F_SETFL, fl & ~O_DIRECT) < 0) return FALSE;
+                total = len;
+                continue;
+            }
+            return FALSE;
+        }
+        written += w;
+    }
+    if(total != len && ftruncate(fd, len)) return FALSE; // remove alignment tail
+    return TRUE;
+}
+
+// create file `fnam` and write `total` bytes of `buf` (`alen` bytes are available for O_DIRECT)
+static int writefile(const char *fnam, int rewrite, const uint8_t *buf, size_t total, size_t alen){
+    int ret = FALSE;
+    int fd = open(fnam, O_WRONLY | O_CREAT | O_CLOEXEC | (rewrite ? O_TRUNC : O_EXCL), 0666);
+    if(fd < 0){
+        WARN(_("Can't create file %s"), fnam);
+    }else{
+        size_t wlen = total;
+        if(total >= FITSDIRECT_MINDIRECT){ // try to bypass page cache for large files
+            int fl = fcntl(fd, F_GETFL);
+            if(fl > -1 && 0 == fcntl(fd, F_SETFL, fl | O_DIRECT)) wlen = alen;
+        }
+        if(!writeall(fd, buf, total, wlen)) WARN(_("Can't write file %s"), fnam);
+        else ret = TRUE;
+        if(close(fd)){
+            WARN("close()");
+            ret = FALSE;
+        }
+        if(!ret) unlink(fnam);
+    }
+    return ret;
+}
+
+// write buffer got by getbuf(): queue it to asynchronous writer or write immediately
+static int putbuf(int nbuf, const char *fnam, int rewrite, const uint8_t *buf, size_t total, size_t alen){
+    if(nbuf > -1) return aw_write(nbuf, fnam, rewrite, total, (total >= FITSDIRECT_MINDIRECT) ? alen : total) ?
+                         FITSDIRECT_QUEUED : FALSE;
+    return writefile(fnam, rewrite, buf, total, alen);
+}
+
+/**
+ * @brief fitsdirect_save - save 8- or 16-bit image (16-bit as signed with BZERO=32768)
+ * @param fnam - file name (with leading '!' to rewrite existing file)
+ * @param h - header without mandatory keywords and END
+ * @param img - image
+ * @return TRUE if all OK
+ */
+int fitsdirect_save(const char *fnam, const fitshdr *h, cc_IMG *img){
+    if(!fnam || !h || !img || !img->data) return FALSE;
+    int rewrite = FALSE;
+    if(*fnam == '!'){
+        rewrite = TRUE;
+        ++fnam;
+    }
+    fitshdr mand = {0};
+    mandatory(&mand, img, FALSE);
+    size_t total, alen;
+    int nbuf;
+    pthread_mutex_lock(&bufmutex);
+    uint8_t *buf = mkhdu(&mand, h, img, &total, &alen, &nbuf);
+    fitshdr_free(&mand);
+    if(!buf){
+        pthread_mutex_unlock(&bufmutex);
+        return FALSE;
+    }
+    int ret = putbuf(nbuf, fnam, rewrite, buf, total, alen);
+    pthread_mutex_unlock(&bufmutex);
+    return ret;
+}
+
+// put big-endian 32-bit integer
+static inline void putbe32(uint8_t *p, uint32_t v){
+    p[0] = v >> 24; p[1] = v >> 16; p[2] = v >> 8; p[3] = v;
+}
+
+/**
+ * @brief fitsdirect_save_rice - save 8- or 16-bit image as lossless tile-compressed (RICE_1) FITS
+ *        Each row is a tile; tiles are compressed in parallel and placed into the heap of
+ *        binary table "COMPRESSED_IMAGE" (as cfitsio/fpack do), so file is readable by any FITS reader.
+ * @param fnam - file name (with leading '!' to rewrite existing file)
+ * @param h - header without mandatory keywords and END
+ * @param img - image
+ * @return TRUE if all OK
+ */
+int fitsdirect_save_rice(const char *fnam, const fitshdr *h, cc_IMG *img){
+    if(!fnam || !h || !img || !img->data) return FALSE;
+    int rewrite = FALSE;
+    if(*fnam == '!'){
+        rewrite = TRUE;
+        ++fnam;
+    }
+    int nbytes = cc_getNbytes(img), w = img->w, ntiles = img->h;
+    size_t tilemax = (size_t)w * nbytes + w / 16 + 16; // worst case of Rice coding
+    uint8_t *tiles = MALLOC(uint8_t, tilemax * ntiles);
+    int *tlen = MALLOC(int, ntiles);
+    int bad = FALSE;
+#pragma omp parallel
+    {
+        short *row = (nbytes == 2) ? MALLOC(short, w) : NULL;
+        #pragma omp for schedule(dynamic, 8) reduction(||:bad)
+        for(int t = 0; t < ntiles; ++t){
+            uint8_t *out = tiles + tilemax * t;
+            if(nbytes == 1) tlen[t] = fits_rcomp_byte((signed char*)img->data + (size_t)t * w, w, out, (int)tilemax, RICE_BLOCKSIZE);
+            else{
+                const uint16_t *in = (const uint16_t*)img->data + (size_t)t * w;
+                for(int i = 0; i < w; ++i) row[i] = (short)(in[i] ^ 0x8000); // BZERO = 32768
+                tlen[t] = fits_rcomp_short(row, w, out, (int)tilemax, RICE_BLOCKSIZE);
+            }
+            if(tlen[t] < 0) bad = TRUE;
+        }
+        FREE(row);
+    }
+    size_t *offset = MALLOC(size_t, ntiles), heap = 0;
+    int maxlen = 0;
+    for(int t = 0; t < ntiles && !bad; ++t){
+        offset[t] = heap;
+        heap += tlen[t];
+        if(tlen[t] > maxlen) maxlen = tlen[t];
+    }
+    if(bad || heap > INT32_MAX){
+        WARNX(_("Can't compress image"));
+        FREE(tiles); FREE(tlen); FREE(offset);
+        return FALSE;
+    }
+    // primary HDU is empty, image is in the first extension
+    fitshdr prim = {0}, empty = {0}, ext = {0};
+    fitshdr_addval(&prim, "SIMPLE", "T", "file does conform to FITS standard");
+    fitshdr_addint(&prim, "BITPIX", 8, "number of bits per data pixel");
+    fitshdr_addint(&prim, "NAXIS", 0, "number of data axes");
+    fitshdr_addval(&prim, "EXTEND", "T", "FITS dataset may contain extensions");
+    char tform[FLEN_VALUE];
+    snprintf(tform, FLEN_VALUE, "1PB(%d)", maxlen);
+    fitshdr_addstr(&ext, "XTENSION", "BINTABLE", "binary table extension");
+    fitshdr_addint(&ext, "BITPIX", 8, "8-bit bytes");
+    fitshdr_addint(&ext, "NAXIS", 2, "2-dimensional binary table");
+    fitshdr_addint(&ext, "NAXIS1", 8, "width of table in bytes");
+    fitshdr_addint(&ext, "NAXIS2", ntiles, "number of rows in table");
+    fitshdr_addint(&ext, "PCOUNT", (long)heap, "size of special data area");
+    fitshdr_addint(&ext, "GCOUNT", 1, "one data group (required keyword)");
+    fitshdr_addint(&ext, "TFIELDS", 1, "number of fields in each row");
+    fitshdr_addstr(&ext, "TTYPE1", "COMPRESSED_DATA", "label for field 1");
+    fitshdr_addstr(&ext, "TFORM1", tform, "data format of field: variable length array");
+    fitshdr_addval(&ext, "ZIMAGE", "T", "extension contains compressed image");
+    fitshdr_addint(&ext, "ZBITPIX", 8 * nbytes, "data type of original image");
+    fitshdr_addint(&ext, "ZNAXIS", 2, "dimension of original image");
+    fitshdr_addint(&ext, "ZNAXIS1", w, "length of original image axis");
+    fitshdr_addint(&ext, "ZNAXIS2", ntiles, "length of original image axis");
+    fitshdr_addint(&ext, "ZTILE1", w, "size of tiles to be compressed");
+    fitshdr_addint(&ext, "ZTILE2", 1, "size of tiles to be compressed");
+    fitshdr_addstr(&ext, "ZCMPTYPE", "RICE_1", "compression algorithm");
+    fitshdr_addstr(&ext, "ZNAME1", "BLOCKSIZE", "compression block size");
+    fitshdr_addint(&ext, "ZVAL1", RICE_BLOCKSIZE, "pixels per block");
+    fitshdr_addstr(&ext, "ZNAME2", "BYTEPIX", "bytes per pixel (1, 2, 4, or 8)");
+    fitshdr_addint(&ext, "ZVAL2", nbytes, "bytes per pixel (1, 2, 4, or 8)");
+    fitshdr_addstr(&ext, "EXTNAME", "COMPRESSED_IMAGE", "name of this binary table extension");
+    if(nbytes == 2){
+        fitshdr_addint(&ext, "BZERO", 32768, "offset data range to that of unsigned short");
+        fitshdr_addint(&ext, "BSCALE", 1, "default scaling factor");
+    }
+    size_t phdr = hdrsize(&prim, &empty), xhdr = hdrsize(&ext, h), datalen = 8 * (size_t)ntiles + heap;
+    size_t total = phdr + xhdr + ROUNDUP(datalen, FITS_BLOCK), alen = ROUNDUP(total, DIRECT_ALIGN);
+    int ret = FALSE, nbuf;
+    pthread_mutex_lock(&bufmutex);
+    uint8_t *buf = getbuf(alen, &nbuf);
+    if(buf){
+        puthdr(buf, &prim, &empty);
+        puthdr(buf + phdr, &ext, h);
+        uint8_t *table = buf + phdr + xhdr, *heapptr = table + 8 * (size_t)ntiles;
+        OMP_FOR()
+        for(int t = 0; t < ntiles; ++t){ // descriptors: length and offset in heap
+            putbe32(table + 8 * (size_t)t, (uint32_t)tlen[t]);
+            putbe32(table + 8 * (size_t)t + 4, (uint32_t)offset[t]);
+            memcpy(heapptr + offset[t], tiles + tilemax * t, tlen[t]);
+        }
+        memset(table + datalen, 0, buf + alen - table - datalen);
+        ret = putbuf(nbuf, fnam, rewrite, buf, total, alen);
+    }
+    pthread_mutex_unlock(&bufmutex);
+    fitshdr_free(&prim);
+    fitshdr_free(&ext);
+    FREE(tiles); FREE(tlen); FREE(offset);
+    return ret;
+}
+
+// grow series file and its mapping to hold at least `size` bytes
+static int seriesgrow(fitsseries *s, size_t size){
+    if(size <= s->mapsize) return TRUE;
+    size_t newsize = s->mapsize * 2;
+    if(newsize < size) newsize = size;
+    int e = posix_fallocate(s->fd, 0, newsize);
+    if(e){
+        if(e != EOPNOTSUPP && e != EINVAL){
+            WARNX("posix_fallocate(): %s", strerror(e));
+            return FALSE;
+        }
+        // file system can't preallocate: write zeros to allocate blocks, otherwise ENOSPC would come
+        // as SIGBUS when writing through mapping
+        static const uint8_t zeros[65536] = {0};
+        for(size_t pos = s->mapsize; pos < newsize;){
+            size_t l = newsize - pos;
+            if(l > sizeof(zeros)) l = sizeof(zeros);
+            ssize_t w = pwrite(s->fd, zeros, l, (off_t)pos);
+            if(w < 0){
+                if(errno == EINTR) continue;
+                WARN("pwrite()");
+                return FALSE;
+            }
+            pos += (size_t)w;
+        }
+    }
+    uint8_t *map = s->map ? mremap(s->map, s->mapsize, newsize, MREMAP_MAYMOVE) :
+                          mmap(NULL, newsize, PROT_READ | PROT_WRITE, MAP_SHARED, s->fd, 0);
+    if(map == MAP_FAILED){
+        WARN("mmap()");
+        return FALSE;
+    }
+    DBG("Series file mapped: %zd bytes", newsize);
+    s->map = map;
+    s->mapsize = newsize;
+    return TRUE;
+}
+
+/**
+ * @brief fitsseries_open - create multi-extension FITS file for series of frames
+ *        File is preallocated for `nframes` (or FITSSERIES_MINFRAMES) frames, mapped into memory
+ *        and grown when needed; on close it is truncated to real size.
+ * @param s - series
+ * @param fnam - file name (with leading '!' to rewrite existing file)
+ * @param h - records of primary HDU (common for all series)
+ * @param img - first image of series (to calculate file size)
+ * @param nframes - expected amount of frames or 0
+ * @return TRUE if all OK
+ */
+int fitsseries_open(fitsseries *s, const char *fnam, const fitshdr *h, cc_IMG *img, int nframes){
+    if(!s || !fnam || !h || !img) return FALSE;
+    if(s->fd > -1) fitsseries_close(s);
+    int rewrite = FALSE;
+    if(*fnam == '!'){
+        rewrite = TRUE;
+        ++fnam;
+    }
+    int fd = open(fnam, O_RDWR | O_CREAT | O_CLOEXEC | (rewrite ? O_TRUNC : O_EXCL), 0666);
+    if(fd < 0){
+        WARN(_("Can't create file %s"), fnam);
+        return FALSE;
+    }
+    *s = (fitsseries){.fd = fd};
+    // primary HDU without data; NEXTEND would be changed on closing
+    fitshdr mand = {0};
+    fitshdr_addval(&mand, "SIMPLE", "T", "file does conform to FITS standard");
+    fitshdr_addint(&mand, "BITPIX", 8, "number of bits per data pixel");
+    fitshdr_addint(&mand, "NAXIS", 0, "number of data axes");
+    fitshdr_addval(&mand, "EXTEND", "T", "FITS dataset may contain extensions");
+    fitshdr_addint(&mand, "NEXTEND", 0, "number of extensions (frames)");
+    size_t total = hdrsize(&mand, h);
+    // frame header is estimated as two blocks, if it is larger, file will be grown
+    size_t hdu = 2 * FITS_BLOCK + ROUNDUP((size_t)img->w * img->h * cc_getNbytes(img), FITS_BLOCK);
+    if(nframes < FITSSERIES_MINFRAMES) nframes = FITSSERIES_MINFRAMES;
+    int ok = seriesgrow(s, total + hdu * nframes);
+    if(ok) puthdr(s->map, &mand, h);
+    fitshdr_free(&mand);
+    if(!ok){
+        WARNX(_("Can't write file %s"), fnam);
+        if(s->map) munmap(s->map, s->mapsize);
+        close(fd);
+        unlink(fnam);
+        *s = (fitsseries){.fd = -1};
+        return FALSE;
+    }
+    s->name = strdup(fnam);
+    s->offset = total;
+    s->nextendpos = 4 * FITSHDR_CARDLEN; // fifth card
+    return TRUE;
+}
+
+/**
+ * @brief fitsseries_add - add next frame as image extension
+ *        Header and data are written directly into file mapping, then writeback of this frame is
+ *        started and previous frame is dropped from page cache.
+ * @param s - series
+ * @param h - records of frame
+ * @param img - image
+ * @return TRUE if all OK
+ */
+int fitsseries_add(fitsseries *s, const fitshdr *h, cc_IMG *img){
+    if(!s || s->fd < 0 || !h || !img || !img->data) return FALSE;
+    fitshdr mand = {0};
+    mandatory(&mand, img, TRUE);
+    size_t total = hdrsize(&mand, h) + ROUNDUP((size_t)img->w * img->h * cc_getNbytes(img), FITS_BLOCK);
+    if(!seriesgrow(s, s->offset + total)){
+        fitshdr_free(&mand);
+        WARNX(_("Can't write file %s"), s->name);
+        return FALSE;
+    }
+    uint8_t *dst = s->map + s->offset;
+    dst += puthdr(dst, &mand, h);
+    putdata(dst, img);
+    fitshdr_free(&mand);
+    sync_file_range(s->fd, s->offset, total, SYNC_FILE_RANGE_WRITE);
+    if(s->prevlen){ // previous frame should be already written
+        sync_file_range(s->fd, s->prevoffset, s->prevlen,
+                        SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+        posix_fadvise(s->fd, s->prevoffset, s->prevlen, POSIX_FADV_DONTNEED);
+    }
+    s->prevoffset = s->offset;
+    s->prevlen = total;
+    s->offset += total;
+    ++s->nframes;
+    return TRUE;
+}
+
+/**
+ * @brief fitsseries_close - set NEXTEND, remove preallocated tail and close file
+ * @param s - series
+ * @return TRUE if all OK
+ */
+int fitsseries_close(fitsseries *s){
+    if(!s || s->fd < 0) return FALSE;
+    int ret = TRUE;
+    fitshdr c = {0};
+    fitshdr_addint(&c, "NEXTEND", s->nframes, "number of extensions (frames)");
+    memcpy(s->map + s->nextendpos, fitshdr_card(&c, 0), FITSHDR_CARDLEN);
+    fitshdr_free(&c);
+    if(munmap(s->map, s->mapsize)) ret = FALSE;
+    if(ftruncate(s->fd, s->offset)) ret = FALSE;
+    if(close(s->fd)) ret = FALSE;
+    if(!ret) WARN(_("Can't write file %s"), s->name);
+    FREE(s->name);
+    *s = (fitsseries){.fd = -1};
+    return ret;
+}
@@ -0,0 +1,55 @@
+/*
+ * This file is part of the CCD_Capture project.
+ * Copyright 2026 Edward V. Emelianov <edward.emelianoff@gmail.com>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "ccdcapture.h"
+#include "fitshdr.h"
+
+// FITS block size
+#define FITS_BLOCK          2880
+// use O_DIRECT for files not less than this size
+#define FITSDIRECT_MINDIRECT (1<<20)
+
+// fitsdirect_save*() return value if file is queued to asynchronous writer (it logs result by itself)
+#define FITSDIRECT_QUEUED   2
+
+int fitsdirect_supported(const char *fnam);
+int fitsdirect_save(const char *fnam, const fitshdr *h, cc_IMG *img);
+int fitsdirect_save_rice(const char *fnam, const fitshdr *h, cc_IMG *img);
+
+// minimal amount of frames to preallocate series file
+#define FITSSERIES_MINFRAMES    8
+
+// multi-extension FITS for series: primary HDU with common records and image extension for each frame;
+// file is preallocated and memory-mapped, frames are written directly into mapping
+typedef struct{
+    int fd;             // file descriptor (-1 if closed)
+    char *name;         // file name
+    uint8_t *map;       // file mapping
+    size_t mapsize;     // size of mapping (and preallocated file)
+    size_t offset;      // end of last HDU
+    size_t prevoffset;  // offset of previous HDU
+    size_t prevlen;     // its length
+    size_t nextendpos;  // position of NEXTEND card in file
+    int nframes;        // amount of frames written
+} fitsseries;
+
+int fitsseries_open(fitsseries *s, const char *fnam, const fitshdr *h, cc_IMG *img, int nframes);
+int fitsseries_add(fitsseries *s, const fitshdr *h, cc_IMG *img);
+int fitsseries_close(fitsseries *s);
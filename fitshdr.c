@@ -0,0 +1,273 @@
+/*
+ * This file is part of the CCD_Capture project.
+ * Copyright 2026 Edward V. Emelianov <edward.emelianoff@gmail.com>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// pre-formatted FITS headers: cards are formatted once and written without keyword search
+
+#include <stdio.h>
+#include <string.h>
+#include <usefull_macros.h>
+
+#include "ccdcapture.h"
+#include "fitshdr.h"
+
+// key card have '=' at 9th position
+#define ISKEYCARD(c)    ((c)[8] == '=')
+
+void fitshdr_clear(fitshdr *h){
+    if(h) h->ncards = 0;
+}
+
+void fitshdr_free(fitshdr *h){
+    if(!h) return;
+    FREE(h->cards);
+    h->ncards = h->size = 0;
+}
+
+/**
+ * @brief fitshdr_card - get card by number
+ * @param h - header
+ * @param n - card number
+ * @return pointer to card (FITSHDR_CARDLEN bytes without trailing zero) or NULL
+ */
+const char *fitshdr_card(const fitshdr *h, int n){
+    if(!h || n < 0 || n >= h->ncards) return NULL;
+    return h->cards + (size_t)n * FITSHDR_CARDLEN;
+}
+
+// find card with the same key as in `card`, return its number or -1
+static int findkey(const fitshdr *h, const char *card){
+    if(!h || !ISKEYCARD(card)) return -1;
+    for(int i = 0; i < h->ncards; ++i){
+        const char *c = h->cards + (size_t)i * FITSHDR_CARDLEN;
+        if(ISKEYCARD(c) && 0 == memcmp(c, card, 8)) return i;
+    }
+    return -1;
+}
+
+/**
+ * @brief fitshdr_haskey - check if header have card with the same key as `card`
+ * @param h - header
+ * @param card - formatted card
+ * @return TRUE if found
+ */
+int fitshdr_haskey(const fitshdr *h, const char *card){
+    return (findkey(h, card) > -1);
+}
+
+/**
+ * @brief fitshdr_delkey - remove card with given key
+ * @param h - header
+ * @param key - keyword
+ * @return TRUE if found and removed
+ */
+int fitshdr_delkey(fitshdr *h, const char *key){
+    if(!h || !key) return FALSE;
+    char card[FLEN_CARD];
+    snprintf(card, FLEN_CARD, "%-8.8s=", key);
+    int n = findkey(h, card);
+    if(n < 0) return FALSE;
+    char *c = h->cards + (size_t)n * FITSHDR_CARDLEN;
+    memmove(c, c + FITSHDR_CARDLEN, (size_t)(h->ncards - n - 1) * FITSHDR_CARDLEN);
+    --h->ncards;
+    return TRUE;
+}
+
+/**
+ * @brief fitshdr_addcard - add formatted card (replace card with the same key)
+ * @param h - header
+ * @param card - card (will be padded by spaces to 80 characters)
+ * @return FALSE if failed
+ */
+int fitshdr_addcard(fitshdr *h, const char *card){
+    if(!h || !card) return FALSE;
+    char c[FITSHDR_CARDLEN];
+    size_t l = strnlen(card, FITSHDR_CARDLEN);
+    memcpy(c, card, l);
+    if(l < FITSHDR_CARDLEN) memset(c + l, ' ', FITSHDR_CARDLEN - l);
+    int n = findkey(h, c);
+    if(n < 0){
+        if(h->ncards == h->size){
+            int newsz = h->size + 64;
+            char *nc = realloc(h->cards, (size_t)newsz * FITSHDR_CARDLEN);
+            if(!nc){
+                WARN("realloc()");
+                return FALSE;
+            }
+            h->cards = nc;
+            h->size = newsz;
+        }
+        n = h->ncards++;
+    }
+    memcpy(h->cards + (size_t)n * FITSHDR_CARDLEN, c, FITSHDR_CARDLEN);
+    return TRUE;
+}
+
+/**
+ * @brief fitshdr_addtempl - parse record like "KEY = value / comment" and add it
+ * @param h - header
+ * @param templ - template
+ * @return FALSE if failed
+ */
+int fitshdr_addtempl(fitshdr *h, const char *templ){
+    if(!h || !templ) return FALSE;
+    char t[2*FLEN_CARD], card[FLEN_CARD];
+    int status = 0, kt = 0;
+    snprintf(t, 2*FLEN_CARD, "%s", templ);
+    fits_parse_template(t, card, &kt, &status);
+    if(status){
+        fits_report_error(stderr, status);
+        return FALSE;
+    }
+    return fitshdr_addcard(h, card);
+}
+
+/**
+ * @brief fitshdr_addval - add card with already formatted value
+ * @param h - header
+ * @param key - keyword (up to 8 characters)
+ * @param val - value (numbers are right-justified to 30th column)
+ * @param comment - comment
+ * @return FALSE if failed
+ */
+int fitshdr_addval(fitshdr *h, const char *key, const char *val, const char *comment){
+    if(!h || !key || !val) return FALSE;
+    char card[FLEN_CARD];
+    if(comment) snprintf(card, FLEN_CARD, "%-8.8s= %20s / %s", key, val, comment);
+    else snprintf(card, FLEN_CARD, "%-8.8s= %20s", key, val);
+    return fitshdr_addcard(h, card);
+}
+
+int fitshdr_addint(fitshdr *h, const char *key, long val, const char *comment){
+    char buf[32];
+    snprintf(buf, 32, "%ld", val);
+    return fitshdr_addval(h, key, buf, comment);
+}
+
+int fitshdr_addflt(fitshdr *h, const char *key, double val, const char *comment){
+    char buf[32];
+    snprintf(buf, 32, "%g", val);
+    return fitshdr_addval(h, key, buf, comment);
+}
+
+/**
+ * @brief fitshdr_addstr - add string card (quotes are doubled, value is left-justified)
+ * @param h - header
+ * @param key - keyword
+ * @param val - string value
+ * @param comment - comment
+ * @return FALSE if failed
+ */
+int fitshdr_addstr(fitshdr *h, const char *key, const char *val, const char *comment){
+    if(!h || !key || !val) return FALSE;
+    char q[FLEN_CARD], card[FLEN_CARD];
+    int l = 0;
+    q[l++] = '\'';
+    for(; *val && l < FITSHDR_CARDLEN - 12; ++val){
+        if(*val == '\'') q[l++] = '\'';
+        q[l++] = *val;
+    }
+    while(l < 9) q[l++] = ' '; // string value should have at least 8 characters
+    q[l++] = '\'';
+    q[l] = 0;
+    if(comment) snprintf(card, FLEN_CARD, "%-8.8s= %-20s / %s", key, q, comment);
+    else snprintf(card, FLEN_CARD, "%-8.8s= %s", key, q);
+    return fitshdr_addcard(h, card);
+}
+
+/**
+ * @brief fitshdr_addfile - add records from file
+ * @param h - header
+ * @param filename - file name with FITS headers ('\n'-terminated or by 80 chars)
+ * @return amount of records added
+ */
+int fitshdr_addfile(fitshdr *h, const char *filename){
+    if(!h || !filename) return 0;
+    sl_mmapbuf_t *buf = sl_mmap((char*)filename);
+    if(!buf || buf->len < 1){
+        WARNX(_("Can't add FITS records from file %s"), filename);
+        LOGWARN("Can't add FITS records from file %s", filename);
+        return 0;
+    }
+    char rec[FLEN_CARD];
+    char *data = buf->data, *x = strchr(data, '\n'), *eodata = buf->data + buf->len;
+    int newlines = 0;
+    if(x && (x - data) < FLEN_CARD){ // we found newline -> this is a format with newlines
+        newlines = 1;
+    }
+    int written = 0;
+    do{
+        data = cc_nextkw(data, rec, newlines);
+        if(data > eodata) break;
+        if(fitshdr_addtempl(h, rec)) ++written;
+    }while(data && *data);
+    sl_munmap(buf);
+    return written;
+}
+
+/**
+ * @brief fitshdr_addcomment - add COMMENT cards (long text is divided into several cards)
+ * @param h - header
+ * @param text - comment
+ * @return FALSE if failed
+ */
+int fitshdr_addcomment(fitshdr *h, const char *text){
+    if(!h || !text) return FALSE;
+    char card[FLEN_CARD];
+    do{
+        snprintf(card, FLEN_CARD, "COMMENT %.72s", text);
+        if(!fitshdr_addcard(h, card)) return FALSE;
+        text += strnlen(text, 72);
+    }while(*text);
+    return TRUE;
+}
+
+/**
+ * @brief fitshdr_append - add all cards of `src` to `dst` (cards with the same keys are replaced)
+ * @param dst - destination header
+ * @param src - source header
+ * @return FALSE if failed
+ */
+int fitshdr_append(fitshdr *dst, const fitshdr *src){
+    if(!dst || !src) return FALSE;
+    char card[FLEN_CARD];
+    for(int i = 0; i < src->ncards; ++i){
+        memcpy(card, fitshdr_card(src, i), FITSHDR_CARDLEN);
+        card[FITSHDR_CARDLEN] = 0;
+        if(!fitshdr_addcard(dst, card)) return FALSE;
+    }
+    return TRUE;
+}
+
+/**
+ * @brief fitshdr_write - write all cards of header into current HDU
+ * @param fp - FITS file
+ * @param h - header
+ * @return cfitsio status
+ */
+int fitshdr_write(fitsfile *fp, const fitshdr *h){
+    if(!fp || !h) return 0;
+    char card[FLEN_CARD];
+    int status = 0;
+    for(int i = 0; i < h->ncards && !status; ++i){
+        memcpy(card, fitshdr_card(h, i), FITSHDR_CARDLEN);
+        card[FITSHDR_CARDLEN] = 0;
+        fits_write_record(fp, card, &status);
+    }
+    if(status) fits_report_error(stderr, status);
+    return status;
+}
@@ -0,0 +1,47 @@
+/*
+ * This file is part of the CCD_Capture project.
+ * Copyright 2026 Edward V. Emelianov <edward.emelianoff@gmail.com>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <fitsio.h>
+
+// length of FITS card without trailing zero
+#define FITSHDR_CARDLEN     (FLEN_CARD - 1)
+
+// set of ready 80-character FITS cards; key cards are unique (adding the same key replaces old card)
+typedef struct{
+    char *cards;        // `ncards` cards of FITSHDR_CARDLEN bytes each (not zero-terminated)
+    int ncards;         // amount of cards
+    int size;           // amount of cards allocated
+} fitshdr;
+
+void fitshdr_clear(fitshdr *h);
+void fitshdr_free(fitshdr *h);
+const char *fitshdr_card(const fitshdr *h, int n);
+int fitshdr_haskey(const fitshdr *h, const char *card);
+int fitshdr_delkey(fitshdr *h, const char *key);
+int fitshdr_addcard(fitshdr *h, const char *card);
+int fitshdr_addtempl(fitshdr *h, const char *templ);
+int fitshdr_addval(fitshdr *h, const char *key, const char *val, const char *comment);
+int fitshdr_addint(fitshdr *h, const char *key, long val, const char *comment);
+int fitshdr_addflt(fitshdr *h, const char *key, double val, const char *comment);
+int fitshdr_addstr(fitshdr *h, const char *key, const char *val, const char *comment);
+int fitshdr_addfile(fitshdr *h, const char *filename);
+int fitshdr_addcomment(fitshdr *h, const char *text);
+int fitshdr_append(fitshdr *dst, const fitshdr *src);
+int fitshdr_write(fitsfile *fp, const fitshdr *h);
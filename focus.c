@@ -0,0 +1,108 @@
+/*
+ * This file is part of the CCD_Capture project.
+ * Copyright 2026 Edward V. Emelianov <edward.emelianoff@gmail.com>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <usefull_macros.h>
+
+#include "focus.h"
+
+static int fltcmp(const void *a, const void *b){
+    float fa = *(const float*)a, fb = *(const float*)b;
+    if(fa < fb) return -1;
+    if(fa > fb) return 1;
+    return 0;
+}
+
+/**
+ * @brief focus_starsize - size of stars on image
+ * Saturated sources and sources touching edges of image are ignored.
+ * @param T      - table of sources
+ * @param nstars (o) - amount of stars used (could be NULL)
+ * @return median FWHM of stars or 0 if there's less than FOCUS_MINSTARS stars
+ */
+float focus_starsize(const sourcetable *T, int *nstars){
+    float fwhm[SOURCES_MAX];
+    int n = 0;
+    if(nstars) *nstars = 0;
+    if(!T) return 0.f;
+    for(int i = 0; i < T->nsources; ++i){
+        const source_t *s = &T->sources[i];
+        if(s->flags || s->fwhm <= 0.f) continue;
+        fwhm[n++] = s->fwhm;
+    }
+    if(nstars) *nstars = n;
+    if(n < FOCUS_MINSTARS) return 0.f;
+    qsort(fwhm, n, sizeof(float), fltcmp);
+    if(n & 1) return fwhm[n/2];
+    return (fwhm[n/2 - 1] + fwhm[n/2]) / 2.f;
+}
+
+/**
+ * @brief focus_fit - find best focus by V-curve
+ * Defocused star image is a hyperbola FWHM^2 = a*(x - x0)^2 + c, so parabola is fitted to squared
+ * sizes by least squares; points without stars are ignored.
+ * @param C       - focus curve
+ * @param best    (o) - position of best focus
+ * @param minfwhm (o) - FWHM in focus (could be NULL)
+ * @return FALSE if there's less than 3 points, curve isn't V-like or its minimum is out of range
+ */
+int focus_fit(const focuscurve *C, double *best, double *minfwhm){
+    if(!C || !best) return FALSE;
+    int n = 0;
+    double xmean = 0., xmin = INFINITY, xmax = -INFINITY;
+    for(int i = 0; i < C->npoints; ++i){
+        if(C->fwhm[i] <= 0.f) continue;
+        ++n;
+        xmean += C->pos[i];
+        if(C->pos[i] < xmin) xmin = C->pos[i];
+        if(C->pos[i] > xmax) xmax = C->pos[i];
+    }
+    if(n < 3) return FALSE;
+    xmean /= n;
+    // normal equations for y = A*x^2 + B*x + C with x relative to mean position
+    double S[5] = {0}, Y[3] = {0};
+    for(int i = 0; i < C->npoints; ++i){
+        if(C->fwhm[i] <= 0.f) continue;
+        double x = C->pos[i] - xmean, y = (double)C->fwhm[i] * C->fwhm[i], xp = 1.;
+        for(int p = 0; p < 5; ++p){
+            S[p] += xp;
+            if(p < 3) Y[p] += y * xp;
+            xp *= x;
+        }
+    }
+    // | S4 S3 S2 | |A|   |Y2|
+    // | S3 S2 S1 | |B| = |Y1|
+    // | S2 S1 S0 | |C|   |Y0|
+#define DET3(a,b,c,d,e,f,g,h,i) ((a)*((e)*(i)-(f)*(h)) - (b)*((d)*(i)-(f)*(g)) + (c)*((d)*(h)-(e)*(g)))
+    double D = DET3(S[4], S[3], S[2], S[3], S[2], S[1], S[2], S[1], S[0]);
+    if(fabs(D) < 1e-30) return FALSE;
+    double A = DET3(Y[2], S[3], S[2], Y[1], S[2], S[1], Y[0], S[1], S[0]) / D;
+    double B = DET3(S[4], Y[2], S[2], S[3], Y[1], S[1], S[2], Y[0], S[0]) / D;
+    double c = DET3(S[4], S[3], Y[2], S[3], S[2], Y[1], S[2], S[1], Y[0]) / D;
+#undef DET3
+    if(A <= 0.) return FALSE; // not a V-curve
+    double x0 = -B / (2. * A);
+    if(x0 + xmean < xmin || x0 + xmean > xmax) return FALSE; // minimum is out of measured range
+    *best = x0 + xmean;
+    if(minfwhm){
+        double f2 = c - B * B / (4. * A);
+        *minfwhm = (f2 > 0.) ? sqrt(f2) : 0.;
+    }
+    return TRUE;
+}
@@ -0,0 +1,37 @@
+/*
+ * This file is part of the CCD_Capture project.
+ * Copyright 2026 Edward V. Emelianov <edward.emelianoff@gmail.com>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "sources.h"
+
+// max amount of points in focus curve
+#define FOCUS_MAXPOINTS     128
+// minimal amount of stars to measure their size
+#define FOCUS_MINSTARS      3
+
+// focus curve: star sizes (median FWHM in pixels) at focuser positions
+typedef struct{
+    int npoints;
+    float pos[FOCUS_MAXPOINTS];     // focuser position
+    float fwhm[FOCUS_MAXPOINTS];    // median FWHM (or 0 if no stars found)
+    int nstars[FOCUS_MAXPOINTS];    // amount of stars used
+} focuscurve;
+
+float focus_starsize(const sourcetable *T, int *nstars);
+int focus_fit(const focuscurve *C, double *best, double *minfwhm);
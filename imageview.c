@@ -26,6 +26,7 @@
 #include "ccdfunc.h"
 #include "cmdlnopts.h"
 #include "imageview.h"
+#include "imfunc.h"
 #include "events.h"
 #include "omp.h"
 #include "socket.h" // for timestamp
@@ -119,7 +120,7 @@ static void createWindow(){
     glPixelStorei(GL_UNPACK_SKIP_PIXELS, 0);
     glPixelStorei(GL_UNPACK_SKIP_ROWS, 0);
     glBindTexture(GL_TEXTURE_2D, win->Tex);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, win->image->w, win->image->h, 0,
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, win->image->tw, win->image->th, 0,
             GL_RGB, GL_UNSIGNED_BYTE, win->image->rawdata);
     glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
     glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
@@ -215,22 +216,27 @@ static void RedrawWindow(){
         pthread_mutex_lock(&win->mutex);
         DBG("Image changed!");
         glTexEnvf(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_REPLACE);
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, win->image->w, win->image->h, 0,
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, win->image->tw, win->image->th, 0,
                 GL_RGB, GL_UNSIGNED_BYTE, win->image->rawdata);
-       /* glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, win->image->w, win->image->h,
+       /* glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, win->image->tw, win->image->th,
                         GL_RGB, GL_UNSIGNED_BYTE, win->image->rawdata);*/
         win->image->changed = 0;
         pthread_mutex_unlock(&win->mutex);
     }
+    // part of image covered by texture (in relative coordinates)
+    float u0 = win->image->x0 / w, u1 = (win->image->x0 + win->image->tw * win->image->dec) / w;
+    float v0 = win->image->y0 / h, v1 = (win->image->y0 + win->image->th * win->image->dec) / h;
     w /= 2.f; h /= 2.f;
     float lr = 1., ud = -1.; // flipping coefficients (mirror image around Y by default)
     if(win->flip & WIN_FLIP_LR) lr = -1.;
     if(win->flip & WIN_FLIP_UD) ud = 1.;
+    // relative coordinates (u, v) of image are at (lr*w*(1-2u), -ud*h*(1-2v))
+    float xl = lr*w*(1.f-2.f*u0), xr = lr*w*(1.f-2.f*u1), yb = -ud*h*(1.f-2.f*v0), yt = -ud*h*(1.f-2.f*v1);
     glBegin(GL_QUADS);
-        glTexCoord2f(1.0f, 1.0f); glVertex2f( -1.f*lr*w, ud*h ); // top right
-        glTexCoord2f(1.0f, 0.0f); glVertex2f( -1.f*lr*w, -1.f*ud*h ); // bottom right
-        glTexCoord2f(0.0f, 0.0f); glVertex2f(lr*w, -1.f*ud*h ); // bottom left
-        glTexCoord2f(0.0f, 1.0f); glVertex2f(lr*w,  ud*h ); // top left
+        glTexCoord2f(1.0f, 1.0f); glVertex2f(xr, yt); // top right
+        glTexCoord2f(1.0f, 0.0f); glVertex2f(xr, yb); // bottom right
+        glTexCoord2f(0.0f, 0.0f); glVertex2f(xl, yb); // bottom left
+        glTexCoord2f(0.0f, 1.0f); glVertex2f(xl, yt); // top left
     glEnd();
     glDisable(GL_TEXTURE_2D);
     glFinish();
@@ -289,16 +295,17 @@ static void createGLwin(char *title, int w, int h, rawimage *rawdata){
     if(win) killwindow();
     win = MALLOC(windowData, 1);
     int wh = w * h;
-    win->rawdata = MALLOC(uint8_t, wh);
     rawimage *raw;
     if(rawdata){
         raw = rawdata;
     }else{
         raw = MALLOC(rawimage, 1);
         if(raw){
-            raw->rawdata = MALLOC(GLubyte, wh*3);
-            raw->w = w;
-            raw->h = h;
+            raw->datasize = wh*3;
+            raw->rawdata = MALLOC(GLubyte, raw->datasize);
+            raw->w = raw->tw = w;
+            raw->h = raw->th = h;
+            raw->dec = 1;
             raw->changed = 1;
             // raw->protected is zero automatically
         }
@@ -341,90 +348,13 @@ void conv_image_to_mouse_coords(float X, float Y,
     *y = (int)roundf((window->y0 - Y) * a);
 }
 
-/**
- * Convert gray (unsigned short) into RGB components (GLubyte)
- * @argument L   - gray level (0..1)
- * @argument rgb - rgb array (GLubyte [3])
- */
-static void gray2rgb(double gray, GLubyte *rgb){
-    int i = gray * 4.;
-    double x = (gray - (double)i * .25) * 4.;
-    GLubyte r = 0, g = 0, b = 0;
-    //r = g = b = (gray < 1) ? gray * 256 : 255;
-    switch(i){
-        case 0:
-            g = (GLubyte)(255. * x);
-            b = 255;
-        break;
-        case 1:
-            g = 255;
-            b = (GLubyte)(255. * (1. - x));
-        break;
-        case 2:
-            r = (GLubyte)(255. * x);
-            g = 255;
-        break;
-        case 3:
-            r = 255;
-            g = (GLubyte)(255. * (1. - x));
-        break;
-        default:
-            r = 255;
-    }
-    *rgb++ = r;
-    *rgb++ = g;
-    *rgb   = b;
-}
-
-typedef enum{
-    COLORFN_BWLINEAR,   // gray levels, linear
-    COLORFN_BWLOG,      // gray ln
-    COLORFN_LINEAR,     // linear
-    COLORFN_LOG,        // ln
-    COLORFN_SQRT,       // sqrt
-    COLORFN_POW,        // power
-    COLORFN_MAX         // end of list
-} colorfn_type;
-
 static colorfn_type ft = COLORFN_BWLINEAR;
-
-// all colorfun's should get argument in [0, 1] and return in [0, 1]
-static double linfun(double arg){ return arg; } // bung for PREVIEW_LINEAR
-static double glogfun(double arg){ return 45.98590 * log(1.+arg); } // gray for log (arg in [0, 255])
-static double logfun(double arg){ return log(1.+arg) / 0.6931472; } // for PREVIEW_LOG [log_2(x+1)]
-static double powfun(double arg){ return arg * arg;}
-static double (*colorfun)(double) = linfun; // default function to convert color
+static displaylut *lut = NULL; // raw pixels -> RGB conversion table
 
 static void change_colorfun(colorfn_type f){
     DBG("New colorfn: %d", f);
-    const char *cfn = NULL;
     ft = f;
-    switch (f){
-        case COLORFN_BWLINEAR:
-            colorfun = linfun;
-            cfn = "bw linear";
-        break;
-        case COLORFN_BWLOG:
-            colorfun = glogfun;
-            cfn = "bw log";
-        break;
-        case COLORFN_LOG:
-            colorfun = logfun;
-            cfn = "log";
-        break;
-        case COLORFN_SQRT:
-            colorfun = sqrt;
-            cfn = "sqrt";
-        break;
-        case COLORFN_POW:
-            colorfun = powfun;
-            cfn = "square";
-        break;
-        default: // linear
-            colorfun = linfun;
-            cfn = "linear";
-    }
-    verbose(VERBOSE_PRIMARY, _("Histogram conversion: %s"), cfn);
+    verbose(VERBOSE_PRIMARY, _("Histogram conversion: %s"), colorfun_name(f));
 }
 
 // cycle switch between palettes
@@ -434,245 +364,125 @@ static void roll_colorfun(){
     change_colorfun(t);
 }
 
-/*
-no omp
-histo: 0.000675201s
-equal: 0.000781059s
-result: 0.00135899s
-omp:
-histo: 0.000928879s
-equal: 0.0010879s
-result: 0.0014689s
-*/
-
 /**
- * @brief equalize - hystogram equalization
- * @param img (i)  - input image
+ * @brief preview_geometry - calculate visible part of image and its decimation
+ * @param W, H   - image size
+ * @param x0, y0 (o) - upper left corner of visible part
+ * @param tw, th (o) - size of decimated visible part
+ * @return decimation step (1 - full resolution)
  */
-static void equalize(cc_IMG *img){
-    double orig_hysto[0x10000] = {0.}; // original hystogram
-    uint8_t eq_levls[0x10000] = {0};   // levels to convert: newpix = eq_levls[oldpix]
-    int s = img->h * img->w;
-//double t0 = dtime();
-    /* -- takes too long because of sync
-#pragma omp parallel
-{
-    //printf("%d\n", omp_get_thread_num());
-    size_t histogram_private[0x10000] = {0};
-    #pragma omp for nowait
-    for(int i = 0; i < s; ++i){
-        ++histogram_private[ori[i]];
-    }
-    #pragma omp critical
-    {
-        for(int i = 0; i < 0x10000; ++i) orig_hysto[i] += histogram_private[i];
-    }
-}*/
-    int bytes = cc_getNbytes(img);
-
-    if(bytes == 1){
-        uint8_t *data = (uint8_t*) img->data;
-        for(int i = 0; i < s; ++i){
-            ++orig_hysto[data[i]];
-        }
-    }else{
-        uint16_t *data = (uint16_t*) img->data;
-        for(int i = 0; i < s; ++i){
-            ++orig_hysto[data[i]];
-        }
-    }
-
-//WARNX("histo: %gs", dtime()-t0);
-    int max = (bytes == 1) ? 0xff : 0xffff;
-    double part = (double)(s + 1) / 0x100, N = 0.;
-    for(int i = 0; i <= max; ++i){
-        N += orig_hysto[i];
-        eq_levls[i] = (uint8_t)(N/part);
-    }
-//WARNX("equal: %gs", dtime()-t0);
-    //OMP_FOR() -- takes the same time!
-    uint8_t *retn = win->rawdata;
-    if(bytes == 1){
-        uint8_t *data = (uint8_t*) img->data;
-        for(int i = 0; i < s; ++i){
-            retn[i] = eq_levls[data[i]];
-        }
-    }else{
-        uint16_t *data = (uint16_t*) img->data;
-        for(int i = 0; i < s; ++i){
-            retn[i] = eq_levls[data[i]];
-        }
+static int preview_geometry(int W, int H, int *x0, int *y0, int *tw, int *th){
+    GLfloat Wo, Ho;
+    float zoom = win->zoom;
+    if(zoom <= 0.f || win->w < 1 || win->h < 1){ // can't calculate: full image
+        *x0 = *y0 = 0; *tw = W; *th = H;
+        return 1;
     }
-//WARNX("result: %gs", dtime()-t0);
+    calc_win_props(&Wo, &Ho);
+    // window of 2*Wo ortho units have win->w pixels; image pixel is `zoom` units
+    int dec = (int)(2.f * Wo / (zoom * win->w));
+    if(dec > W / 2) dec = W / 2;
+    if(dec > H / 2) dec = H / 2;
+    if(dec < 1) dec = 1;
+    // window coordinates P = (win->x, win->y) - zoom*V, P in [-Wo, Wo]x[-Ho, Ho]
+    float lr = (win->flip & WIN_FLIP_LR) ? -1.f : 1.f, ud = (win->flip & WIN_FLIP_UD) ? 1.f : -1.f;
+    float hw = W / 2.f, hh = H / 2.f;
+    // relative image coordinates of vertex V: u = (1 - Vx/(lr*hw))/2, v = (1 + Vy/(ud*hh))/2
+    float u0 = (1.f - (win->x - Wo) / zoom / (lr*hw)) / 2.f, u1 = (1.f - (win->x + Wo) / zoom / (lr*hw)) / 2.f;
+    float v0 = (1.f + (win->y - Ho) / zoom / (ud*hh)) / 2.f, v1 = (1.f + (win->y + Ho) / zoom / (ud*hh)) / 2.f;
+    if(u0 > u1){ float t = u0; u0 = u1; u1 = t; }
+    if(v0 > v1){ float t = v0; v0 = v1; v1 = t; }
+    int X0 = (int)floorf(u0 * W) - 1, X1 = (int)ceilf(u1 * W) + 1;
+    int Y0 = (int)floorf(v0 * H) - 1, Y1 = (int)ceilf(v1 * H) + 1;
+    if(X0 < 0) X0 = 0;
+    if(Y0 < 0) Y0 = 0;
+    if(X1 > W) X1 = W;
+    if(Y1 > H) Y1 = H;
+    if(X1 <= X0 || Y1 <= Y0){ // image is out of window: show it all
+        X0 = Y0 = 0; X1 = W; Y1 = H;
+    }
+    // align to decimation grid to prevent flickering when moving
+    X0 -= X0 % dec; Y0 -= Y0 % dec;
+    *x0 = X0; *y0 = Y0;
+    *tw = (X1 - X0 + dec - 1) / dec;
+    *th = (Y1 - Y0 + dec - 1) / dec;
+    return dec;
 }
-/*
- no omp @ histo:
-histo: 0.00269914s
-stat: 0.00272393s
-cuts: 0.00357103s
- omp @ histo:
-histo: 0.00120497s
-stat: 0.00127792s
-cuts: 0.00188208s
-*/
 
-// count image cuts as [median-sigma median+5sigma]
-static void mkcuts(cc_IMG *img){
-    int orig_hysto[0x10000] = {0.}; // original hystogram
-    int s = img->h * img->w;
-    double sum = 0., sum2 = 0.;
-    int bytes = cc_getNbytes(img);
-    TIMESTAMP("Make histogram");
-    if(bytes == 1){
-        uint8_t *data = (uint8_t*) img->data;
-#pragma omp parallel
-{
-    size_t histogram_private[0x100] = {0};
-    double sm = 0., sm2 = 0.;
-    #pragma omp for nowait
-    for(int i = 0; i < s; ++i){
-        ++histogram_private[data[i]];
-        double b = data[i];
-        sm += b;
-        sm2 += b*b;
-    }
-    #pragma omp critical
-    {
-        for(int i = 0; i < 0x100; ++i) orig_hysto[i] += histogram_private[i];
-        sum += sm;
-        sum2 += sm2;
-    }
-}
-    }else{
-        uint16_t *data = (uint16_t*) img->data;
-#pragma omp parallel
-{
-    size_t histogram_private[0x10000] = {0};
-    double sm = 0., sm2 = 0.;
-    #pragma omp for nowait
-    for(int i = 0; i < s; ++i){
-        ++histogram_private[data[i]];
-        double b = data[i];
-        sm += b;
-        sm2 += b*b;
-    }
-    #pragma omp critical
-    {
-        for(int i = 0; i < 0x10000; ++i) orig_hysto[i] += histogram_private[i];
-        sum += sm;
-        sum2 += sm2;
-    }
-}
-    }
-    TIMESTAMP("Calculate stat");
-//WARNX("histo: %gs", dtime()-t0);
-    // get median level
-    int counts = s/2, median = 0, max = (bytes == 1) ? 0xff : 0xffff;
-    for(; median < max; ++median){
-        if((counts -= orig_hysto[median]) < 0) break;
-    }
-    sum /= s;
-    double sigma = sqrt(sum2/s - sum*sum);
-    int low = median - sigma, high = median + 5.*sigma;
-    if(low < 0) low = 0;
-    if(high > max) high = max;
-    double A = 255./(high - low);
-    DBG("Got: sigma=%.1f, low=%d, high=%d, A=%g", sigma, low, high, A);
-    // now we can recalculate values: new = (old - low)*A
-//WARNX("stat: %gs", dtime()-t0);
-// DEBUG: 2ms without OMP; 0.7ms with
-    TIMESTAMP("apply cuts");
-    uint8_t *retn = win->rawdata;
-    if(bytes == 1){
-        DBG("8 bit data");
-        uint8_t *data = (uint8_t*) img->data;
-        //OMP_FOR()
-        for(int i = 0; i < s; ++i){
-            uint16_t old = data[i];
-            if(old > high){ retn[i] = 255; continue; }
-            else if(old < low){ retn[i] = 0; continue; }
-            retn[i] = (uint8_t)(A*(old - low));
-        }
-    }else{
-        DBG("16 bit data");
-        uint16_t *data = (uint16_t*) img->data;
-        //OMP_FOR()
-        for(int i = 0; i < s; ++i){
-            uint16_t old = data[i];
-            if(old > high){ retn[i] = 255; continue; }
-            else if(old < low){ retn[i] = 0; continue; }
-            retn[i] = (uint8_t)(A*(old - low));
-        }
-    }
-    DBG("Done");
-//WARNX("cuts: %gs", dtime()-t0);
+// check if visible part of image changed and image should be recalculated
+static int view_changed(cc_IMG *img){
+    if(!win || !img || !win->image) return FALSE;
+    rawimage *im = win->image;
+    if(img->imnumber == 0 || im->w != img->w || im->h != img->h) return FALSE; // no image yet
+    int x0, y0, tw, th, dec = preview_geometry(img->w, img->h, &x0, &y0, &tw, &th);
+    return (dec != im->dec || x0 != im->x0 || y0 != im->y0 || tw != im->tw || th != im->th);
 }
 
 static void change_displayed_image(cc_IMG *img){
     if(!win || !img) return;
     static size_t lastN = 0;
+    static cc_IMG preview = {0}; // decimated visible part of image
+    static size_t previewsz = 0;
     pthread_mutex_lock(&img->mutex);
     ssize_t delta = img->imnumber - lastN;
     TIMESTAMP("Got image #%zd", img->imnumber);
     if(delta > 0 && delta != 1) WARNX(_("Missed %zd images"), delta-1);
     lastN = img->imnumber;
     pthread_mutex_lock(&win->mutex);
-    int w = img->w, h = img->h, s = w*h;
-    if(!win->image || ! win->rawdata || (win->image->h != h) || (win->image->w != w)){ // realloc image & raw image to new size
-        //pthread_mutex_lock(&win->mutex);
+    rawimage *im = win->image;
+    int x0, y0, tw, th;
+    im->w = img->w; im->h = img->h;
+    int dec = preview_geometry(img->w, img->h, &x0, &y0, &tw, &th);
+    size_t s = (size_t)tw * th;
+    if(im->datasize < s*3){ // realloc image to new size
         DBG("\n\nRealloc rawdata");
-        uint8_t *raw = win->image->rawdata;
-        win->image->rawdata = realloc(win->image->rawdata, s*3);
-        if(!win->image->rawdata){
+        uint8_t *raw = realloc(im->rawdata, s*3);
+        if(!raw){
             WARN("realloc()");
             LOGERR("Realloc() error");
-            win->image->rawdata = raw;
+            pthread_mutex_unlock(&win->mutex);
             pthread_mutex_unlock(&img->mutex);
             return;
         }
-        win->image->h = h; win->image->w = w;
-        raw = win->rawdata;
-        win->rawdata = realloc(win->rawdata, s);
-        if(!win->rawdata){
+        im->rawdata = raw;
+        im->datasize = s*3;
+        DBG("win->image changed");
+    }
+    if(previewsz < s * sizeof(uint16_t)){
+        void *d = realloc(preview.data, s * sizeof(uint16_t));
+        if(!d){
             WARN("realloc()");
             LOGERR("Realloc() error");
-            win->rawdata = raw;
+            pthread_mutex_unlock(&win->mutex);
             pthread_mutex_unlock(&img->mutex);
             return;
         }
-        DBG("win->image changed");
-        //pthread_mutex_unlock(&win->mutex);
+        preview.data = d;
+        previewsz = s * sizeof(uint16_t);
     }
-    rawimage *im = win->image;
-    uint8_t *raw = win->rawdata;
-    DBG("imh=%d, imw=%d, ch=%u, cw=%u", im->h, im->w, img->h, img->w);
+    TIMESTAMP("decimate");
+    if(!decimate(img, &preview, x0, y0, tw, th, dec)){
+        WARNX("Can't decimate image");
+        pthread_mutex_unlock(&win->mutex);
+        pthread_mutex_unlock(&img->mutex);
+        return;
+    }
+    if(!lut) lut = new_displaylut();
+    DBG("imh=%d, imw=%d, ch=%u, cw=%u, texture %dx%d @(%d, %d), dec=%d", im->h, im->w, img->h, img->w, tw, th, x0, y0, dec);
     TIMESTAMP("level correction");
     if(imequalize){
         DBG("equalize");
-        equalize(img);
+        equalize(&preview, lut);
     }else{
         DBG("cuts");
-        mkcuts(img);
+        mkcuts(&preview, lut);
     }
-    //pthread_mutex_lock(&win->mutex);
-    GLubyte *dst = im->rawdata;
     TIMESTAMP("colorfun");
-//double t0 = dtime();
-    if(ft < COLORFN_LINEAR){ // gray
-        // without OMP: 1.8ms; with OMP: 0.8ms
-        OMP_FOR()
-        for(int i = 0; i < s; ++i){
-            GLubyte *t = &dst[i*3];
-            t[0] = t[1] = t[2] = colorfun(raw[i]);
-        }
-    }else{
-        // without OMP: 3.6ms; with OMP: 1.7ms
-        OMP_FOR()
-        for(int i = 0; i < s; ++i){
-            gray2rgb(colorfun(raw[i] / 256.), &dst[i*3]);
-        }
-    }
-//WARNX("Conversion time: %g", dtime()-t0);
+    set_palette(lut, ft);
+    colorize(&preview, lut, im->rawdata);
+    im->x0 = x0; im->y0 = y0;
+    im->tw = tw; im->th = th;
+    im->dec = dec;
     /*
     // mirror image around Y
     int w3 = w*3, h1 = h-1, wsz = w3*sizeof(GLubyte);
@@ -747,6 +557,7 @@ int viewer(imagefunc newimage){
             }
             //DBG("Next cycle, t=%g", dtime()-t0);
         }
+        if(view_changed(locimage)) change_displayed_image(locimage); // zoom or move: recalculate visible part
         if(!win->winevt){
             //DBG("No events");
             //usleep(1000);
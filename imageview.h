@@ -44,9 +44,13 @@
 
 // common structs with events.c
 typedef struct{
-    GLubyte *rawdata;  // raw image data
+    GLubyte *rawdata;  // raw image data (visible part of image, decimated)
+    size_t datasize;   // size of `rawdata` buffer
     int w;             // size of image
     int h;
+    int tw, th;        // size of texture in `rawdata`
+    int x0, y0;        // upper left corner of texture on image
+    int dec;           // decimation: texture pixel is `dec`x`dec` pixels of image
     int changed;       // == 1 if data was changed outside (to redraw)
 } rawimage;
 
@@ -55,7 +59,6 @@ typedef struct{
     char *title;        // title of window
     GLuint Tex;         // texture for image inside window
     rawimage *image;    // colour image data
-    uint8_t *rawdata;   // raw data after processing
     int w; int h;       // window size
     float x; float y;   // image offset coordinates
     float x0; float y0; // center of window for coords conversion
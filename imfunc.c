@@ -0,0 +1,555 @@
+/*
+ * This file is part of the CCD_Capture project.
+ * Copyright 2026 Edward V. Emelianov <edward.emelianoff@gmail.com>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <math.h>
+#include <string.h>
+#if defined(__AVX2__) || defined(__SSSE3__)
+#include <immintrin.h>
+#endif
+#include <usefull_macros.h>
+
+#include "imfunc.h"
+#include "omp.h"
+
+#ifdef OMP_FOUND
+// local omp.h hides system one
+int omp_get_thread_num(void);
+int omp_get_num_threads(void);
+#endif
+
+/**
+ * Convert gray (unsigned short) into RGB components
+ * @argument L   - gray level (0..1)
+ * @argument rgb - rgb array (uint8_t [3])
+ */
+void gray2rgb(double gray, uint8_t *rgb){
+    int i = gray * 4.;
+    double x = (gray - (double)i * .25) * 4.;
+    uint8_t r = 0, g = 0, b = 0;
+    //r = g = b = (gray < 1) ? gray * 256 : 255;
+    switch(i){
+        case 0:
+            g = (uint8_t)(255. * x);
+            b = 255;
+        break;
+        case 1:
+            g = 255;
+            b = (uint8_t)(255. * (1. - x));
+        break;
+        case 2:
+            r = (uint8_t)(255. * x);
+            g = 255;
+        break;
+        case 3:
+            r = 255;
+            g = (uint8_t)(255. * (1. - x));
+        break;
+        default:
+            r = 255;
+    }
+    *rgb++ = r;
+    *rgb++ = g;
+    *rgb   = b;
+}
+
+// all colorfun's should get argument in [0, 1] and return in [0, 1]
+static double linfun(double arg){ return arg; } // bung for PREVIEW_LINEAR
+static double glogfun(double arg){ return 45.98590 * log(1.+arg); } // gray for log (arg in [0, 255])
+static double logfun(double arg){ return log(1.+arg) / 0.6931472; } // for PREVIEW_LOG [log_2(x+1)]
+static double powfun(double arg){ return arg * arg;}
+
+static const struct{
+    double (*fn)(double);
+    const char *name;
+} colorfuns[COLORFN_MAX] = {
+    [COLORFN_BWLINEAR] = {linfun, "bw linear"},
+    [COLORFN_BWLOG] = {glogfun, "bw log"},
+    [COLORFN_LINEAR] = {linfun, "linear"},
+    [COLORFN_LOG] = {logfun, "log"},
+    [COLORFN_SQRT] = {sqrt, "sqrt"},
+    [COLORFN_POW] = {powfun, "square"},
+};
+
+const char *colorfun_name(colorfn_type f){
+    if(f >= COLORFN_MAX) f = COLORFN_LINEAR;
+    return colorfuns[f].name;
+}
+
+/**
+ * @brief new_displaylut - allocate new conversion table
+ * @return table (should be FREE'd after using) with undefined palette and levels
+ */
+displaylut *new_displaylut(){
+    displaylut *L = MALLOC(displaylut, 1);
+    L->ft = COLORFN_MAX;
+    L->low = L->high = -1;
+    return L;
+}
+
+/**
+ * @brief set_palette - change palette of conversion table (rebuild only if changed)
+ * @param L - table
+ * @param f - palette function
+ */
+void set_palette(displaylut *L, colorfn_type f){
+    if(!L) return;
+    if(f >= COLORFN_MAX) f = COLORFN_LINEAR;
+    if(f == L->ft) return;
+    double (*colorfun)(double) = colorfuns[f].fn;
+    for(int i = 0; i < 256; ++i){
+        uint8_t *t = L->palette[i];
+        if(f < COLORFN_LINEAR) t[0] = t[1] = t[2] = colorfun(i); // gray
+        else gray2rgb(colorfun(i / 256.), t);
+    }
+    L->ft = f;
+    L->valid = FALSE;
+}
+
+/**
+ * @brief colorize - convert image into RGB by one table lookup per pixel
+ * @param img (i) - input image
+ * @param L       - conversion table (with palette and levels set)
+ * @param rgb (o) - RGB data (3*w*h bytes)
+ */
+void colorize(cc_IMG *img, displaylut *L, uint8_t *rgb){
+    if(!img || !L || L->ft == COLORFN_MAX) return;
+    if(!L->valid){ // rebuild table after changing palette or levels
+        for(int i = 0; i <= L->max; ++i){
+            const uint8_t *p = L->palette[L->levels[i]];
+            L->rgb[i][0] = p[0]; L->rgb[i][1] = p[1]; L->rgb[i][2] = p[2];
+        }
+        L->valid = TRUE;
+    }
+    int s = img->h * img->w;
+    const uint8_t (*lut)[3] = (const uint8_t (*)[3]) L->rgb;
+    if(cc_getNbytes(img) == 1){
+        const uint8_t *data = (const uint8_t*) img->data;
+        OMP_FOR()
+        for(int i = 0; i < s; ++i){
+            const uint8_t *c = lut[data[i]];
+            uint8_t *t = &rgb[i*3];
+            t[0] = c[0]; t[1] = c[1]; t[2] = c[2];
+        }
+    }else{
+        const uint16_t *data = (const uint16_t*) img->data;
+        OMP_FOR()
+        for(int i = 0; i < s; ++i){
+            const uint8_t *c = lut[data[i]];
+            uint8_t *t = &rgb[i*3];
+            t[0] = c[0]; t[1] = c[1]; t[2] = c[2];
+        }
+    }
+}
+
+/**
+ * @brief decimate - get part of image taking each `dec`'th pixel by X and Y
+ * @param in  (i) - input image
+ * @param out (o) - output image (its `data` should have at least w*h pixels); w, h and bitpix are changed here
+ * @param x0, y0  - upper left corner of part
+ * @param w, h    - size of output image
+ * @param dec     - decimation step (1 - just crop)
+ * @return FALSE if part is out of image
+ */
+int decimate(cc_IMG *in, cc_IMG *out, int x0, int y0, int w, int h, int dec){
+    if(!in || !out || dec < 1 || w < 1 || h < 1 || x0 < 0 || y0 < 0) return FALSE;
+    if(x0 + (w-1)*dec >= in->w || y0 + (h-1)*dec >= in->h) return FALSE;
+    int bytes = cc_getNbytes(in);
+    out->w = w; out->h = h; out->bitpix = in->bitpix;
+    out->bytelen = (size_t)w * h * bytes;
+    if(bytes == 1){
+        OMP_FOR()
+        for(int y = 0; y < h; ++y){
+            const uint8_t *i = (const uint8_t*)in->data + (size_t)(y0 + y*dec) * in->w + x0;
+            uint8_t *o = (uint8_t*)out->data + (size_t)y * w;
+            if(dec == 1) memcpy(o, i, w);
+            else for(int x = 0; x < w; ++x, i += dec) o[x] = *i;
+        }
+    }else{
+        OMP_FOR()
+        for(int y = 0; y < h; ++y){
+            const uint16_t *i = (const uint16_t*)in->data + (size_t)(y0 + y*dec) * in->w + x0;
+            uint16_t *o = (uint16_t*)out->data + (size_t)y * w;
+            if(dec == 1) memcpy(o, i, w * sizeof(uint16_t));
+            else for(int x = 0; x < w; ++x, i += dec) o[x] = *i;
+        }
+    }
+    return TRUE;
+}
+
+/**
+ * @brief histogram - count histogram of image in parallel
+ * Each thread fills its own integer histogram, then all threads merge them together:
+ * each thread sums its own range of bins over all private histograms, so there's no locks.
+ * @param img  (i) - input image
+ * @param hist (o) - histogram (0x100 bins for 8-bit or 0x10000 bins for 16-bit image)
+ * @return amount of bins
+ */
+int histogram(cc_IMG *img, uint32_t *hist){
+    int s = img->h * img->w;
+    int bytes = cc_getNbytes(img);
+    int nbins = (bytes == 1) ? 0x100 : 0x10000;
+    uint32_t *priv = NULL;
+    int nthreads = 1;
+#pragma omp parallel if(s > 4*nbins)
+{
+    int id = 0;
+#ifdef OMP_FOUND
+    id = omp_get_thread_num();
+#endif
+    #pragma omp single
+    {
+#ifdef OMP_FOUND
+        nthreads = omp_get_num_threads();
+#endif
+        priv = calloc((size_t)nthreads * nbins, sizeof(uint32_t));
+    }
+    if(priv){ // all threads see the same value after `single` barrier
+        uint32_t *h = priv + (size_t)id * nbins;
+        if(bytes == 1){
+            uint8_t *data = (uint8_t*) img->data;
+            #pragma omp for
+            for(int i = 0; i < s; ++i) ++h[data[i]];
+        }else{
+            uint16_t *data = (uint16_t*) img->data;
+            #pragma omp for
+            for(int i = 0; i < s; ++i) ++h[data[i]];
+        }
+        #pragma omp for
+        for(int b = 0; b < nbins; ++b){
+            uint32_t N = 0;
+            for(int t = 0; t < nthreads; ++t) N += priv[(size_t)t * nbins + b];
+            hist[b] = N;
+        }
+    }
+}
+    if(!priv){ // no memory for private histograms: count in one thread
+        WARNX("histogram(): calloc failed");
+        memset(hist, 0, nbins * sizeof(uint32_t));
+        if(bytes == 1){
+            uint8_t *data = (uint8_t*) img->data;
+            for(int i = 0; i < s; ++i) ++hist[data[i]];
+        }else{
+            uint16_t *data = (uint16_t*) img->data;
+            for(int i = 0; i < s; ++i) ++hist[data[i]];
+        }
+    }
+    FREE(priv);
+    return nbins;
+}
+
+/**
+ * @brief equalize - hystogram equalization
+ * @param img (i)  - input image
+ * @param L   (o)  - conversion table to store levels
+ */
+void equalize(cc_IMG *img, displaylut *L){
+    uint32_t orig_hysto[0x10000]; // original hystogram
+    uint8_t eq_levls[0x10000] = {0};   // levels to convert: newpix = eq_levls[oldpix]
+    int s = img->h * img->w;
+    int max = histogram(img, orig_hysto) - 1;
+    double part = (double)(s + 1) / 0x100, N = 0.;
+    for(int i = 0; i <= max; ++i){
+        N += orig_hysto[i];
+        eq_levls[i] = (uint8_t)(N/part);
+    }
+    L->low = L->high = -1;
+    if(max == L->max && 0 == memcmp(L->levels, eq_levls, max + 1)) return;
+    memcpy(L->levels, eq_levls, max + 1);
+    L->max = max;
+    L->valid = FALSE;
+}
+
+/**
+ * @brief mkcuts - count image cuts as [median-sigma median+5sigma] and store them as levels
+ * @param img (i)  - input image
+ * @param L   (o)  - conversion table to store levels
+ */
+void mkcuts(cc_IMG *img, displaylut *L){
+    uint32_t orig_hysto[0x10000]; // original hystogram
+    int s = img->h * img->w;
+    int max = histogram(img, orig_hysto) - 1;
+    // statistics by histogram
+    double sum = 0., sum2 = 0.;
+    for(int i = 0; i <= max; ++i){
+        double n = orig_hysto[i] * (double)i;
+        sum += n;
+        sum2 += n * i;
+    }
+    // get median level
+    int counts = s/2, median = 0;
+    for(; median < max; ++median){
+        if((counts -= orig_hysto[median]) < 0) break;
+    }
+    sum /= s;
+    double sigma = sqrt(sum2/s - sum*sum);
+    int low = median - sigma, high = median + 5.*sigma;
+    if(low < 0) low = 0;
+    if(high > max) high = max;
+    double A = 255./(high - low);
+    DBG("Got: sigma=%.1f, low=%d, high=%d, A=%g", sigma, low, high, A);
+    if(low == L->low && high == L->high && max == L->max) return; // levels are the same
+    // now we can recalculate levels: new = (old - low)*A
+    for(int i = 0; i <= max; ++i){
+        if(i > high) L->levels[i] = 255;
+        else if(i < low) L->levels[i] = 0;
+        else L->levels[i] = (uint8_t)(A*(i - low));
+    }
+    L->low = low; L->high = high; L->max = max;
+    L->valid = FALSE;
+}
+
+/**
+ * @brief swap16_bzero - convert unsigned 16-bit data into big-endian signed with BZERO=32768 (FITS)
+ * Data is processed by blocks of 32 pixels with AVX2 or SSSE3 (when compiled with -march supporting them)
+ * @param in  (i) - input data
+ * @param out (o) - output data (could be the same as `in`)
+ * @param n       - amount of pixels
+ */
+void swap16_bzero(const uint16_t *in, uint16_t *out, size_t n){
+    size_t nblk = n / 32;
+#pragma omp parallel for if(n > 0x40000)
+    for(size_t b = 0; b < nblk; ++b){
+        const uint16_t *i = in + b*32;
+        uint16_t *o = out + b*32;
+#if defined(__AVX2__)
+        const __m256i shuf = _mm256_setr_epi8(1,0,3,2,5,4,7,6,9,8,11,10,13,12,15,14,
+                                              1,0,3,2,5,4,7,6,9,8,11,10,13,12,15,14);
+        const __m256i bzero = _mm256_set1_epi16((short)0x8000);
+        for(int k = 0; k < 32; k += 16){
+            __m256i v = _mm256_loadu_si256((const __m256i*)(i + k));
+            v = _mm256_shuffle_epi8(_mm256_xor_si256(v, bzero), shuf);
+            _mm256_storeu_si256((__m256i*)(o + k), v);
+        }
+#elif defined(__SSSE3__)
+        const __m128i shuf = _mm_setr_epi8(1,0,3,2,5,4,7,6,9,8,11,10,13,12,15,14);
+        const __m128i bzero = _mm_set1_epi16((short)0x8000);
+        for(int k = 0; k < 32; k += 8){
+            __m128i v = _mm_loadu_si128((const __m128i*)(i + k));
+            v = _mm_shuffle_epi8(_mm_xor_si128(v, bzero), shuf);
+            _mm_storeu_si128((__m128i*)(o + k), v);
+        }
+#else
+        for(int k = 0; k < 32; ++k) o[k] = __builtin_bswap16(i[k] ^ 0x8000);
+#endif
+    }
+    for(size_t k = nblk * 32; k < n; ++k) out[k] = __builtin_bswap16(in[k] ^ 0x8000);
+}
+
+/**
+ * @brief swap16_bzero_impl - name of swap16_bzero() implementation
+ */
+const char *swap16_bzero_impl(){
+#if defined(__AVX2__)
+    return "avx2";
+#elif defined(__SSSE3__)
+    return "ssse3";
+#else
+    return "scalar";
+#endif
+}
+
+/**
+ * @brief calibrate - subtract bias and dark and divide by flat: out = (in - bias - k*dark) * gain
+ * Result is rounded and clamped to [0, max]; pixels saturated in `in` (>= max) stay saturated.
+ * Pixels are processed by blocks of 8 with AVX2 (when compiled with -march supporting it)
+ * @param in   (i) - raw image
+ * @param out  (o) - calibrated image of the same size and bitpix (data could be the same as `in`)
+ * @param bias (i) - master bias
+ * @param dark (i) - master dark current (bias subtracted) for exposure of 1 unit
+ * @param k        - dark scale (exposure time)
+ * @param gain (i) - inverted normalized flat
+ * @return FALSE if images have different sizes
+ */
+int calibrate(cc_IMG *in, cc_IMG *out, const float *bias, const float *dark, float k, const float *gain){
+    if(!in || !out || !bias || !dark || !gain) return FALSE;
+    if(in->w != out->w || in->h != out->h || in->bitpix != out->bitpix) return FALSE;
+    size_t n = in->w * in->h;
+    size_t nblk = n / 8;
+    int nbytes = cc_getNbytes(in);
+    float max = (float)((1 << in->bitpix) - 1);
+#define CALPIX(i, o)  do{ float v = (float)(i);                           \
+    if(v < max){ v = (v - bias[p] - k*dark[p]) * gain[p];                 \
+        v = (v < 0.f) ? 0.f : (v > max) ? max : v; (o) = (v + 0.5f); }    \
+    else (o) = max; }while(0)
+    if(nbytes == 1){
+        const uint8_t *i = (const uint8_t*)in->data;
+        uint8_t *o = (uint8_t*)out->data;
+#pragma omp parallel for if(n > 0x40000)
+        for(size_t b = 0; b < nblk; ++b){
+            size_t p = b * 8;
+#if defined(__AVX2__)
+            __m256 v = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(i + p))));
+            __m256 sat = _mm256_cmp_ps(v, _mm256_set1_ps(max), _CMP_GE_OQ);
+            __m256 c = _mm256_sub_ps(_mm256_sub_ps(v, _mm256_loadu_ps(bias + p)),
+                                     _mm256_mul_ps(_mm256_set1_ps(k), _mm256_loadu_ps(dark + p)));
+            c = _mm256_mul_ps(c, _mm256_loadu_ps(gain + p));
+            c = _mm256_min_ps(_mm256_max_ps(c, _mm256_setzero_ps()), _mm256_set1_ps(max));
+            c = _mm256_blendv_ps(c, _mm256_set1_ps(max), sat);
+            __m256i r = _mm256_cvtps_epi32(c);
+            __m128i w = _mm_packus_epi32(_mm256_castsi256_si128(r), _mm256_extracti128_si256(r, 1));
+            _mm_storel_epi64((__m128i*)(o + p), _mm_packus_epi16(w, w));
+#else
+            for(int j = 0; j < 8; ++j, ++p) CALPIX(i[p], o[p]);
+#endif
+        }
+        for(size_t p = nblk * 8; p < n; ++p) CALPIX(i[p], o[p]);
+    }else{
+        const uint16_t *i = (const uint16_t*)in->data;
+        uint16_t *o = (uint16_t*)out->data;
+#pragma omp parallel for if(n > 0x40000)
+        for(size_t b = 0; b < nblk; ++b){
+            size_t p = b * 8;
+#if defined(__AVX2__)
+            __m256 v = _mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)(i + p))));
+            __m256 sat = _mm256_cmp_ps(v, _mm256_set1_ps(max), _CMP_GE_OQ);
+            __m256 c = _mm256_sub_ps(_mm256_sub_ps(v, _mm256_loadu_ps(bias + p)),
+                                     _mm256_mul_ps(_mm256_set1_ps(k), _mm256_loadu_ps(dark + p)));
+            c = _mm256_mul_ps(c, _mm256_loadu_ps(gain + p));
+            c = _mm256_min_ps(_mm256_max_ps(c, _mm256_setzero_ps()), _mm256_set1_ps(max));
+            c = _mm256_blendv_ps(c, _mm256_set1_ps(max), sat);
+            __m256i r = _mm256_cvtps_epi32(c);
+            _mm_storeu_si128((__m128i*)(o + p), _mm_packus_epi32(_mm256_castsi256_si128(r), _mm256_extracti128_si256(r, 1)));
+#else
+            for(int j = 0; j < 8; ++j, ++p) CALPIX(i[p], o[p]);
+#endif
+        }
+        for(size_t p = nblk * 8; p < n; ++p) CALPIX(i[p], o[p]);
+    }
+#undef CALPIX
+    out->gotstat = 0;
+    return TRUE;
+}
+
+// add sums of `hb` neighbouring pixels of input row to `acc` (output pixels from x0 to ow-1)
+#define BINROW(T)  do{ const T *r = (const T*)row;     \
+    for(int x = x0; x < ow; ++x){                       \
+        const T *p = r + x*hb; uint32_t s = 0;          \
+        for(int k = 0; k < hb; ++k){ s += p[k]; }       \
+        acc[x] += s;                                    \
+    }}while(0)
+
+/**
+ * @brief binimage - software binning: sum (saturated to 16 bit) or mean of `hb`x`vb` pixels
+ * Rows are processed in parallel; for horizontal binning by 2 pairs of pixels are added by AVX2.
+ * Incomplete bins at right and bottom edges are dropped.
+ * @param in  (i) - full-resolution image
+ * @param out (o) - binned image (w, h, bitpix and bytelen are set here): 16-bit for sum, same bitpix as `in` for mean
+ * @param hb, vb  - binning factors
+ * @param avg     - !=0 to calculate mean instead of sum
+ * @return FALSE if bad parameters or `out` data buffer is too small
+ */
+int binimage(cc_IMG *in, cc_IMG *out, int hb, int vb, int avg){
+    if(!in || !out || !in->data || !out->data || hb < 1 || vb < 1) return FALSE;
+    int ow = in->w / hb, oh = in->h / vb, w = in->w;
+    if(ow < 1 || oh < 1) return FALSE;
+    int nbytes = cc_getNbytes(in);
+    int outbitpix = avg ? in->bitpix : 16;
+    int outbytes = (outbitpix > 8) ? 2 : 1;
+    size_t bytelen = (size_t)ow * oh * outbytes;
+    if(out->datasize && out->datasize < bytelen) return FALSE;
+    uint32_t n = hb * vb, half = n / 2;
+    #pragma omp parallel if((size_t)in->w * in->h > 0x40000)
+    {
+        uint32_t *acc = MALLOC(uint32_t, ow);
+        #pragma omp for
+        for(int y = 0; y < oh; ++y){
+            bzero(acc, ow * sizeof(uint32_t));
+            for(int r = 0; r < vb; ++r){
+                const uint8_t *row = (const uint8_t*)in->data + ((size_t)y * vb + r) * w * nbytes;
+                int x0 = 0;
+#if defined(__AVX2__)
+                if(hb == 2){ // even and odd pixels are added in parallel
+                    if(nbytes == 2){
+                        const __m256i mask = _mm256_set1_epi32(0xffff);
+                        for(; x0 + 8 <= ow; x0 += 8){
+                            __m256i v = _mm256_loadu_si256((const __m256i*)(row + x0 * 4));
+                            __m256i s = _mm256_add_epi32(_mm256_and_si256(v, mask), _mm256_srli_epi32(v, 16));
+                            __m256i a = _mm256_loadu_si256((const __m256i*)(acc + x0));
+                            _mm256_storeu_si256((__m256i*)(acc + x0), _mm256_add_epi32(a, s));
+                        }
+                    }else{
+                        const __m256i mask = _mm256_set1_epi16(0xff);
+                        for(; x0 + 16 <= ow; x0 += 16){
+                            __m256i v = _mm256_loadu_si256((const __m256i*)(row + x0 * 2));
+                            __m256i s = _mm256_add_epi16(_mm256_and_si256(v, mask), _mm256_srli_epi16(v, 8));
+                            __m256i lo = _mm256_cvtepu16_epi32(_mm256_castsi256_si128(s));
+                            __m256i hi = _mm256_cvtepu16_epi32(_mm256_extracti128_si256(s, 1));
+                            uint32_t *a = acc + x0;
+                            _mm256_storeu_si256((__m256i*)a, _mm256_add_epi32(_mm256_loadu_si256((const __m256i*)a), lo));
+                            _mm256_storeu_si256((__m256i*)(a + 8), _mm256_add_epi32(_mm256_loadu_si256((const __m256i*)(a + 8)), hi));
+                        }
+                    }
+                }
+#endif
+                // the rest of row
+                if(nbytes == 2) BINROW(uint16_t);
+                else BINROW(uint8_t);
+            }
+            if(outbytes == 2){
+                uint16_t *o = (uint16_t*)out->data + (size_t)y * ow;
+                if(avg) for(int x = 0; x < ow; ++x) o[x] = (acc[x] + half) / n;
+                else for(int x = 0; x < ow; ++x) o[x] = (acc[x] > 0xffff) ? 0xffff : acc[x];
+            }else{
+                uint8_t *o = (uint8_t*)out->data + (size_t)y * ow;
+                for(int x = 0; x < ow; ++x) o[x] = (acc[x] + half) / n;
+            }
+        }
+        FREE(acc);
+    }
+    out->w = ow; out->h = oh;
+    out->bitpix = outbitpix;
+    out->bytelen = bytelen;
+    return TRUE;
+}
+#undef BINROW
+
+/**
+ * @brief copyfields - copy all header fields of `src` into `dst` (`dst` keeps its data buffer size)
+ */
+void copyfields(cc_IMG *dst, const cc_IMG *src){
+    if(!dst || !src || dst == src) return;
+    size_t datasize = dst->datasize;
+    memcpy(&dst->start_of_copyable_data, &src->start_of_copyable_data,
+           offsetof(cc_IMG, end_of_copyable_data) - offsetof(cc_IMG, start_of_copyable_data));
+    dst->datasize = datasize;
+}
+
+/**
+ * @brief cropimage - copy subimage (x0, y0)-(x0+w-1, y0+h-1) of `in` into `out` (part outside `in` is cut off)
+ * @param in   (i) - full image
+ * @param out  (o) - subimage (w, h, bitpix and bytelen are set here)
+ * @param x0, y0   - left upper corner
+ * @param w, h     - size
+ * @return FALSE if subimage is empty or `out` buffer is too small
+ */
+int cropimage(cc_IMG *in, cc_IMG *out, int x0, int y0, int w, int h){
+    if(!in || !out || !in->data || !out->data || x0 < 0 || y0 < 0) return FALSE;
+    if(x0 + w > in->w) w = in->w - x0;
+    if(y0 + h > in->h) h = in->h - y0;
+    if(w < 1 || h < 1) return FALSE;
+    int nbytes = cc_getNbytes(in);
+    size_t rowlen = (size_t)w * nbytes, bytelen = rowlen * h;
+    if(out->datasize && out->datasize < bytelen) return FALSE;
+    const uint8_t *i = (const uint8_t*)in->data + ((size_t)y0 * in->w + x0) * nbytes;
+    uint8_t *o = (uint8_t*)out->data;
+    for(int y = 0; y < h; ++y, i += (size_t)in->w * nbytes, o += rowlen) memcpy(o, i, rowlen);
+    out->w = w; out->h = h;
+    out->bitpix = in->bitpix;
+    out->bytelen = bytelen;
+    return TRUE;
+}
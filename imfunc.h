@@ -0,0 +1,64 @@
+/*
+ * This file is part of the CCD_Capture project.
+ * Copyright 2026 Edward V. Emelianov <edward.emelianoff@gmail.com>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "ccdcapture.h"
+
+// image processing kernels (used by viewer and server, measured by benchmarks/kernels_bench)
+
+typedef enum{
+    COLORFN_BWLINEAR,   // gray levels, linear
+    COLORFN_BWLOG,      // gray ln
+    COLORFN_LINEAR,     // linear
+    COLORFN_LOG,        // ln
+    COLORFN_SQRT,       // sqrt
+    COLORFN_POW,        // power
+    COLORFN_MAX         // end of list
+} colorfn_type;
+
+// table-driven conversion of raw pixel values into RGB: raw -> level (cuts or equalization) -> palette colour
+// the full table is rebuilt only when levels or palette changed
+typedef struct{
+    uint8_t rgb[0x10000][3];    // colour of each raw value
+    uint8_t levels[0x10000];    // 8-bit level of each raw value
+    uint8_t palette[256][3];    // colour of each level
+    colorfn_type ft;            // current palette (COLORFN_MAX if not set)
+    int max;                    // max raw value (0xff or 0xffff)
+    int low, high;              // last cuts (-1 if levels got by equalization)
+    int valid;                  // `rgb` is actual
+} displaylut;
+
+const char *colorfun_name(colorfn_type f);
+void gray2rgb(double gray, uint8_t *rgb);
+displaylut *new_displaylut();
+void set_palette(displaylut *L, colorfn_type f);
+void colorize(cc_IMG *img, displaylut *L, uint8_t *rgb);
+int decimate(cc_IMG *in, cc_IMG *out, int x0, int y0, int w, int h, int dec);
+int histogram(cc_IMG *img, uint32_t *hist);
+void equalize(cc_IMG *img, displaylut *L);
+void mkcuts(cc_IMG *img, displaylut *L);
+void swap16_bzero(const uint16_t *in, uint16_t *out, size_t n);
+const char *swap16_bzero_impl();
+int calibrate(cc_IMG *in, cc_IMG *out, const float *bias, const float *dark, float k, const float *gain);
+int binimage(cc_IMG *in, cc_IMG *out, int hb, int vb, int avg);
+void copyfields(cc_IMG *dst, const cc_IMG *src);
+int cropimage(cc_IMG *in, cc_IMG *out, int x0, int y0, int w, int h);
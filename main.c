@@ -29,6 +29,7 @@
 #include <unistd.h>
 #include <usefull_macros.h>
 
+#include "calib.h"
 #include "cmdlnopts.h"
 #include "ccdfunc.h"
 #ifdef IMAGEVIEW
@@ -95,6 +96,12 @@ int main(int argc, char **argv){
         struct stat filestat;
         if(0 == stat(GP->outfile, &filestat)) ERRX(_("File %s exists!"), GP->outfile);
     }
+    if(GP->stack){
+        if(stack_method_byname(GP->stack) == STACK_AMOUNT) ERRX(_("Wrong stacking method: %s"), GP->stack);
+        if(GP->ser || GP->mef) ERRX(_("Options `stack`, `ser` and `mef` can't be used together"));
+        if(GP->stackkappa <= 0.) ERRX(_("Clipping level should be positive"));
+    }
+    if(GP->ser2fits) return ser2fits(GP->ser2fits) ? 0 : 1;
     if(GP->anstmout > 0.){
         if(!cc_setAnsTmout(GP->anstmout)) ERRX(_("Can't set answer timeout to %g"), GP->anstmout);
     }
@@ -0,0 +1,531 @@
+/*
+ * This file is part of the CCD_Capture project.
+ * Copyright 2026 Edward V. Emelianov <edward.emelianoff@gmail.com>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <float.h>
+#include <math.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/shm.h>
+#include <sys/stat.h>
+#include <usefull_macros.h>
+
+#include "ccdfunc.h"
+#include "cmdlnopts.h"
+#include "multicam.h"
+#include "server.h"
+#include "socket.h"
+
+#define FLAG_STARTCAPTURE   (1<<0)
+#define FLAG_CANCEL         (1<<1)
+
+// max time of waiting for SHM semaphore before frame is dropped (seconds)
+#define SEM_TMOUT           (0.5)
+// period of temperature checking (seconds)
+#define TEMP_PERIOD         (5.)
+
+// request from command handler to camera thread (all plugin calls are made by camera thread only)
+typedef enum{
+    REQ_NONE,       // no requests
+    REQ_PENDING,    // new request waits for camera thread
+    REQ_RUNNING,    // camera thread runs it
+    REQ_OK,         // done
+    REQ_FAILED      // failed
+} reqstate;
+
+typedef enum{
+    REQ_BIN,        // setbin(hbin, vbin)
+    REQ_FORMAT,     // setgeometry(&fmt)
+    REQ_DARK,       // setframetype(!dark)
+    REQ_TEMP,       // setT(temp)
+} reqtype;
+
+typedef struct{
+    reqtype type;
+    int hbin, vbin;
+    int dark;
+    float temp;
+    cc_frameformat fmt;
+} camreq;
+
+// additional camera with its own plugin instance, capture thread and SHM segment
+typedef struct{
+    int num;                // number (from 1, main camera is 0)
+    void *dlh;              // plugin handle
+    cc_Camera *cam;         // and camera
+    char model[MODELNM_SZ]; // model name
+    key_t shmkey;           // SHM key
+    cc_IMG *ima;            // image in SHM
+    sem_t *sem;             // its own semaphore (MULTICAM_SEMNAME)
+    char semname[32];       // and its name
+    cc_IMG *locima;         // local buffer for readout
+    double exptime;         // exposition time
+    int hbin, vbin;         // binning
+    int dark;               // dark frames
+    cc_frameformat geom;    // current geometry
+    float tcold;            // last measured temperature
+    int tok;                // tcold is valid
+    camreq req;             // current request to camera thread
+    atomic_int reqstate;    // its state (reqstate)
+    _Atomic cc_camera_state state;
+    atomic_int flags;       // FLAG_STARTCAPTURE, FLAG_CANCEL
+    atomic_int infty;       // infinity loop
+    atomic_int running;     // thread is running
+    pthread_t thread;       // capture thread
+    pthread_mutex_t mutex;  // mutex for fields above shared with command handlers (not for plugin calls)
+} camctx;
+
+static camctx cams[MULTICAM_MAX];
+static int ncams = 0;
+static camctx *curcam = NULL; // camera selected for current command
+
+/**
+ * @brief loadcamera - load new instance of camera plugin
+ * Each camera gets plugin in its own link-map namespace, so several devices of the same plugin
+ * have independent states.
+ * @param C    - camera context
+ * @param name - plugin name
+ * @return FALSE if failed
+ */
+static int loadcamera(camctx *C, const char *name){
+    C->dlh = dlmopen(LM_ID_NEWLM, name, RTLD_NOW | RTLD_LOCAL);
+    if(!C->dlh){
+        WARNX(_("Can't load plugin %s: %s"), name, dlerror());
+        return FALSE;
+    }
+    C->cam = (cc_Camera*) dlsym(C->dlh, "camera");
+    if(!C->cam){
+        WARNX(_("Can't find camera in plugin %s: %s"), name, dlerror());
+        dlclose(C->dlh);
+        C->dlh = NULL;
+        return FALSE;
+    }
+    return TRUE;
+}
+
+// check plugin, set device number and full frame; allocate SHM
+static int initcamera(camctx *C, int devno){
+    cc_Camera *cam = C->cam;
+    if(!cam->check || !cam->check() || !cam->startexposition || !cam->pollcapture || !cam->capture || !cam->setexp){
+        WARNX(_("Camera %d: plugin isn't full or no devices found"), C->num);
+        return FALSE;
+    }
+    if(devno >= cam->Ndevices || (devno > 0 && (!cam->setDevNo || !cam->setDevNo(devno)))){
+        WARNX(_("Camera %d: no device %d"), C->num, devno);
+        return FALSE;
+    }
+    if(!cam->getModelName || !cam->getModelName(C->model, MODELNM_SZ-1)) snprintf(C->model, MODELNM_SZ, "unknown");
+    cc_frameformat fmt, step;
+    if(cam->getgeomlimits && cam->getgeomlimits(&fmt, &step)){
+        fmt.xoff = fmt.yoff = 0;
+        if(cam->setgeometry) cam->setgeometry(&fmt);
+    }
+    C->hbin = C->vbin = 1;
+    if(cam->setbin) cam->setbin(1, 1);
+    C->geom = cam->geometry;
+    C->tok = cam->getTcold && cam->getTcold(&C->tcold);
+    size_t len = (size_t)cam->array.w * cam->array.h * 2;
+    C->ima = cc_getshm(C->shmkey, len);
+    C->locima = cc_newimage(16, cam->array.w, cam->array.h);
+    if(!C->ima || !C->locima){
+        WARNX(_("Camera %d: can't allocate memory for image"), C->num);
+        return FALSE;
+    }
+    snprintf(C->locima->model, MODELNM_SZ, "%s", C->model);
+    C->locima->pixel_x = cam->pixX;
+    C->locima->pixel_y = cam->pixY;
+    snprintf(C->semname, sizeof(C->semname), MULTICAM_SEMNAME, C->shmkey);
+    umask(0); // for read-write semaphore
+    C->sem = sem_open(C->semname, O_CREAT, 0666, 1);
+    if(C->sem == SEM_FAILED){
+        WARNX(_("Camera %d: can't open semaphore %s: %s"), C->num, C->semname, strerror(errno));
+        C->sem = NULL;
+        return FALSE;
+    }
+    return TRUE;
+}
+
+// camera error stops infinity loop, else failed exposition would be restarted each millisecond
+static void seterror(camctx *C){
+    if(C->infty){
+        C->infty = 0;
+        LOGWARN("Camera %d: infinity loop stopped", C->num);
+    }
+    C->state = CAMERA_ERROR;
+}
+
+// lock SHM semaphore of camera; FALSE if it's still locked by client after SEM_TMOUT
+static int lockshm(camctx *C){
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_nsec += (long)(SEM_TMOUT * 1e9);
+    ts.tv_sec += ts.tv_nsec / 1000000000L;
+    ts.tv_nsec %= 1000000000L;
+    while(sem_timedwait(C->sem, &ts)){
+        if(errno != EINTR) return FALSE;
+    }
+    return TRUE;
+}
+
+// start exposition
+static void startexp(camctx *C){
+    cc_Camera *cam = C->cam;
+    C->flags &= ~(FLAG_STARTCAPTURE | FLAG_CANCEL);
+    pthread_mutex_lock(&C->mutex);
+    double exptime = C->exptime;
+    pthread_mutex_unlock(&C->mutex);
+    if(!cam->setexp(exptime) || !cam->startexposition()){
+        LOGERR("Camera %d: can't start exposition", C->num);
+        seterror(C);
+        return;
+    }
+    C->locima->exposure_time = exptime;
+    C->state = CAMERA_CAPTURE;
+}
+
+// read frame into local buffer and copy it into SHM
+static void readframe(camctx *C){
+    cc_Camera *cam = C->cam;
+    cc_IMG *img = C->locima;
+    img->w = C->geom.w / C->hbin;
+    img->h = C->geom.h / C->vbin;
+    if(!cam->getbitpix || !cam->getbitpix(&img->bitpix)) img->bitpix = 16;
+    if(img->bitpix < 8 || img->bitpix > 16) img->bitpix = 16;
+    img->bytelen = (size_t)img->w * img->h * cc_getNbytes(img);
+    img->bin_x = C->hbin; img->bin_y = C->vbin;
+    if(!cam->capture(img)){
+        LOGERR("Camera %d: can't capture image", C->num);
+        seterror(C);
+        return;
+    }
+    fill_camera_fields(cam, img);
+    img->flags.dark = C->dark;
+    // each camera has its own semaphore locked only for copying, so cameras don't wait for each other
+    if(!lockshm(C)){
+        LOGWARN("Camera %d: SHM is locked by client, frame dropped", C->num);
+        C->state = CAMERA_IDLE;
+        return;
+    }
+    img->imnumber = C->ima->imnumber + 1;
+    cc_copyimage(C->ima, img, FALSE);
+    sem_post(C->sem);
+    C->state = CAMERA_FRAMERDY;
+}
+
+// run request of command handler (if any)
+static void runrequest(camctx *C){
+    int expected = REQ_PENDING;
+    if(!atomic_compare_exchange_strong(&C->reqstate, &expected, REQ_RUNNING)) return;
+    cc_Camera *cam = C->cam;
+    camreq *R = &C->req;
+    int r = FALSE;
+    switch(R->type){
+        case REQ_BIN:
+            if((r = cam->setbin(R->hbin, R->vbin))){ C->hbin = R->hbin; C->vbin = R->vbin; }
+        break;
+        case REQ_FORMAT:
+            if((r = cam->setgeometry(&R->fmt))){
+                pthread_mutex_lock(&C->mutex);
+                C->geom = cam->geometry;
+                pthread_mutex_unlock(&C->mutex);
+            }
+        break;
+        case REQ_DARK:
+            if((r = cam->setframetype(!R->dark))) C->dark = R->dark;
+        break;
+        case REQ_TEMP:
+            r = cam->setT(R->temp);
+        break;
+    }
+    if(!r) LOGWARN("Camera %d: request %d failed", C->num, R->type);
+    C->reqstate = r ? REQ_OK : REQ_FAILED;
+}
+
+// check temperature once per TEMP_PERIOD
+static void checktemp(camctx *C){
+    static double t0[MULTICAM_MAX] = {0};
+    double t = sl_dtime();
+    if(!C->cam->getTcold || t - t0[C->num - 1] < TEMP_PERIOD) return;
+    t0[C->num - 1] = t;
+    float T;
+    int ok = C->cam->getTcold(&T);
+    pthread_mutex_lock(&C->mutex);
+    C->tcold = T;
+    C->tok = ok;
+    pthread_mutex_unlock(&C->mutex);
+}
+
+// capture thread of additional camera: the only one calling plugin functions
+static void *camthread(void *arg){
+    camctx *C = (camctx*)arg;
+    while(C->running){
+        float tremain = 0.f;
+        if(C->flags & FLAG_CANCEL){
+            C->flags &= ~(FLAG_STARTCAPTURE | FLAG_CANCEL);
+            C->infty = 0;
+            if(C->state == CAMERA_CAPTURE && C->cam->cancel) C->cam->cancel();
+            C->state = CAMERA_IDLE;
+        }
+        runrequest(C); // settings are changed before the next exposition starts
+        checktemp(C);
+        if(C->state == CAMERA_CAPTURE){
+            cc_capture_status cs;
+            if(!C->cam->pollcapture(&cs, &tremain)){
+                LOGERR("Camera %d: exposition aborted", C->num);
+                seterror(C);
+            }else if(cs != CAPTURE_PROCESS) readframe(C);
+        }else if((C->flags & FLAG_STARTCAPTURE) || C->infty) startexp(C);
+        if(tremain > 0.002f && tremain < 0.5f) usleep(tremain * 1e6);
+        else usleep(1000);
+    }
+    return NULL;
+}
+
+/**
+ * @brief multicam_start - run additional cameras
+ * @param list    - "plugin[:devno[:shmkey]]" of each camera
+ * @param mainkey - SHM key of main camera
+ * @return FALSE if some of cameras can't be started
+ */
+int multicam_start(char **list, key_t mainkey){
+    if(!list) return TRUE;
+    for(; *list; ++list){
+        if(ncams == MULTICAM_MAX){
+            WARNX(_("Too many cameras, max: %d"), MULTICAM_MAX);
+            return FALSE;
+        }
+        camctx *C = &cams[ncams];
+        bzero(C, sizeof(camctx));
+        C->num = ncams + 1;
+        char *par = strdup(*list), *name = par, *devstr = strchr(par, ':'), *keystr = NULL;
+        int devno = 0, key = mainkey + MULTICAM_KEYSTEP * C->num;
+        if(devstr){
+            *devstr++ = 0;
+            if((keystr = strchr(devstr, ':'))) *keystr++ = 0;
+        }
+        int ok = (!devstr || sscanf(devstr, "%d", &devno) == 1) && (!keystr || sscanf(keystr, "%d", &key) == 1) && devno > -1;
+        if(!ok) WARNX(_("Wrong camera parameters: %s"), *list);
+        C->shmkey = key;
+        C->exptime = 1.;
+        if(ok) ok = loadcamera(C, name) && initcamera(C, devno);
+        FREE(par);
+        if(!ok){
+            if(C->cam && C->cam->close) C->cam->close();
+            cc_freeimage(&C->locima);
+            if(C->sem){ sem_close(C->sem); sem_unlink(C->semname); }
+            return FALSE;
+        }
+        pthread_mutex_init(&C->mutex, NULL);
+        C->running = 1;
+        if(pthread_create(&C->thread, NULL, camthread, C)){
+            WARN("pthread_create()");
+            C->running = 0;
+            return FALSE;
+        }
+        ++ncams;
+        LOGMSG("Camera %d: %s (device %d), SHM key %d", C->num, C->model, devno, C->shmkey);
+        verbose(VERBOSE_PRIMARY, _("Camera %d: %s (device %d), SHM key %d"), C->num, C->model, devno, C->shmkey);
+    }
+    return TRUE;
+}
+
+int multicam_amount(){
+    return ncams;
+}
+
+/**
+ * @brief multicam_select - select camera for next command
+ * @param n - camera number (from 1)
+ * @return FALSE if there's no such camera
+ */
+int multicam_select(int n){
+    if(n < 1 || n > ncams) return FALSE;
+    curcam = &cams[n - 1];
+    return TRUE;
+}
+
+/**
+ * @brief multicam_list - list of additional cameras `N:model:shmkey` divided by ';'
+ * @return length of string
+ */
+int multicam_list(char *buf, int buflen){
+    int l = 0;
+    *buf = 0;
+    for(int i = 0; i < ncams && l < buflen; ++i)
+        l += snprintf(buf + l, buflen - l, "%s%d:%s:%d", i ? ";" : "", cams[i].num, cams[i].model, cams[i].shmkey);
+    return l;
+}
+
+void multicam_stop(){
+    for(int i = 0; i < ncams; ++i){
+        camctx *C = &cams[i];
+        C->running = 0;
+        pthread_join(C->thread, NULL);
+        if(C->state == CAMERA_CAPTURE && C->cam->cancel) C->cam->cancel();
+        if(C->cam->close) C->cam->close();
+        cc_freeimage(&C->locima);
+        sem_close(C->sem);
+        sem_unlink(C->semname);
+    }
+    ncams = 0;
+}
+
+/*******************************************************************************
+ ************************ Handlers of additional cameras ***********************
+ ******************************************************************************/
+
+// all handlers work with `curcam` and send answers as `camN.key=value`
+#define SENDANS(fmt, ...) do{char buf[256]; snprintf(buf, 255, "cam%d.%s=" fmt, curcam->num, key, __VA_ARGS__); \
+    if(!cc_sendstrmessage(fd, buf)){return CC_RESULT_DISCONNECTED;} return CC_RESULT_SILENCE;}while(0)
+
+// handlers have no check functions as they shouldn't wait for main camera lock; they don't call plugin
+// functions but send requests to camera thread; setters of geometry and exposition can't be run while camera captures
+#define CHKCAM() do{if(!curcam) return CC_RESULT_FAIL;}while(0)
+#define CHKIDLE() do{CHKCAM(); if(val && curcam->state == CAMERA_CAPTURE) return CC_RESULT_BUSY;}while(0)
+
+static cc_hresult exphandler(int fd, const char *key, const char *val){
+    CHKIDLE();
+    if(val){
+        double v = atof(val);
+        if(v < DBL_EPSILON) return CC_RESULT_BADVAL;
+        pthread_mutex_lock(&curcam->mutex);
+        curcam->exptime = v;
+        pthread_mutex_unlock(&curcam->mutex);
+    }
+    SENDANS("%g", curcam->exptime);
+}
+
+static cc_hresult expstatehandler(int fd, const char *key, const char *val){
+    CHKCAM();
+    if(val){
+        int n = atoi(val);
+        if(n == CAMERA_IDLE) curcam->flags |= FLAG_CANCEL;
+        else if(n == CAMERA_CAPTURE) curcam->flags |= FLAG_STARTCAPTURE;
+        else return CC_RESULT_BADVAL;
+    }
+    SENDANS("%d", curcam->state);
+}
+
+static cc_hresult inftyhandler(int fd, const char *key, const char *val){
+    CHKCAM();
+    if(val){
+        curcam->infty = atoi(val) ? 1 : 0;
+        if(!curcam->infty) curcam->flags |= FLAG_CANCEL;
+    }
+    SENDANS("%d", (int)curcam->infty);
+}
+
+/**
+ * @brief sendreq - give request to camera thread (server's poll loop can't wait for its result)
+ * The request is done before the next exposition starts; client could check result by getter
+ * @param R - request
+ * @return CC_RESULT_OK if request accepted or CC_RESULT_BUSY if previous request isn't done yet
+ */
+static cc_hresult sendreq(const camreq *R){
+    camctx *C = curcam;
+    int st = C->reqstate;
+    if(st == REQ_PENDING || st == REQ_RUNNING) return CC_RESULT_BUSY; // previous request still runs
+    C->req = *R;
+    C->reqstate = REQ_PENDING;
+    return CC_RESULT_OK;
+}
+
+static cc_hresult binhandler(int fd, const char *key, const char *val){
+    CHKIDLE();
+    int ishbin = (strcmp(key, CC_CMD_HBIN) == 0);
+    if(val){
+        int b = atoi(val);
+        if(b < 1 || !curcam->cam->setbin) return CC_RESULT_BADVAL;
+        camreq R = {.type = REQ_BIN, .hbin = ishbin ? b : curcam->hbin, .vbin = ishbin ? curcam->vbin : b};
+        return sendreq(&R);
+    }
+    SENDANS("%d", ishbin ? curcam->hbin : curcam->vbin);
+}
+
+static cc_hresult formathandler(int fd, const char *key, const char *val){
+    CHKIDLE();
+    cc_frameformat f;
+    if(val){
+        if(!curcam->cam->setgeometry) return CC_RESULT_FAIL;
+        if(4 != sscanf(val, "%d,%d,%d,%d", &f.xoff, &f.yoff, &f.w, &f.h)) return CC_RESULT_BADVAL;
+        f.w -= f.xoff; f.h -= f.yoff;
+        camreq R = {.type = REQ_FORMAT, .fmt = f};
+        return sendreq(&R);
+    }
+    pthread_mutex_lock(&curcam->mutex);
+    f = curcam->geom;
+    pthread_mutex_unlock(&curcam->mutex);
+    SENDANS("%d,%d,%d,%d", f.xoff, f.yoff, f.xoff + f.w, f.yoff + f.h);
+}
+
+static cc_hresult darkhandler(int fd, const char *key, const char *val){
+    CHKIDLE();
+    if(val){
+        int d = atoi(val);
+        if(d != 0 && d != 1) return CC_RESULT_BADVAL;
+        if(!curcam->cam->setframetype) return CC_RESULT_FAIL;
+        camreq R = {.type = REQ_DARK, .dark = d};
+        return sendreq(&R);
+    }
+    SENDANS("%d", curcam->dark);
+}
+
+// temperature is measured by camera thread, here is the last value
+static cc_hresult temphandler(int fd, const char *key, const char *val){
+    CHKCAM();
+    if(val){
+        if(!curcam->cam->setT) return CC_RESULT_FAIL;
+        camreq R = {.type = REQ_TEMP, .temp = atof(val)};
+        return sendreq(&R);
+    }
+    pthread_mutex_lock(&curcam->mutex);
+    float t = curcam->tcold;
+    int ok = curcam->tok;
+    pthread_mutex_unlock(&curcam->mutex);
+    if(!ok) return CC_RESULT_FAIL;
+    SENDANS("%.1f", t);
+}
+
+static cc_hresult imnohandler(int fd, const char *key, _U_ const char *val){
+    CHKCAM();
+    SENDANS("%zd", curcam->ima->imnumber);
+}
+
+static cc_hresult shmkeyhandler(int fd, const char *key, _U_ const char *val){
+    CHKCAM();
+    SENDANS("%d", curcam->shmkey);
+}
+
+cc_handleritem multicam_items[] = {
+    {NULL, exphandler, CC_CMD_EXPOSITION},
+    {NULL, expstatehandler, CC_CMD_EXPSTATE},
+    {NULL, inftyhandler, CC_CMD_INFTY},
+    {NULL, binhandler, CC_CMD_HBIN},
+    {NULL, binhandler, CC_CMD_VBIN},
+    {NULL, formathandler, CC_CMD_FRAMEFORMAT},
+    {NULL, darkhandler, CC_CMD_DARK},
+    {NULL, temphandler, CC_CMD_CAMTEMPER},
+    {NULL, imnohandler, CC_CMD_IMNUMBER},
+    {NULL, shmkeyhandler, CC_CMD_SHMEMKEY},
+    {NULL, NULL, NULL},
+};
@@ -0,0 +1,37 @@
+/*
+ * This file is part of the CCD_Capture project.
+ * Copyright 2026 Edward V. Emelianov <edward.emelianoff@gmail.com>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "ccdcapture.h"
+
+// max amount of additional cameras
+#define MULTICAM_MAX        8
+// default SHM key of camera N is main key + MULTICAM_KEYSTEP*N (additional cameras have no image socket)
+#define MULTICAM_KEYSTEP    100
+// SHM of additional camera is guarded by its own semaphore (not SEM_NAME), its name contains SHM key
+#define MULTICAM_SEMNAME    SEM_NAME "_%d"
+
+// commands for additional cameras (`camN.command`, N > 0) after selecting camera by `multicam_select`
+extern cc_handleritem multicam_items[];
+
+int multicam_start(char **list, key_t mainkey);
+int multicam_amount();
+int multicam_select(int n);
+int multicam_list(char *buf, int buflen);
+void multicam_stop();
@@ -0,0 +1,140 @@
+/*
+ * This file is part of the CCD_Capture project.
+ * Copyright 2026 Edward V. Emelianov <edward.emelianoff@gmail.com>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <usefull_macros.h>
+
+#include "plan.h"
+
+/**
+ * @brief parsekey - parse one `key=value` record of plan step
+ * @param s   - step
+ * @param key - record (its content is broken)
+ * @return FALSE if key or value is wrong
+ */
+static int parsekey(planstep *s, char *key){
+    char *val = strchr(key, '=');
+    if(!val || !val[1]) return FALSE;
+    *val++ = 0;
+    char *eptr;
+    if(strcmp(key, "wheel") == 0){
+        long l = strtol(val, &eptr, 10);
+        if(*eptr || l < -1) return FALSE;
+        s->wheel = (int)l;
+    }else if(strcmp(key, "focus") == 0){
+        s->focus = strtof(val, &eptr);
+        if(*eptr) return FALSE;
+        s->focoffset = NAN;
+    }else if(strcmp(key, "focoffset") == 0){
+        s->focoffset = strtof(val, &eptr);
+        if(*eptr) return FALSE;
+        s->focus = NAN;
+    }else if(strcmp(key, "exptime") == 0){
+        s->exptime = strtod(val, &eptr);
+        if(*eptr || s->exptime < 1e-9) return FALSE;
+    }else if(strcmp(key, "nframes") == 0){
+        long l = strtol(val, &eptr, 10);
+        if(*eptr || l < 1) return FALSE;
+        s->nframes = (int)l;
+    }else if(strcmp(key, "bin") == 0){ // `bin=b` or `bin=h,v`
+        int n = sscanf(val, "%d,%d", &s->hbin, &s->vbin);
+        if(n == 1) s->vbin = s->hbin;
+        else if(n != 2) return FALSE;
+        if(s->hbin < 1 || s->vbin < 1) return FALSE;
+    }else if(strcmp(key, "frame") == 0){ // X0,Y0,X1,Y1 like in `format` command
+        cc_frameformat *f = &s->frame;
+        if(4 != sscanf(val, "%d,%d,%d,%d", &f->xoff, &f->yoff, &f->w, &f->h)) return FALSE;
+        f->w -= f->xoff; f->h -= f->yoff;
+        if(f->xoff < 0 || f->yoff < 0 || f->w < 1 || f->h < 1) return FALSE;
+    }else if(strcmp(key, "dark") == 0){
+        if(strcmp(val, "0") && strcmp(val, "1")) return FALSE;
+        s->dark = (*val == '1');
+    }else if(strcmp(key, "prefix") == 0){
+        s->prefix = val; // will be copied after line parsing
+    }else return FALSE;
+    return TRUE;
+}
+
+/**
+ * @brief plan_read - read plan file
+ * Each non-empty line (except comments beginning with '#') is step of plan: `key=value` records divided by spaces:
+ * wheel=pos, focus=pos (or focoffset=offset from position at start), exptime=seconds, nframes=N, bin=b or bin=h,v, frame=X0,Y0,X1,Y1, dark=0|1, prefix=path.
+ * Parameters not pointed are inherited from previous step; first step should have `exptime`.
+ * @param fnam - file name
+ * @param P    (o) - plan
+ * @return FALSE if file can't be read or have errors
+ */
+int plan_read(const char *fnam, plan_t *P){
+    if(!fnam || !P) return FALSE;
+    bzero(P, sizeof(plan_t));
+    FILE *f = fopen(fnam, "r");
+    if(!f){
+        WARN(_("Can't open %s"), fnam);
+        return FALSE;
+    }
+    planstep cur = {.wheel = -1, .focus = NAN, .focoffset = NAN, .nframes = 1, .dark = -1};
+    char line[BUFSIZ];
+    int lineno = 0, ret = TRUE;
+    P->steps = MALLOC(planstep, PLAN_MAXSTEPS);
+    while(fgets(line, BUFSIZ, f)){
+        ++lineno;
+        char *c = strchr(line, '#');
+        if(c) *c = 0;
+        char *saveptr, *tok = strtok_r(line, " \t\r\n", &saveptr);
+        if(!tok) continue; // empty line
+        if(P->nsteps == PLAN_MAXSTEPS){
+            WARNX(_("%s: too many steps, max: %d"), fnam, PLAN_MAXSTEPS);
+            ret = FALSE;
+            break;
+        }
+        planstep step = cur;
+        step.prefix = NULL;
+        for(; tok; tok = strtok_r(NULL, " \t\r\n", &saveptr)){
+            if(!parsekey(&step, tok)){
+                WARNX(_("%s:%d: wrong record '%s'"), fnam, lineno, tok);
+                ret = FALSE;
+            }
+        }
+        if(!ret) break;
+        if(step.exptime < 1e-9){
+            WARNX(_("%s:%d: exposition time isn't pointed"), fnam, lineno);
+            ret = FALSE;
+            break;
+        }
+        step.prefix = step.prefix ? strdup(step.prefix) : (cur.prefix ? strdup(cur.prefix) : NULL);
+        P->steps[P->nsteps++] = step;
+        cur = step;
+    }
+    fclose(f);
+    if(ret && P->nsteps == 0){
+        WARNX(_("%s: empty plan"), fnam);
+        ret = FALSE;
+    }
+    if(!ret) plan_free(P);
+    return ret;
+}
+
+void plan_free(plan_t *P){
+    if(!P || !P->steps) return;
+    for(int i = 0; i < P->nsteps; ++i) FREE(P->steps[i].prefix);
+    FREE(P->steps);
+    P->nsteps = 0;
+}
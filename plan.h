@@ -0,0 +1,45 @@
+/*
+ * This file is part of the CCD_Capture project.
+ * Copyright 2026 Edward V. Emelianov <edward.emelianoff@gmail.com>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "ccdcapture.h"
+
+// max amount of steps in plan
+#define PLAN_MAXSTEPS       1024
+
+// one step of plan; parameters not pointed in step are inherited from previous
+typedef struct{
+    int wheel;          // wheel position (-1 - don't move)
+    float focus;        // focuser position (NAN - don't move)
+    float focoffset;    // or its offset from position at plan start (NAN - don't move)
+    double exptime;     // exposition time, s
+    int nframes;        // amount of frames
+    int hbin, vbin;     // binning
+    cc_frameformat frame; // frame format (w == 0 - don't change)
+    int dark;           // 1 - dark frames, 0 - light frames, -1 - don't change
+    char *prefix;       // output files prefix (NULL - use current)
+} planstep;
+
+typedef struct{
+    int nsteps;
+    planstep *steps;
+} plan_t;
+
+int plan_read(const char *fnam, plan_t *P);
+void plan_free(plan_t *P);
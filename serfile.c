@@ -0,0 +1,283 @@
+/*
+ * This file is part of the CCD_Capture project.
+ * Copyright 2026 Edward V. Emelianov <edward.emelianoff@gmail.com>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// lightweight recording of fast series into SER files (format of LUCAM-RECORDER, version 3):
+// header (all numbers are little-endian)
+//   0  FileID[14]      "LUCAM-RECORDER"
+//  14  LuID            0
+//  18  ColorID         0 - MONO
+//  22  LittleEndian    1 - 16-bit data are little-endian
+//  26  ImageWidth
+//  30  ImageHeight
+//  34  PixelDepthPerPlane (8 or 16)
+//  38  FrameCount
+//  42  Observer[40], Instrument[40], Telescope[40]
+// 162  DateTime (int64, local time), 170  DateTime_UTC (int64)
+// then FrameCount frames and FrameCount int64 UTC timestamps of frames;
+// time is in .NET ticks: 100ns intervals since 0001-01-01
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "serfile.h"
+
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#error "SER recording supports only little-endian hosts"
+#endif
+
+#define SER_FILEID          "LUCAM-RECORDER"
+// offsets of fields
+#define SER_COLORID         18
+#define SER_LITTLEENDIAN    22
+#define SER_WIDTH           26
+#define SER_HEIGHT          30
+#define SER_DEPTH           34
+#define SER_FRAMECOUNT      38
+#define SER_OBSERVER        42
+#define SER_INSTRUMENT      82
+#define SER_TELESCOPE       122
+#define SER_DATETIME        162
+#define SER_DATETIME_UTC    170
+// ticks of UNIX epoch start and ticks per second
+#define SER_TICKS_EPOCH     621355968000000000ULL
+#define SER_TICKS_SEC       10000000ULL
+
+static void putle32(uint8_t *p, uint32_t v){
+    for(int i = 0; i < 4; ++i, v >>= 8) p[i] = v & 0xff;
+}
+static void putle64(uint8_t *p, uint64_t v){
+    for(int i = 0; i < 8; ++i, v >>= 8) p[i] = v & 0xff;
+}
+static uint32_t getle32(const uint8_t *p){
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+static uint64_t getle64(const uint8_t *p){
+    return getle32(p) | ((uint64_t)getle32(p + 4) << 32);
+}
+
+static uint64_t unix2ticks(double t){
+    return SER_TICKS_EPOCH + (uint64_t)(t * SER_TICKS_SEC);
+}
+
+// write all `len` bytes at current position
+static int writeall(int fd, const void *data, size_t len){
+    const uint8_t *ptr = data;
+    while(len){
+        ssize_t w = write(fd, ptr, len);
+        if(w < 0){
+            if(errno == EINTR) continue;
+            return FALSE;
+        }
+        ptr += w;
+        len -= w;
+    }
+    return TRUE;
+}
+
+/**
+ * @brief ser_open - create SER file for frames like `img`
+ * @param s - SER file
+ * @param fnam - file name (with leading '!' to rewrite existing file)
+ * @param img - first image of series (for frame size and time)
+ * @param observer, instrument, telescope - strings for header (or NULL)
+ * @return TRUE if all OK
+ */
+int ser_open(serfile *s, const char *fnam, cc_IMG *img, const char *observer, const char *instrument, const char *telescope){
+    if(!s || !fnam || !img) return FALSE;
+    if(s->fd > -1) ser_close(s);
+    int rewrite = FALSE;
+    if(*fnam == '!'){
+        rewrite = TRUE;
+        ++fnam;
+    }
+    int nbytes = cc_getNbytes(img);
+    if(nbytes < 1 || nbytes > 2){
+        WARNX(_("SER files support only 8- and 16-bit images"));
+        return FALSE;
+    }
+    uint8_t hdr[SER_HEADER_SIZE] = {0};
+    memcpy(hdr, SER_FILEID, sizeof(SER_FILEID) - 1);
+    putle32(hdr + SER_COLORID, 0);
+    putle32(hdr + SER_LITTLEENDIAN, 1);
+    putle32(hdr + SER_WIDTH, img->w);
+    putle32(hdr + SER_HEIGHT, img->h);
+    putle32(hdr + SER_DEPTH, 8 * nbytes);
+    if(observer) strncpy((char*)hdr + SER_OBSERVER, observer, SER_STRING_LEN);
+    if(instrument) strncpy((char*)hdr + SER_INSTRUMENT, instrument, SER_STRING_LEN);
+    if(telescope) strncpy((char*)hdr + SER_TELESCOPE, telescope, SER_STRING_LEN);
+    double t = img->timestamp > 0. ? img->timestamp : sl_dtime();
+    time_t tt = (time_t)t;
+    struct tm tm;
+    localtime_r(&tt, &tm);
+    putle64(hdr + SER_DATETIME, unix2ticks(t + tm.tm_gmtoff));
+    putle64(hdr + SER_DATETIME_UTC, unix2ticks(t));
+    int fd = open(fnam, O_WRONLY | O_CREAT | O_CLOEXEC | (rewrite ? O_TRUNC : O_EXCL), 0666);
+    if(fd < 0){
+        WARN(_("Can't create file %s"), fnam);
+        return FALSE;
+    }
+    if(!writeall(fd, hdr, SER_HEADER_SIZE)){
+        WARN(_("Can't write file %s"), fnam);
+        close(fd);
+        unlink(fnam);
+        return FALSE;
+    }
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    *s = (serfile){.fd = fd, .w = img->w, .h = img->h, .bitpix = 8 * nbytes};
+    s->name = strdup(fnam);
+    return TRUE;
+}
+
+/**
+ * @brief ser_add - write next frame
+ * @param s - SER file
+ * @param img - image (the same size and depth as first one)
+ * @return TRUE if all OK
+ */
+int ser_add(serfile *s, cc_IMG *img){
+    if(!s || s->fd < 0 || !img || !img->data) return FALSE;
+    if(img->w != s->w || img->h != s->h || 8 * cc_getNbytes(img) != s->bitpix){
+        WARNX(_("Frame %dx%d (%d bits) can't be added to SER file with %dx%d (%d bits) frames"),
+              img->w, img->h, img->bitpix, s->w, s->h, s->bitpix);
+        return FALSE;
+    }
+    if(s->nframes == s->stampsize){
+        size_t newsz = s->stampsize ? s->stampsize * 2 : 1024;
+        uint64_t *n = realloc(s->stamps, newsz * sizeof(uint64_t));
+        if(!n){
+            WARN("realloc()");
+            return FALSE;
+        }
+        s->stamps = n;
+        s->stampsize = newsz;
+    }
+    if(!writeall(s->fd, img->data, (size_t)s->w * s->h * (s->bitpix / 8))){
+        WARN(_("Can't write file %s"), s->name);
+        return FALSE;
+    }
+    s->stamps[s->nframes++] = unix2ticks(img->timestamp > 0. ? img->timestamp : sl_dtime());
+    return TRUE;
+}
+
+/**
+ * @brief ser_close - write timestamps and amount of frames, close file
+ * @param s - SER file
+ * @return TRUE if all OK
+ */
+int ser_close(serfile *s){
+    if(!s || s->fd < 0) return FALSE;
+    int ret = TRUE;
+    for(uint32_t i = 0; i < s->nframes; ++i) putle64((uint8_t*)&s->stamps[i], s->stamps[i]);
+    if(s->nframes && !writeall(s->fd, s->stamps, s->nframes * sizeof(uint64_t))) ret = FALSE;
+    uint8_t n[4];
+    putle32(n, s->nframes);
+    if(4 != pwrite(s->fd, n, 4, SER_FRAMECOUNT)) ret = FALSE;
+    if(close(s->fd)) ret = FALSE;
+    if(!ret) WARN(_("Can't write file %s"), s->name);
+    FREE(s->name);
+    FREE(s->stamps);
+    *s = (serfile){.fd = -1};
+    return ret;
+}
+
+// copy string field of header
+static void getstring(char *dst, const uint8_t *src){
+    memcpy(dst, src, SER_STRING_LEN);
+    dst[SER_STRING_LEN] = 0;
+    for(int i = SER_STRING_LEN - 1; i > -1 && (dst[i] == ' ' || dst[i] == 0); --i) dst[i] = 0;
+}
+
+/**
+ * @brief ser_read_open - open SER file for reading (only monochrome and raw Bayer files are supported)
+ * @param r - reader
+ * @param fnam - file name
+ * @return TRUE if all OK
+ */
+int ser_read_open(serreader *r, const char *fnam){
+    if(!r || !fnam) return FALSE;
+    *r = (serreader){0};
+    sl_mmapbuf_t *buf = sl_mmap((char*)fnam);
+    if(!buf) return FALSE;
+    const uint8_t *hdr = (const uint8_t*)buf->data;
+    if(buf->len < SER_HEADER_SIZE || memcmp(hdr, SER_FILEID, sizeof(SER_FILEID) - 1)){
+        WARNX(_("%s isn't SER file"), fnam);
+        sl_munmap(buf);
+        return FALSE;
+    }
+    uint32_t color = getle32(hdr + SER_COLORID), depth = getle32(hdr + SER_DEPTH);
+    int w = (int)getle32(hdr + SER_WIDTH), h = (int)getle32(hdr + SER_HEIGHT), n = (int)getle32(hdr + SER_FRAMECOUNT);
+    if(color >= 100 || depth < 1 || depth > 16 || w < 1 || h < 1 || n < 0){ // RGB/BGR have 3 planes
+        WARNX(_("Unsupported SER format: color %u, depth %u, %dx%d"), color, depth, w, h);
+        sl_munmap(buf);
+        return FALSE;
+    }
+    r->w = w; r->h = h;
+    r->bitpix = depth > 8 ? 16 : 8;
+    r->swap = (r->bitpix == 16 && getle32(hdr + SER_LITTLEENDIAN) == 0);
+    r->framesize = (size_t)w * h * (r->bitpix / 8);
+    size_t avail = (buf->len - SER_HEADER_SIZE) / r->framesize;
+    if(avail < (size_t)n){
+        WARNX(_("File %s is truncated: %zd frames instead of %d"), fnam, avail, n);
+        n = (int)avail;
+    }
+    r->nframes = n;
+    if(buf->len >= SER_HEADER_SIZE + r->framesize * n + sizeof(uint64_t) * n)
+        r->stamps = hdr + SER_HEADER_SIZE + r->framesize * n;
+    getstring(r->observer, hdr + SER_OBSERVER);
+    getstring(r->instrument, hdr + SER_INSTRUMENT);
+    getstring(r->telescope, hdr + SER_TELESCOPE);
+    r->buf = buf;
+    return TRUE;
+}
+
+/**
+ * @brief ser_read_frame - copy frame into image and set its timestamp
+ * @param r - reader
+ * @param n - frame number (from 0)
+ * @param img - image of the same size and depth
+ * @return TRUE if all OK
+ */
+int ser_read_frame(serreader *r, int n, cc_IMG *img){
+    if(!r || !r->buf || n < 0 || n >= r->nframes || !img || !img->data) return FALSE;
+    if(img->w != r->w || img->h != r->h || img->datasize < r->framesize) return FALSE;
+    const uint8_t *src = (const uint8_t*)r->buf->data + SER_HEADER_SIZE + r->framesize * n;
+    if(r->swap){
+        const uint16_t *in = (const uint16_t*)src;
+        uint16_t *out = (uint16_t*)img->data;
+        size_t npix = (size_t)r->w * r->h;
+        for(size_t i = 0; i < npix; ++i) out[i] = __builtin_bswap16(in[i]);
+    }else memcpy(img->data, src, r->framesize);
+    img->bitpix = r->bitpix;
+    img->bytelen = r->framesize;
+    img->gotstat = 0;
+    if(r->stamps){
+        uint64_t t = getle64(r->stamps + sizeof(uint64_t) * n);
+        if(t > SER_TICKS_EPOCH) img->timestamp = (double)(t - SER_TICKS_EPOCH) / SER_TICKS_SEC;
+    }
+    return TRUE;
+}
+
+void ser_read_close(serreader *r){
+    if(!r || !r->buf) return;
+    sl_munmap(r->buf);
+    r->buf = NULL;
+}
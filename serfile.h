@@ -0,0 +1,61 @@
+/*
+ * This file is part of the CCD_Capture project.
+ * Copyright 2026 Edward V. Emelianov <edward.emelianoff@gmail.com>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <usefull_macros.h>
+
+#include "ccdcapture.h"
+
+// size of SER header
+#define SER_HEADER_SIZE     178
+// length of string fields of header
+#define SER_STRING_LEN      40
+
+// SER file (LUCAM-RECORDER v3) writer: 178-byte header, raw frames back-to-back, UTC timestamps of frames at the end
+typedef struct{
+    int fd;             // file descriptor (-1 if closed)
+    char *name;         // file name
+    int w, h;           // frame size
+    int bitpix;         // 8 or 16
+    uint32_t nframes;   // amount of frames written
+    uint64_t *stamps;   // timestamps of frames (in .NET ticks)
+    size_t stampsize;   // size of `stamps` array
+} serfile;
+
+// SER file opened for reading
+typedef struct{
+    sl_mmapbuf_t *buf;  // mapped file
+    int w, h;           // frame size
+    int bitpix;         // 8 or 16
+    int swap;           // 16-bit data have to be swapped
+    int nframes;        // amount of frames
+    size_t framesize;   // size of frame in bytes
+    char observer[SER_STRING_LEN + 1];
+    char instrument[SER_STRING_LEN + 1];
+    char telescope[SER_STRING_LEN + 1];
+    const uint8_t *stamps; // trailer with timestamps or NULL
+} serreader;
+
+int ser_open(serfile *s, const char *fnam, cc_IMG *img, const char *observer, const char *instrument, const char *telescope);
+int ser_add(serfile *s, cc_IMG *img);
+int ser_close(serfile *s);
+
+int ser_read_open(serreader *r, const char *fnam);
+int ser_read_frame(serreader *r, int n, cc_IMG *img);
+void ser_read_close(serreader *r);
@@ -17,6 +17,7 @@
  */
 
 #include <fcntl.h>
+#include <math.h>
 #include <netdb.h>
 #include <pthread.h>
 #include <poll.h>
@@ -24,14 +25,22 @@
 #include <stdio.h>
 #include <string.h>
 #include <sys/mman.h>
+#include <sys/shm.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
 #include <usefull_macros.h>
 
+#include "calib.h"
 #include "ccdfunc.h"
+#include "coadd.h"
 #include "cmdlnopts.h"
+#include "focus.h"
+#include "imfunc.h"
+#include "multicam.h"
+#include "plan.h"
 #include "server.h"
 #include "socket.h"
+#include "sources.h"
 
 static int parsestring(int fd, cc_handleritem *handlers, char *str);
 
@@ -45,6 +54,64 @@ static cc_frameformat frmformatmax = {0}, curformat = {0}; // maximal format
 
 // image in shared memory
 static cc_IMG *ima = NULL;
+// calibrated image in shared memory and master frames (if calibration is on)
+static cc_IMG *calima = NULL;
+static calmasters *masters = NULL;
+// co-added image in shared memory (if co-adding is on)
+static cc_IMG *coaddima = NULL;
+static coadder coadd = {0};
+// regions of interest (in image pixels) cut from each frame into their own SHM segments
+typedef struct{
+    cc_frameformat f;   // ROI
+    key_t key;          // its SHM key
+    cc_IMG *shm;        // and segment
+} roi_t;
+static roi_t rois[MAX_ROI];
+static int nrois = 0;
+static pthread_mutex_t roimutex = PTHREAD_MUTEX_INITIALIZER;
+// table of sources found on last frame (in SHM) and detection threshold (0 - off)
+static sourcetable *srctable = NULL;
+static double srcnsigma = 0.;
+static pthread_mutex_t srcmutex = PTHREAD_MUTEX_INITIALIZER;
+// state of long jobs (autofocus, plan) running in separate threads
+typedef enum{
+    JOB_IDLE,
+    JOB_RUNNING,
+    JOB_DONE,
+    JOB_FAILED
+} job_state;
+static const char *jobstates[] = {"idle", "running", "done", "failed"};
+// autofocus
+static struct{
+    float start, step;      // first position and step
+    int npoints;            // amount of positions
+    cc_frameformat roi;     // part of image to measure stars (w == 0 - whole image)
+    focuscurve curve;       // measured points
+    double best, minfwhm;   // fitted focus position and star size
+} af;
+static _Atomic job_state afstate = JOB_IDLE;
+static atomic_int afcancel = 0;
+static pthread_mutex_t afmutex = PTHREAD_MUTEX_INITIALIZER;
+// plan of series
+static struct{
+    plan_t plan;
+    int step, frame;        // current step and frame
+    float focstart;         // focuser position at start
+    double exptime;         // total exposition time of frames saved
+    double tstart, tend;    // time of plan start and end
+} pl;
+static _Atomic job_state plstate = JOB_IDLE;
+static atomic_int plcancel = 0;
+static pthread_mutex_t plmutex = PTHREAD_MUTEX_INITIALIZER;
+// wheel/focuser moves queued while camera captures: they start at the end of exposition (during readout)
+typedef struct{
+    int wheel;              // wheel position (-1 - don't move)
+    float focus;            // focuser position (NAN - don't move)
+} devmove;
+static devmove pendmove = {.wheel = -1, .focus = NAN}, runmove;
+static int capturing = FALSE; // exposition is running (moves could be queued); guarded by `movemutex`
+static pthread_mutex_t movemutex = PTHREAD_MUTEX_INITIALIZER;
+static atomic_int moving = 0, moveerr = 0; // queued moves are running; some of them failed
 
 static float focmaxpos = 0.f, focminpos = 0.f; // focuser extremal positions
 static int wmaxpos = 0; // wheel max pos
@@ -66,6 +133,8 @@ strpair allcommands[] = {
     { CC_CMD_CAMDEVNO,     "camera device number" },
     { CC_CMD_CAMFLAGS,     "get camflags (bits: 0-start capture, 1-cancel, 2-restart server"},
     { CC_CMD_CAMLIST,      "list all connected cameras" },
+    { CC_CMD_CAMERAS,      "list of cameras served (N:model:shmkey); commands to camera N>0 are prefixed by `camN.`, "
+                           "their images are in SHM only (no image socket)" },
     { CC_CMD_CAMFANSPD,    "fan speed of camera" },
     { CC_CMD_CONFIO,       "camera IO configuration" },
     { CC_CMD_DARK,         "don't open shutter @ exposure" },
@@ -79,6 +148,7 @@ strpair allcommands[] = {
     { CC_CMD_FMINPOS,      "get minimal focuser position"},
     { CC_CMD_FGOTO,        "focuser position" },
     { CC_CMD_FTEMP,        "get focuser body temperature"},
+    { CC_CMD_AUTOFOCUS,    "run autofocus (start,end,step[,x0,y0,w,h]), stop it (stop) or get its state and focus curve"},
     { CC_CMD_FRAMEFORMAT,  "camera frame format (X0,Y0,X1,Y1)" },
     { CC_CMD_GAIN,         "camera gain" },
     //{ CC_CMD_GETHEADERS,   "get last file FITS headers" },
@@ -96,11 +166,14 @@ strpair allcommands[] = {
     //{ CC_CMD_OBJECT,       "FITS 'OBJECT' field" },
     //{ CC_CMD_OBJTYPE,      "FITS 'IMAGETYP' field" },
     //{ CC_CMD_OBSERVER,     "FITS 'OBSERVER' field" },
+    { CC_CMD_PLAN,         "run plan of series from given file (stop - cancel it) or get its state" },
     { CC_CMD_PLUGINCMD,    "custom camera plugin command" },
     //{ CC_CMD_PROGRAM,      "FITS 'PROG-ID' field" },
     { CC_CMD_RESTART,      "restart server" },
+    { CC_CMD_ROI,          "regions of interest (x0,y0,w,h;... or none) published in SHM segments with given keys" },
     { CC_CMD_SHMEMKEY,     "get shared memory key" },
     { CC_CMD_SHUTTER,      "camera shutter's operations" },
+    { CC_CMD_SOURCES,      "threshold of sources detection (sigma, 0 - off) or list of sources found on last image (x,y,flux,fwhm;...)" },
     { CC_CMD_CAMTEMPER,    "camera chip temperature" },
     { CC_CMD_TREMAIN,      "time (in seconds) of exposition remained" },
     { CC_CMD_VBIN,         "vertical binning" },
@@ -169,6 +242,26 @@ static void fixima(){
             WARNX(_("Can't init camera data"));
             LOGWARN("Can't init camera data");
         }
+        if(masters){
+            if(GP->calshmkey == 0) GP->calshmkey = GP->shmkey + 1;
+            calima = cc_getshm(GP->calshmkey, len);
+            if(!calima || !image_init_camdata(calima)){
+                WARNX(_("Can't allocate memory for calibrated image, calibration is off"));
+                LOGWARN("Can't allocate memory for calibrated image, calibration is off");
+                calib_free(&masters);
+                calima = NULL;
+            }else LOGMSG("Calibrated images are in SHM with key %d", GP->calshmkey);
+        }
+        if(coadd.N){
+            if(GP->coaddshmkey == 0) GP->coaddshmkey = GP->shmkey + 2;
+            coaddima = cc_getshm(GP->coaddshmkey, len);
+            if(!coaddima || !image_init_camdata(coaddima)){
+                WARNX(_("Can't allocate memory for co-added image, co-adding is off"));
+                LOGWARN("Can't allocate memory for co-added image, co-adding is off");
+                coadd_free(&coadd);
+                coaddima = NULL;
+            }else LOGMSG("Co-added images are in SHM with key %d", GP->coaddshmkey);
+        }
         // init shared semaphore
         cc_init_sem(TRUE);
     }
@@ -187,6 +280,7 @@ static void fixima(){
     if(ima->bitpix < 8 || ima->bitpix > 16) ima->bitpix = 16; // use maximum in any strange cases
     DBG("bitpix=%d", ima->bitpix);
     GP->_8bit = (ima->bitpix < 9) ? 1 : 0;
+    ima->bitpix = binnedbitpix(ima->bitpix);
     DBG("GP->_8bit=%d", GP->_8bit);
     ima->bytelen = raw_height * raw_width * cc_getNbytes(ima);
     DBG("new image: %dx%d", raw_width, raw_height);
@@ -196,12 +290,557 @@ static void fixima(){
     TIMESTAMP("All OK");
 }
 
+// detach and remove SHM segments of all ROIs; roimutex is locked
+static void freerois(){
+    for(int i = 0; i < nrois; ++i){
+        if(!rois[i].shm) continue;
+        shmdt(rois[i].shm);
+        int id = shmget(rois[i].key, 0, 0);
+        if(id > -1) shmctl(id, IPC_RMID, NULL);
+        rois[i].shm = NULL;
+    }
+    nrois = 0;
+}
+
+/**
+ * @brief setrois - change list of ROIs
+ * @param list - ROIs "x0,y0,w,h" divided by ';' (NULL, "" or "none" to clear list)
+ * @return FALSE if list is wrong (old list isn't changed) or can't allocate SHM
+ */
+static int setrois(const char *list){
+    roi_t newrois[MAX_ROI];
+    int n = 0;
+    if(list && *list && strcmp(list, "none")){
+        const char *p = list;
+        while(p && *p){
+            if(n == MAX_ROI) return FALSE;
+            cc_frameformat *f = &newrois[n].f;
+            if(4 != sscanf(p, "%d,%d,%d,%d", &f->xoff, &f->yoff, &f->w, &f->h)) return FALSE;
+            if(f->xoff < 0 || f->yoff < 0 || f->w < 1 || f->h < 1) return FALSE;
+            ++n;
+            if((p = strchr(p, ';'))) ++p;
+        }
+    }
+    if(GP->roishmkey == 0) GP->roishmkey = GP->shmkey + 10;
+    pthread_mutex_lock(&roimutex);
+    freerois();
+    int ret = TRUE;
+    for(int i = 0; i < n; ++i){
+        rois[i].f = newrois[i].f;
+        rois[i].key = GP->roishmkey + i;
+        rois[i].shm = cc_getshm(rois[i].key, (size_t)rois[i].f.w * rois[i].f.h * 2);
+        if(!rois[i].shm){
+            LOGERR("Can't allocate SHM for ROI %d", i);
+            ret = FALSE;
+            break;
+        }
+        ++nrois;
+        LOGMSG("ROI %d: (%d, %d) %dx%d, SHM key %d", i, rois[i].f.xoff, rois[i].f.yoff,
+               rois[i].f.w, rois[i].f.h, rois[i].key);
+    }
+    pthread_mutex_unlock(&roimutex);
+    return ret;
+}
+
+/**
+ * @brief setsources - change threshold of sources detection
+ * @param nsigma - threshold (in background RMS), 0 to stop detection
+ * @return FALSE if `nsigma` is wrong or can't allocate SHM for table
+ */
+static int setsources(double nsigma){
+    if(nsigma < 0. || nsigma > 1e4) return FALSE;
+    pthread_mutex_lock(&srcmutex);
+    if(nsigma > 0. && !srctable){
+        if(GP->srcshmkey == 0) GP->srcshmkey = GP->shmkey + 3;
+        srctable = sources_getshm(GP->srcshmkey, TRUE);
+        if(srctable) LOGMSG("Table of sources is in SHM with key %d", GP->srcshmkey);
+        else LOGERR("Can't allocate SHM for table of sources");
+    }
+    int ret = (nsigma == 0. || srctable) ? TRUE : FALSE;
+    if(ret) srcnsigma = nsigma;
+    pthread_mutex_unlock(&srcmutex);
+    return ret;
+}
+
+// find sources on `img` and publish them; SHM is unlocked (only camera thread changes images)
+// @return FALSE if detection is off or failed
+static int publishsources(cc_IMG *img){
+    static sourcetable T;
+    pthread_mutex_lock(&srcmutex);
+    double nsigma = srcnsigma;
+    pthread_mutex_unlock(&srcmutex);
+    if(nsigma <= 0. || !findsources(img, nsigma, SOURCES_MINPIX, &T)) return FALSE;
+    size_t len = offsetof(sourcetable, sources) + T.nsources * sizeof(source_t);
+    pthread_mutex_lock(&srcmutex);
+    cc_lock_shm(TRUE);
+    memcpy(srctable, &T, len);
+    cc_unlock_shm();
+    pthread_mutex_unlock(&srcmutex);
+    return TRUE;
+}
+
+// cut all ROIs from `img` into their SHM segments; SHM is locked
+static void publishrois(cc_IMG *img){
+    pthread_mutex_lock(&roimutex);
+    for(int i = 0; i < nrois; ++i){
+        cc_IMG *r = rois[i].shm;
+        cc_frameformat *f = &rois[i].f;
+        copyfields(r, img);
+        if(!cropimage(img, r, f->xoff, f->yoff, f->w, f->h)){ // ROI is out of image
+            r->w = r->h = 0;
+            r->bytelen = 0;
+            continue;
+        }
+        // absolute position of ROI on sensor
+        r->geometry.xoff = img->geometry.xoff + f->xoff * img->bin_x;
+        r->geometry.yoff = img->geometry.yoff + f->yoff * img->bin_y;
+        r->geometry.w = r->w * img->bin_x;
+        r->geometry.h = r->h * img->bin_y;
+        r->gotstat = 0;
+    }
+    pthread_mutex_unlock(&roimutex);
+}
+
+// autofocus or plan is running
+static int jobrunning(){
+    return (afstate == JOB_RUNNING || plstate == JOB_RUNNING) ? TRUE : FALSE;
+}
+
+/**
+ * @brief waitframe - wait for next frame captured by camera thread
+ * @param imno   - number of previous frame
+ * @param cancel - flag of job cancelling
+ * @return FALSE if cancelled, timed out or camera failed
+ */
+static int waitframe(size_t imno, atomic_int *cancel){
+    double t0 = sl_dtime(), tmout = GP->exptime + FRAME_TMOUT;
+    while(!ima || ima->imnumber == imno){
+        if(*cancel || camstate == CAMERA_ERROR) return FALSE;
+        if(sl_dtime() - t0 > tmout){
+            LOGERR("Timeout waiting for frame");
+            return FALSE;
+        }
+        usleep(1000);
+    }
+    return TRUE;
+}
+
+/**
+ * @brief lockshm - lock SHM from thread other than camera one: wait while camera thread processes frame,
+ *        but never force unlocking
+ * @param cancel - flag of job cancelling
+ * @return FALSE if cancelled or timed out
+ */
+static int lockshm(atomic_int *cancel){
+    double t0 = sl_dtime();
+    while(!cc_lock_shm(FALSE)){
+        if(*cancel) return FALSE;
+        if(sl_dtime() - t0 > FRAME_TMOUT){
+            LOGERR("Timeout waiting for SHM lock");
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+/**
+ * @brief queuemove - queue move of wheel (wpos > -1) and/or focuser (fpos isn't NAN) till the end of exposition
+ * @param force - queue even if camera doesn't capture now (exposition is going to start)
+ * @return FALSE if exposition is over or not started (move should be done synchronously)
+ */
+static int queuemove(int wpos, float fpos, int force){
+    pthread_mutex_lock(&movemutex);
+    int ret = (capturing || force) ? TRUE : FALSE;
+    if(ret){
+        if(wpos > -1) pendmove.wheel = wpos;
+        if(!isnan(fpos)) pendmove.focus = fpos;
+    }
+    pthread_mutex_unlock(&movemutex);
+    if(ret) LOGMSG("Queued move: wheel=%d, focuser=%g", wpos, fpos);
+    return ret;
+}
+
+// drop moves queued but not started yet; return TRUE if there were some
+static int dropmoves(){
+    pthread_mutex_lock(&movemutex);
+    int ret = (pendmove.wheel > -1 || !isnan(pendmove.focus)) ? TRUE : FALSE;
+    pendmove.wheel = -1; pendmove.focus = NAN;
+    pthread_mutex_unlock(&movemutex);
+    return ret;
+}
+
+// move focuser to `pos` (minimal position by homing)
+static int focgoto(int async, float pos){
+    if(pos - focminpos < __FLT_EPSILON__) return focuser->home(async);
+    return focuser->setAbsPos(async, pos);
+}
+
+// run moves from `runmove`; `d` != NULL if caller already locked `locmutex`
+static void *moverthread(void *d){
+    double t0 = sl_dtime();
+    if(!d) while(!lock()) usleep(1000); // don't call plugins simultaneously with command handlers
+    if(runmove.wheel > -1 && !wheel->setPos(runmove.wheel)){
+        LOGERR("Can't move wheel to %d", runmove.wheel);
+        moveerr = 1;
+    }
+    if(!isnan(runmove.focus) && !focgoto(0, runmove.focus)){
+        LOGERR("Can't move focuser to %g", runmove.focus);
+        moveerr = 1;
+    }
+    if(!d) unlock();
+    LOGDBG("Queued moves done in %.2fs", sl_dtime() - t0);
+    moving = 0;
+    return NULL;
+}
+
+// mark that exposition starts: moves given since now will be queued till its end
+static void capturestarts(){
+    pthread_mutex_lock(&movemutex);
+    capturing = TRUE;
+    pthread_mutex_unlock(&movemutex);
+}
+
+/**
+ * @brief startmoves - start queued moves (called by camera thread when exposition ends)
+ * @param img - image to fill wheel and focuser fields by their positions before moving
+ * @param locked - caller have locked `locmutex`
+ * @return TRUE if there was queued moves (and `img` have device fields filled)
+ */
+static int startmoves(cc_IMG *img, int locked){
+    pthread_mutex_lock(&movemutex);
+    capturing = FALSE;
+    runmove = pendmove;
+    pendmove.wheel = -1; pendmove.focus = NAN;
+    int ret = (runmove.wheel > -1 || !isnan(runmove.focus)) ? TRUE : FALSE;
+    if(ret){
+        moving = 1;
+        moveerr = 0;
+    }
+    pthread_mutex_unlock(&movemutex);
+    if(!ret) return FALSE;
+    if(img) fill_device_fields(img);
+    pthread_t thread;
+    if(pthread_create(&thread, NULL, moverthread, NULL) || pthread_detach(thread)){
+        LOGWARN("Can't run mover thread, move synchronously");
+        moverthread(locked ? (void*)1 : NULL);
+    }
+    return TRUE;
+}
+
+// wait while queued moves are running
+static void waitmoves(){
+    while(moving) usleep(1000);
+}
+
+// move focuser synchronously
+static int afgoto(float pos){
+    waitmoves();
+    while(!lock()) usleep(1000);
+    int r = focgoto(0, pos);
+    unlock();
+    if(!r) LOGERR("Autofocus: can't move focuser to %g", pos);
+    return r;
+}
+
+/**
+ * @brief afmeasure - capture next frame and find stars on it (or on its part `af.roi`)
+ * @param img - local buffer for image
+ * @param T   (o) - table of sources
+ * @return FALSE if cancelled, timed out or failed
+ */
+static int afmeasure(cc_IMG *img, sourcetable *T){
+    size_t imno = ima ? ima->imnumber : 0;
+    camflags |= FLAG_STARTCAPTURE;
+    if(!waitframe(imno, &afcancel)) return FALSE;
+    if(!lockshm(&afcancel)) return FALSE; // wait while frame processing ends
+    cc_IMG *in = (calima && calima->imnumber == ima->imnumber) ? calima : ima;
+    copyfields(img, in);
+    int r = (af.roi.w > 0) ? cropimage(in, img, af.roi.xoff, af.roi.yoff, af.roi.w, af.roi.h) :
+                             cropimage(in, img, 0, 0, in->w, in->h);
+    cc_unlock_shm();
+    if(!r){
+        LOGERR("Autofocus: can't get image");
+        return FALSE;
+    }
+    pthread_mutex_lock(&srcmutex);
+    double nsigma = (srcnsigma > 0.) ? srcnsigma : SOURCES_NSIGMA;
+    pthread_mutex_unlock(&srcmutex);
+    return findsources(img, nsigma, SOURCES_MINPIX, T);
+}
+
+// autofocus thread: measure star sizes over focuser positions, fit V-curve and move to best focus
+static void *afthread(_U_ void *d){
+    static sourcetable T;
+    cc_IMG img = {0};
+    img.datasize = (size_t)camera->array.w * camera->array.h * 2;
+    img.data = malloc(img.datasize);
+    int ok = (img.data) ? TRUE : FALSE;
+    float initpos = af.start;
+    while(!lock()) usleep(1000);
+    if(!focuser->getPos(&initpos)) initpos = af.start;
+    unlock();
+    LOGMSG("Autofocus started: %d points from %g with step %g", af.npoints, af.start, af.step);
+    for(int i = 0; ok && i < af.npoints && !afcancel; ++i){
+        float pos = af.start + i * af.step;
+        if(!(ok = afgoto(pos))) break;
+        if(!(ok = afmeasure(&img, &T))) break;
+        int nstars;
+        float fwhm = focus_starsize(&T, &nstars);
+        pthread_mutex_lock(&afmutex);
+        af.curve.pos[i] = pos;
+        af.curve.fwhm[i] = fwhm;
+        af.curve.nstars[i] = nstars;
+        af.curve.npoints = i + 1;
+        pthread_mutex_unlock(&afmutex);
+        LOGMSG("Autofocus: pos=%g, FWHM=%.2f (%d stars)", pos, fwhm, nstars);
+    }
+    FREE(img.data);
+    double best, minfwhm;
+    pthread_mutex_lock(&afmutex);
+    if(ok && !afcancel) ok = focus_fit(&af.curve, &best, &minfwhm);
+    pthread_mutex_unlock(&afmutex);
+    if(ok && !afcancel){
+        // approach best position in direction of scan to exclude backlash
+        ok = afgoto(af.start) && afgoto(best);
+        if(ok){
+            pthread_mutex_lock(&afmutex);
+            af.best = best; af.minfwhm = minfwhm;
+            pthread_mutex_unlock(&afmutex);
+            LOGMSG("Autofocus: best focus at %g, FWHM=%.2f", best, minfwhm);
+        }
+    }else{
+        LOGWARN("Autofocus failed or cancelled, return focuser to %g", initpos);
+        afgoto(initpos);
+    }
+    afstate = (ok && !afcancel) ? JOB_DONE : JOB_FAILED;
+    return NULL;
+}
+
+/**
+ * @brief startaf - start autofocus thread
+ * @param par - "start,end,step[,x0,y0,w,h]": range of focuser positions and optional part of image
+ * @return CC_RESULT_OK if started
+ */
+static cc_hresult startaf(const char *par){
+    float start, end, step;
+    cc_frameformat roi = {0};
+    int n = sscanf(par, "%f,%f,%f,%d,%d,%d,%d", &start, &end, &step, &roi.xoff, &roi.yoff, &roi.w, &roi.h);
+    if(n != 3 && n != 7) return CC_RESULT_BADVAL;
+    if(n == 7 && (roi.xoff < 0 || roi.yoff < 0 || roi.w < 1 || roi.h < 1)) return CC_RESULT_BADVAL;
+    if(start < focminpos || start > focmaxpos || end < focminpos || end > focmaxpos) return CC_RESULT_BADVAL;
+    if(step <= 0.f) return CC_RESULT_BADVAL;
+    int npoints = (int)(fabsf(end - start) / step + 1.001f);
+    if(npoints < 3 || npoints > FOCUS_MAXPOINTS) return CC_RESULT_BADVAL;
+    if(GP->exptime < 1e-9) return CC_RESULT_FAIL; // need exposition time to be set
+    if(jobrunning() || camstate == CAMERA_CAPTURE) return CC_RESULT_BUSY;
+    pthread_mutex_lock(&afmutex);
+    bzero(&af, sizeof(af));
+    af.start = start;
+    af.step = (end < start) ? -step : step;
+    af.npoints = npoints;
+    af.roi = roi;
+    pthread_mutex_unlock(&afmutex);
+    afcancel = 0;
+    afstate = JOB_RUNNING;
+    pthread_t thread;
+    if(pthread_create(&thread, NULL, afthread, NULL) || pthread_detach(thread)){
+        LOGERR("Can't run autofocus thread");
+        afstate = JOB_FAILED;
+        return CC_RESULT_FAIL;
+    }
+    return CC_RESULT_OK;
+}
+
+// set camera parameters and output prefix of plan step; camera is idle
+static int planconf(const planstep *s){
+    int ret = FALSE;
+    while(!lock()) usleep(1000);
+    if(!camera->setexp || !camera->setexp(s->exptime)){
+        LOGERR("Plan: can't set exposition time to %g", s->exptime);
+        goto rtn;
+    }
+    GP->exptime = s->exptime;
+    if(s->hbin){
+        GP->hbin = s->hbin; GP->vbin = s->vbin;
+        if(!setbinning(GP->hbin, GP->vbin)){
+            LOGERR("Plan: can't set binning %dx%d", s->hbin, s->vbin);
+            goto rtn;
+        }
+        getbinning(&GP->hbin, &GP->vbin);
+    }
+    if(s->frame.w){
+        cc_frameformat f = s->frame;
+        if(!camera->setgeometry || !camera->setgeometry(&f)){
+            LOGERR("Plan: can't set frame format");
+            goto rtn;
+        }
+        curformat = camera->geometry;
+    }
+    if(s->dark > -1){
+        if(!camera->setframetype || !camera->setframetype(!s->dark)){
+            LOGERR("Plan: can't set frame type");
+            goto rtn;
+        }
+        GP->dark = s->dark;
+    }
+    if(s->prefix) GP->outfileprefix = s->prefix;
+    ret = TRUE;
+rtn:
+    unlock();
+    return ret;
+}
+
+// focuser position of plan step (NAN if not pointed)
+static float planfocus(const planstep *s){
+    return isnan(s->focus) ? pl.focstart + s->focoffset : s->focus;
+}
+
+// move wheel and focuser to positions of plan step `n` if they differ from previous step
+static int planmove(int n){
+    const planstep *s = &pl.plan.steps[n], *prev = n ? s - 1 : NULL;
+    float pos = planfocus(s);
+    int ret = TRUE;
+    waitmoves();
+    while(!lock()) usleep(1000);
+    if(s->wheel > -1 && (!prev || prev->wheel != s->wheel) && !wheel->setPos(s->wheel)){
+        LOGERR("Plan: can't move wheel to %d", s->wheel);
+        ret = FALSE;
+    }
+    if(ret && !isnan(pos) && (!prev || pos != planfocus(prev)) && !focgoto(0, pos)){
+        LOGERR("Plan: can't move focuser to %g", pos);
+        ret = FALSE;
+    }
+    unlock();
+    return ret;
+}
+
+// queue moves of plan step `n` (if its positions differ from previous step) till the end of current exposition
+static void planqueue(int n){
+    const planstep *s = &pl.plan.steps[n], *prev = s - 1;
+    float pos = planfocus(s);
+    queuemove((s->wheel != prev->wheel) ? s->wheel : -1, (pos != planfocus(prev)) ? pos : NAN, TRUE);
+}
+
+// plan thread: run series of all steps, saving frames by server
+static void *planthread(_U_ void *d){
+    plan_t *P = &pl.plan;
+    char *oldprefix = GP->outfileprefix, *oldoutfile = GP->outfile;
+    GP->outfile = NULL; // each frame is saved into new file
+    cc_IMG *img = NULL;
+    int ok = TRUE;
+    LOGMSG("Plan started: %d steps", P->nsteps);
+    for(int s = 0; ok && s < P->nsteps && !plcancel; ++s){
+        const planstep *st = &P->steps[s];
+        double tstep = sl_dtime(), texp = 0.;
+        if(s == 0) ok = planmove(0);
+        else if(dropmoves()) ok = planmove(s); // queued moves weren't started: move now
+        else{ // moves were queued at last exposition of previous step
+            waitmoves();
+            ok = !moveerr;
+        }
+        if(!ok || !(ok = planconf(st))) break;
+        // moves of next step will start just after the last exposition of this step,
+        // so they are queued before it starts
+        int queuenext = (s < P->nsteps - 1);
+        size_t imno = ima ? ima->imnumber : 0;
+        if(queuenext && st->nframes == 1) planqueue(s + 1);
+        camflags |= FLAG_STARTCAPTURE;
+        for(int f = 0; f < st->nframes; ++f){
+            pthread_mutex_lock(&plmutex);
+            pl.step = s; pl.frame = f;
+            pthread_mutex_unlock(&plmutex);
+            if(!(ok = waitframe(imno, &plcancel))) break;
+            if(!(ok = lockshm(&plcancel))) break;
+            imno = ima->imnumber;
+            if(!img) img = cc_newimage(cc_getNbytes(ima) * 8, ima->w, ima->h);
+            ok = (img && cc_copyimage(img, ima, FALSE)) ? TRUE : FALSE;
+            cc_unlock_shm();
+            if(!ok) break;
+            // readout is over: start next exposition while this frame is being saved
+            if(f < st->nframes - 1){
+                if(queuenext && f == st->nframes - 2) planqueue(s + 1);
+                camflags |= FLAG_STARTCAPTURE;
+            }
+            if(!(ok = saveFITS(img, NULL))) break;
+            texp += st->exptime;
+            pthread_mutex_lock(&plmutex);
+            pl.exptime += st->exptime;
+            pthread_mutex_unlock(&plmutex);
+        }
+        closeFITSseries();
+        double dt = sl_dtime() - tstep;
+        LOGMSG("Plan step %d: %g s of exposition in %.1f s, efficiency %.0f%%", s, texp, dt, 100. * texp / dt);
+    }
+    if(!ok || plcancel){ // stop started exposition and don't run moves of next step
+        dropmoves();
+        camflags |= FLAG_CANCEL;
+    }
+    cc_freeimage(&img);
+    GP->outfileprefix = oldprefix;
+    GP->outfile = oldoutfile;
+    pthread_mutex_lock(&plmutex);
+    pl.tend = sl_dtime();
+    double dt = pl.tend - pl.tstart;
+    LOGMSG("Plan %s: %g s of exposition in %.1f s, efficiency %.0f%%", (ok && !plcancel) ? "done" : "failed",
+           pl.exptime, dt, 100. * pl.exptime / dt);
+    pthread_mutex_unlock(&plmutex);
+    plstate = (ok && !plcancel) ? JOB_DONE : JOB_FAILED;
+    return NULL;
+}
+
+/**
+ * @brief startplan - read plan file and run it in separate thread
+ * @param fnam - plan file name
+ * @return CC_RESULT_OK if started
+ */
+static cc_hresult startplan(const char *fnam){
+    if(jobrunning() || camstate == CAMERA_CAPTURE) return CC_RESULT_BUSY;
+    plan_t P;
+    if(!plan_read(fnam, &P)){
+        LOGERR("Wrong plan file %s", fnam);
+        return CC_RESULT_BADVAL;
+    }
+    float focstart = 0.f;
+    if(focuser) focuser->getPos(&focstart);
+    for(int i = 0; i < P.nsteps; ++i){ // check parameters of all steps before start
+        planstep *s = &P.steps[i];
+        float pos = isnan(s->focus) ? focstart + s->focoffset : s->focus;
+        if((!s->prefix && !GP->outfileprefix) || (s->wheel > -1 && (!wheel || s->wheel >= wmaxpos)) ||
+            (!isnan(pos) && (!focuser || pos < focminpos || pos > focmaxpos))){
+            LOGERR("Plan %s: wrong step %d", fnam, i);
+            plan_free(&P);
+            return CC_RESULT_BADVAL;
+        }
+    }
+    if(infty){ // its expositions would be taken as frames of plan
+        LOGMSG("Stop infinity loop to run plan");
+        infty = 0;
+    }
+    pthread_mutex_lock(&plmutex);
+    plan_free(&pl.plan);
+    bzero(&pl, sizeof(pl));
+    pl.plan = P;
+    pl.focstart = focstart;
+    pl.tstart = sl_dtime();
+    pthread_mutex_unlock(&plmutex);
+    plcancel = 0;
+    plstate = JOB_RUNNING;
+    pthread_t thread;
+    if(pthread_create(&thread, NULL, planthread, NULL) || pthread_detach(thread)){
+        LOGERR("Can't run plan thread");
+        plstate = JOB_FAILED;
+        return CC_RESULT_FAIL;
+    }
+    return CC_RESULT_OK;
+}
+
 // functions for processCAM finite state machine
 static inline void cameraidlestate(){ // idle - wait for capture commands
     static double Tcheck = 0.;
-    if(camflags & FLAG_STARTCAPTURE){ // start capturing
+    if((camflags & FLAG_STARTCAPTURE) && !moving){ // start capturing when queued moves are done
         TIMESTAMP("Start exposition");
         camflags &= ~(FLAG_STARTCAPTURE | FLAG_CANCEL);
+        capturestarts(); // before state change: handlers seeing CAPTURE state should queue moves
         camstate = CAMERA_CAPTURE;
         fixima();
         if(!camera->startexposition){
@@ -217,6 +856,7 @@ static inline void cameraidlestate(){ // idle - wait for capture commands
     }
     if(camstate == CAMERA_ERROR || (camstate == CAMERA_IDLE && sl_dtime() - Tcheck > 5.)){
         Tcheck = sl_dtime();
+        if(camstate == CAMERA_ERROR) startmoves(NULL, FALSE); // exposition failed: run moves queued for its end
         if(!camera->check()){
             LOGERR("Camera disconnected");
             ERRX(_("Camera disconnected"));
@@ -252,17 +892,38 @@ static inline void cameracapturestate(){ // capturing - wait for exposition ends
                 }
                 cc_lock_shm(TRUE);
                 LOGDBG("cameracapturestate(): SHM locked");
-                if(!camera->capture(ima)){
+                // exposition is over: run queued moves during readout
+                int moved = startmoves(ima, FALSE);
+                if(!capturebinned(ima)){
                     LOGERR("Can't capture image");
                     camstate = CAMERA_ERROR;
                     return;
                 }
-                fill_image_fields(ima);
+                if(moved) fill_camera_fields(camera, ima); // positions of devices are filled before moving
+                else fill_image_fields(ima);
                 LOGDBG("Captured new image %zdx%zd pix", ima->w, ima->h);
                 ++ima->imnumber; // increment counter
+                // calibrated frame goes into second SHM segment under the same semaphore
+                int calibrated = FALSE;
+                if(calima){
+                    calibrated = calib_apply(masters, ima, calima);
+                    TIMESTAMP("Calibrated");
+                }
+                // co-add calibrated frames if possible
+                if(coaddima){
+                    coadd_add(&coadd, calibrated ? calima : ima, coaddima);
+                    TIMESTAMP("Co-added");
+                }
+                if(nrois){
+                    publishrois(calibrated ? calima : ima);
+                    TIMESTAMP("ROIs published");
+                }
                 cc_unlock_shm();
                 LOGDBG("cameracapturestate(): SHM UNlocked");
                 TIMESTAMP("Captured and unlocked");
+                if(publishsources(calibrated ? calima : ima)){
+                    TIMESTAMP("Sources found");
+                }
             }
             camstate = CAMERA_FRAMERDY;
         }
@@ -312,6 +973,7 @@ static void* processCAM(_U_ void *d){
                 LOGMSG("User canceled exposition");
                 camflags &= ~(FLAG_STARTCAPTURE | FLAG_CANCEL);
                 if(camera->cancel) camera->cancel();
+                startmoves(NULL, TRUE);
                 camstate = CAMERA_IDLE;
                 infty = 0; // also cancel infinity loop
                 unlock();
@@ -356,7 +1018,7 @@ static int camdevini(int n){
     if(GP->hbin < 1) GP->hbin = 1;
     if(GP->vbin < 1) GP->vbin = 1;
     fixima();
-    if(!camera->setbin || !camera->setbin(GP->hbin, GP->vbin)) WARNX(_("Can't set binning %dx%d"), GP->hbin, GP->vbin);
+    if(!setbinning(GP->hbin, GP->vbin)) WARNX(_("Can't set binning %dx%d"), GP->hbin, GP->vbin);
     if(!camera->setgeometry || !camera->setgeometry(&curformat)){
         WARNX(_("Can't set given geometry"));
     }else curformat = camera->geometry;
@@ -433,13 +1095,11 @@ static cc_hresult binhandler(_U_ int fd, const char *key, const char *val){
         if(b < 1) return CC_RESULT_BADVAL;
         if(0 == strcmp(key, CC_CMD_HBIN)) GP->hbin = b;
         else GP->vbin = b;
-        if(!camera->setbin) return CC_RESULT_FAIL;
-        if(!camera->setbin(GP->hbin, GP->vbin)){
+        if(!setbinning(GP->hbin, GP->vbin)){
             return CC_RESULT_BADVAL;
         }
     }
-    if(!camera->getbin) return CC_RESULT_SILENCE;
-    int r = camera->getbin(&GP->hbin, &GP->vbin);
+    int r = getbinning(&GP->hbin, &GP->vbin);
     if(r){
         if(0 == strcmp(key, CC_CMD_HBIN)) snprintf(buf, 63, "%s=%d", key, GP->hbin);
         else snprintf(buf, 63, "%s=%d", key, GP->vbin);
@@ -796,6 +1456,9 @@ static cc_hresult wgotohandler(_U_ int fd, _U_ const char *key, _U_ const char *
     if(val){
         pos = atoi(val);
         DBG("USER wants to %d", pos);
+        if(pos < 0 || pos >= wmaxpos) return CC_RESULT_BADVAL;
+        if(queuemove(pos, NAN, FALSE)) return CC_RESULT_OK; // move when exposition ends
+        if(moving) return CC_RESULT_BUSY; // exposition just ended: queued moves are running
         int r = wheel->setPos(pos);
         DBG("wheel->setPos(%d)", pos);
         if(!r) return CC_RESULT_BADVAL;
@@ -868,12 +1531,9 @@ static cc_hresult fgotohandler(int fd, _U_ const char *key, const char *val){
     if(val){
         f = atof(val);
         if(f < focminpos || f > focmaxpos) return CC_RESULT_BADVAL;
-        if(f - focminpos < __FLT_EPSILON__){
-            r = focuser->home(1);
-        }else{
-            r = focuser->setAbsPos(1, f);
-        }
-        if(!r) return CC_RESULT_FAIL;
+        if(queuemove(-1, f, FALSE)) return CC_RESULT_OK; // move when exposition ends
+        if(moving) return CC_RESULT_BUSY; // exposition just ended: queued moves are running
+        if(!focgoto(1, f)) return CC_RESULT_FAIL;
     }
     r = focuser->getPos(&f);
     if(!r) return CC_RESULT_FAIL;
@@ -907,11 +1567,101 @@ static cc_hresult shmemkeyhandler(int fd, _U_ const char *key, _U_ const char *v
     return CC_RESULT_SILENCE;
 }
 
+// regions of interest: `roi=x0,y0,w,h;...` (in image pixels), answer `roi=x0,y0,w,h:shmkey;...`
+static cc_hresult roihandler(int fd, _U_ const char *key, const char *val){
+    char buf[BUFSIZ];
+    if(val && !setrois(val)) return CC_RESULT_BADVAL;
+    int l = snprintf(buf, BUFSIZ, CC_CMD_ROI "=");
+    pthread_mutex_lock(&roimutex);
+    if(nrois == 0) l += snprintf(buf + l, BUFSIZ - l, "none");
+    for(int i = 0; i < nrois && l < BUFSIZ; ++i)
+        l += snprintf(buf + l, BUFSIZ - l, "%s%d,%d,%d,%d:%d", i ? ";" : "", rois[i].f.xoff, rois[i].f.yoff,
+                      rois[i].f.w, rois[i].f.h, rois[i].key);
+    pthread_mutex_unlock(&roimutex);
+    if(!cc_sendstrmessage(fd, buf)) return CC_RESULT_DISCONNECTED;
+    return CC_RESULT_SILENCE;
+}
+
+// sources detection: `sources=nsigma` (0 - off), answer `sources=N;x,y,flux,fwhm;...` for last image
+static cc_hresult sourceshandler(int fd, _U_ const char *key, const char *val){
+    char buf[BUFSIZ];
+    if(val){
+        char *eptr;
+        double n = strtod(val, &eptr);
+        if(eptr == val || *eptr || !setsources(n)) return CC_RESULT_BADVAL;
+    }
+    pthread_mutex_lock(&srcmutex);
+    if(srcnsigma <= 0. || !srctable) snprintf(buf, BUFSIZ, CC_CMD_SOURCES "=off");
+    else{
+        int l = snprintf(buf, BUFSIZ, CC_CMD_SOURCES "=%d", srctable->nsources);
+        for(int i = 0; i < srctable->nsources && l < BUFSIZ; ++i){
+            source_t *s = &srctable->sources[i];
+            l += snprintf(buf + l, BUFSIZ - l, ";%.2f,%.2f,%.0f,%.2f", s->x, s->y, s->flux, s->fwhm);
+        }
+    }
+    pthread_mutex_unlock(&srcmutex);
+    if(!cc_sendstrmessage(fd, buf)) return CC_RESULT_DISCONNECTED;
+    return CC_RESULT_SILENCE;
+}
+
+// autofocus: `autofocus=start,end,step[,x0,y0,w,h]` to run, `autofocus=stop` to cancel;
+// answer `autofocus=state[,best,fwhm];pos,fwhm;...`
+static cc_hresult afhandler(int fd, _U_ const char *key, const char *val){
+    char buf[BUFSIZ];
+    if(val){
+        if(strcmp(val, "stop") == 0) afcancel = 1;
+        else{
+            cc_hresult r = startaf(val);
+            if(r != CC_RESULT_OK) return r;
+        }
+    }
+    job_state s = afstate;
+    pthread_mutex_lock(&afmutex);
+    int l = snprintf(buf, BUFSIZ, CC_CMD_AUTOFOCUS "=%s", jobstates[s]);
+    if(s == JOB_DONE) l += snprintf(buf + l, BUFSIZ - l, ",%.4f,%.2f", af.best, af.minfwhm);
+    for(int i = 0; i < af.curve.npoints && l < BUFSIZ; ++i)
+        l += snprintf(buf + l, BUFSIZ - l, ";%.4f,%.2f", af.curve.pos[i], af.curve.fwhm[i]);
+    pthread_mutex_unlock(&afmutex);
+    if(!cc_sendstrmessage(fd, buf)) return CC_RESULT_DISCONNECTED;
+    return CC_RESULT_SILENCE;
+}
+
+// plan of series: `plan=file` to run, `plan=stop` to cancel; answer `plan=state;step=N/M;frame=N/M;exptime=T;elapsed=T`
+static cc_hresult planhandler(int fd, _U_ const char *key, const char *val){
+    char buf[256];
+    if(val){
+        if(strcmp(val, "stop") == 0) plcancel = 1;
+        else{
+            cc_hresult r = startplan(val);
+            if(r != CC_RESULT_OK) return r;
+        }
+    }
+    job_state s = plstate;
+    pthread_mutex_lock(&plmutex);
+    if(pl.plan.nsteps == 0) snprintf(buf, 255, CC_CMD_PLAN "=%s", jobstates[s]);
+    else snprintf(buf, 255, CC_CMD_PLAN "=%s;step=%d/%d;frame=%d/%d;exptime=%.1f;elapsed=%.1f", jobstates[s],
+                  pl.step + 1, pl.plan.nsteps, pl.frame + 1, pl.plan.steps[pl.step].nframes, pl.exptime,
+                  ((s == JOB_RUNNING) ? sl_dtime() : pl.tend) - pl.tstart);
+    pthread_mutex_unlock(&plmutex);
+    if(!cc_sendstrmessage(fd, buf)) return CC_RESULT_DISCONNECTED;
+    return CC_RESULT_SILENCE;
+}
+
+// cameras served by this server (except main)
+static cc_hresult camerashandler(int fd, _U_ const char *key, _U_ const char *val){
+    char buf[BUFSIZ];
+    int l = snprintf(buf, BUFSIZ, CC_CMD_CAMERAS "=");
+    multicam_list(buf + l, BUFSIZ - l);
+    if(!cc_sendstrmessage(fd, buf)) return CC_RESULT_DISCONNECTED;
+    return CC_RESULT_SILENCE;
+}
+
 // infinity loop
 static cc_hresult inftyhandler(int fd, _U_ const char *key, const char *val){
     char buf[64];
     if(val){
         int i = atoi(val);
+        if(i && jobrunning()) return CC_RESULT_BUSY; // plan or autofocus makes its own expositions
         infty = (i) ? 1 : 0;
         if(!infty) camflags |= FLAG_CANCEL;
     }
@@ -970,13 +1720,20 @@ static cc_hresult chkcc(_U_ char *val){ // just check that camera connected
     if(camera) return CC_RESULT_OK;
     return CC_RESULT_FAIL;
 }
+// wheel and focuser: moves during capture are queued; no access while queued moves are running
 static cc_hresult chkwhl(char *val){
-    if(val && CAMbusy()) return CC_RESULT_BUSY;
+    if(moving) return CC_RESULT_BUSY;
+    if(val && ((CAMbusy() && camstate != CAMERA_CAPTURE) || plstate == JOB_RUNNING)) return CC_RESULT_BUSY;
     if(wheel) return CC_RESULT_OK;
     return CC_RESULT_FAIL;
 }
+static cc_hresult chkaf(_U_ char *val){ // autofocus needs both camera and focuser
+    if(camera && focuser) return CC_RESULT_OK;
+    return CC_RESULT_FAIL;
+}
 static cc_hresult chkfoc(char *val){
-    if(val && CAMbusy()) return CC_RESULT_BUSY;
+    if(moving) return CC_RESULT_BUSY;
+    if(val && ((CAMbusy() && camstate != CAMERA_CAPTURE) || jobrunning())) return CC_RESULT_BUSY;
     if(focuser) return CC_RESULT_OK;
     return CC_RESULT_FAIL;
 }
@@ -1002,12 +1759,16 @@ static cc_handleritem items[] = {
     {chkcc,  nflusheshandler, CC_CMD_NFLUSHES},
     {NULL,   expstatehandler, CC_CMD_EXPSTATE},
     {chktrue,shmemkeyhandler, CC_CMD_SHMEMKEY},
+    {chkcc,  roihandler, CC_CMD_ROI},
+    {chkcc,  sourceshandler, CC_CMD_SOURCES},
     {chktrue,imsizehandler, CC_CMD_IMWIDTH},
     {chktrue,imsizehandler, CC_CMD_IMHEIGHT},
     {chkcc,  _8bithandler, CC_CMD_8BIT},
     {chkcc,  fastspdhandler, CC_CMD_FASTSPD},
     {chkcc,  darkhandler, CC_CMD_DARK},
     {chkcc,  inftyhandler, CC_CMD_INFTY},
+    {chkcc,  planhandler, CC_CMD_PLAN},
+    {NULL,   camerashandler, CC_CMD_CAMERAS},
     {chkcc,  pluginhandler, CC_CMD_PLUGINCMD},
     {NULL,   tremainhandler, CC_CMD_TREMAIN},
 #if 0
@@ -1025,6 +1786,7 @@ static cc_handleritem items[] = {
     {chkfoc, fminposhandler, CC_CMD_FMINPOS},
     {chkfoc, fmaxposhandler, CC_CMD_FMAXPOS},
     {chkfoc, ftemphandler, CC_CMD_FTEMP},
+    {chkaf,  afhandler, CC_CMD_AUTOFOCUS},
     {chkwhl, wlisthandler, CC_CMD_WLIST},
     {chkwhl, wsetNhandler, CC_CMD_WDEVNO},
     {chkwhl, wgotohandler, CC_CMD_WPOS},
@@ -1122,11 +1884,33 @@ void server(int sock, int imsock){
     // start camera thread
     pthread_t camthread;
     if(camera){
+        masters = calib_load(GP->masterbias, GP->masterdark, GP->masterflat);
+        if(!masters && (GP->masterbias || GP->masterdark || GP->masterflat)){
+            LOGERR("server(): can't load calibration masters");
+            ERRX(_("Can't load calibration masters"));
+        }
+        if(GP->roi){
+            char **r = GP->roi, list[BUFSIZ] = {0};
+            for(int l = 0; *r && l < BUFSIZ; ++r) l += snprintf(list + l, BUFSIZ - l, "%s%s", l ? ";" : "", *r);
+            if(!setrois(list)) ERRX(_("Wrong ROI list: %s"), list);
+        }
+        if(GP->sources != 0. && !setsources(GP->sources)){
+            LOGERR("server(): can't start sources detection with threshold %g", GP->sources);
+            ERRX(_("Can't start sources detection with threshold %g"), GP->sources);
+        }
+        if(GP->coadd && !coadd_init(&coadd, GP->coadd, GP->coaddema)){
+            LOGERR("server(): wrong co-adding window %d", GP->coadd);
+            ERRX(_("Wrong co-adding window: %d"), GP->coadd);
+        }
         if(pthread_create(&camthread, NULL, processCAM, NULL)){
             WARN("pthread_create()");
             LOGERR("server(): pthread_create()");
         }
     }
+    if(GP->addcamera && !multicam_start(GP->addcamera, GP->shmkey)){
+        LOGERR("server(): can't start additional cameras");
+        ERRX(_("Can't start additional cameras"));
+    }
     int nfd = 2; // only two listening sockets @start: command and image
     struct pollfd poll_set[CC_MAXCLIENTS+2];
     cc_strbuff *buffers[CC_MAXCLIENTS];
@@ -1228,7 +2012,7 @@ void server(int sock, int imsock){
             }
         }
         // check `infty`
-        if(camstate != CAMERA_CAPTURE && infty){ // start new exposition
+        if(camstate != CAMERA_CAPTURE && infty && !jobrunning()){ // start new exposition
             // mark to start new capture in infinity loop when at least one client connected
             if(nfd > 2){
                 camflags |= FLAG_STARTCAPTURE;
@@ -1238,6 +2022,7 @@ void server(int sock, int imsock){
         }
     }
     WARNX("SERVER STOPPED!");
+    multicam_stop();
     camstop();
     focclose();
     closewheel();
@@ -1279,6 +2064,12 @@ char *makeabspath(const char *path, int shouldbe){
 // @return FALSE if client closed (nothing to read)
 static int parsestring(int fd, cc_handleritem *handlers, char *str){
     if(fd < 1 || !handlers || !handlers->key || !str || !*str) return FALSE;
+    // `camN.cmd` - command for additional camera N
+    int camno, plen = 0;
+    if(handlers == items && sscanf(str, "cam%d.%n", &camno, &plen) == 1 && plen > 0){
+        if(!multicam_select(camno)) return cc_sendstrmessage(fd, cc_hresult2str(CC_RESULT_BADKEY));
+        return parsestring(fd, multicam_items, str + plen);
+    }
     char *val = cc_get_keyval(&str);
     if(val){
         DBG("RECEIVE '%s=%s'", str, val);
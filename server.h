@@ -26,6 +26,12 @@
 // pause (seconds) between temperature logging
 #define TLOG_PAUSE  60.
 
+// max amount of regions of interest
+#define MAX_ROI     16
+
+// autofocus and plan: max time (seconds) of frame waiting over exposition time
+#define FRAME_TMOUT 30.
+
 // server-side functions
 void server(int fd, int imsock);
 char *makeabspath(const char *path, int shouldbe);
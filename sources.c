@@ -0,0 +1,260 @@
+/*
+ * This file is part of the CCD_Capture project.
+ * Copyright 2026 Edward V. Emelianov <edward.emelianoff@gmail.com>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/shm.h>
+#include <usefull_macros.h>
+
+#include "imfunc.h"
+#include "omp.h"
+#include "sources.h"
+
+#ifdef OMP_FOUND
+int omp_get_max_threads(void);
+#endif
+
+// run of pixels over threshold in one row with its moments
+typedef struct{
+    int y, x0, x1;      // row and first/last pixel
+    int parent;         // union-find parent (global index)
+    double I, Ix, Iy, Ix2, Iy2; // moments relative to (0, 0)
+    float peak;         // max value over background
+    int saturated;      // have saturated pixels
+} run_t;
+
+// runs of one stripe of rows
+typedef struct{
+    run_t *runs;
+    int n, size;
+    int y0, y1;         // first and last (not including) rows
+    int first;          // index of first run in global numeration
+    int failed;         // can't allocate memory for runs
+} stripe_t;
+
+static int findroot(run_t *R, int i){
+    while(R[i].parent != i){
+        R[i].parent = R[R[i].parent].parent; // path halving
+        i = R[i].parent;
+    }
+    return i;
+}
+
+static void join(run_t *R, int a, int b){
+    a = findroot(R, a); b = findroot(R, b);
+    if(a == b) return;
+    if(a < b) R[b].parent = a;
+    else R[a].parent = b;
+}
+
+// runs `a` and `b` in neighbouring rows are connected (8-connectivity)
+#define CONNECTED(a, b)  ((a)->x0 <= (b)->x1 + 1 && (b)->x0 <= (a)->x1 + 1)
+
+// find runs in stripe and connect them inside stripe (local indexes are used as parents)
+#define FINDRUNS(T)  do{ const T *data = (const T*)img->data;                        \
+    for(int y = S->y0; y < S->y1 && !S->failed; ++y){ const T *row = data + (size_t)y * w;          \
+        int prevfirst = rowfirst; rowfirst = S->n;                                    \
+        for(int x = 0; x < w; ++x){ if(row[x] <= thr) continue;                       \
+            if(S->n == S->size){ run_t *nr = realloc(S->runs, (S->size + 1024) * sizeof(run_t)); \
+                if(!nr){ S->failed = 1; break; } S->runs = nr; S->size += 1024; }     \
+            run_t *r = &S->runs[S->n]; bzero(r, sizeof(run_t));                        \
+            r->y = y; r->x0 = x; r->parent = S->n;                                    \
+            for(; x < w && row[x] > thr; ++x){ double v = row[x] - bg;                 \
+                r->I += v; r->Ix += v * x; r->Ix2 += v * x * x;                        \
+                if(v > r->peak){r->peak = v;} if(row[x] >= max){r->saturated = 1;} }    \
+            r->x1 = x - 1; r->Iy = r->I * y; r->Iy2 = r->I * y * y;                   \
+            for(int p = prevfirst; p < rowfirst; ++p)                                 \
+                if(CONNECTED(&S->runs[p], r)) join(S->runs, p, S->n);                 \
+            ++S->n; }                                                                 \
+        }                                       \
+    }while(0)
+
+// sort by flux decrease
+static int fluxcmp(const void *a, const void *b){
+    float fa = ((const source_t*)a)->flux, fb = ((const source_t*)b)->flux;
+    if(fa > fb) return -1;
+    if(fa < fb) return 1;
+    return 0;
+}
+
+/**
+ * @brief findsources - find sources over background on image
+ * Background and its RMS are estimated by histogram (median and median absolute deviation).
+ * Image is divided into horizontal stripes processed in parallel: each stripe finds runs of pixels over
+ * threshold with their moments and connects them; then runs on stripes borders are joined and moments
+ * of each connected component are summed.
+ * @param img    - image
+ * @param nsigma - threshold (in background RMS)
+ * @param minpix - minimal amount of pixels in source
+ * @param T      (o) - table of sources (brightest SOURCES_MAX)
+ * @return FALSE if failed
+ */
+int findsources(cc_IMG *img, double nsigma, int minpix, sourcetable *T){
+    if(!img || !img->data || !T || img->w < 1 || img->h < 1) return FALSE;
+    // could be called from different threads at the same time (camera and autofocus)
+    uint32_t *hist = malloc(0x10000 * sizeof(uint32_t));
+    if(!hist) return FALSE;
+    int nbins = histogram(img, hist);
+    size_t npix = (size_t)img->w * img->h, half = npix / 2, cnt = 0;
+    int med = 0;
+    for(; med < nbins - 1; ++med) if((cnt += hist[med]) > half) break;
+    // MAD: half of pixels are in [med - mad, med + mad]
+    int mad = 0;
+    cnt = hist[med];
+    while(cnt <= half && mad < nbins){
+        ++mad;
+        if(med - mad >= 0) cnt += hist[med - mad];
+        if(med + mad < nbins) cnt += hist[med + mad];
+    }
+    FREE(hist);
+    double bg = med, noise = 1.4826 * mad;
+    if(noise < 1.) noise = 1.; // integer data
+    double thr = bg + nsigma * noise;
+    T->MAGICK = SOURCES_MAGIC;
+    T->imnumber = img->imnumber;
+    T->timestamp = img->timestamp;
+    T->background = bg;
+    T->noise = noise;
+    T->threshold = thr;
+    T->nsources = T->ntotal = 0;
+    int w = img->w, h = img->h, is16 = (cc_getNbytes(img) == 2);
+    int max = (1 << img->bitpix) - 1;
+    int nstripes = 1;
+#ifdef OMP_FOUND
+    nstripes = omp_get_max_threads();
+#endif
+    if(nstripes > h) nstripes = h;
+    stripe_t *stripes = calloc(nstripes, sizeof(stripe_t));
+    if(!stripes) return FALSE;
+    #pragma omp parallel for schedule(static, 1)
+    for(int s = 0; s < nstripes; ++s){
+        stripe_t *S = &stripes[s];
+        S->y0 = (int)((long)h * s / nstripes);
+        S->y1 = (int)((long)h * (s + 1) / nstripes);
+        int rowfirst = 0;
+        if(is16) FINDRUNS(uint16_t);
+        else FINDRUNS(uint8_t);
+    }
+    // all runs in one array with global indexes
+    int nruns = 0, failed = FALSE;
+    for(int s = 0; s < nstripes; ++s){
+        stripes[s].first = nruns;
+        nruns += stripes[s].n;
+        failed |= stripes[s].failed;
+    }
+    run_t *R = failed ? NULL : malloc((nruns + 1) * sizeof(run_t));
+    if(!R){
+        LOGERR("findsources(): can't allocate memory for %d runs", nruns);
+        WARNX(_("Can't allocate memory for sources detection"));
+        for(int s = 0; s < nstripes; ++s) FREE(stripes[s].runs);
+        FREE(stripes);
+        return FALSE;
+    }
+    for(int s = 0; s < nstripes; ++s){
+        stripe_t *S = &stripes[s];
+        for(int i = 0; i < S->n; ++i){
+            R[S->first + i] = S->runs[i];
+            R[S->first + i].parent += S->first;
+        }
+        FREE(S->runs);
+    }
+    // join runs on borders of stripes
+    for(int s = 1; s < nstripes; ++s){
+        int y = stripes[s].y0;
+        for(int i = stripes[s].first; i < nruns && R[i].y == y; ++i){
+            for(int p = stripes[s].first - 1; p >= 0 && R[p].y >= y - 1; --p)
+                if(R[p].y == y - 1 && CONNECTED(&R[p], &R[i])) join(R, p, i);
+        }
+    }
+    FREE(stripes);
+    // sum moments into roots
+    int *npixels = calloc(nruns + 1, sizeof(int));
+    int *edges = calloc(nruns + 1, sizeof(int));
+    source_t *all = malloc((nruns + 1) * sizeof(source_t));
+    if(!npixels || !edges || !all){
+        LOGERR("findsources(): can't allocate memory for %d runs", nruns);
+        WARNX(_("Can't allocate memory for sources detection"));
+        FREE(all); FREE(edges); FREE(npixels); FREE(R);
+        return FALSE;
+    }
+    for(int i = 0; i < nruns; ++i){
+        int r = findroot(R, i);
+        npixels[r] += R[i].x1 - R[i].x0 + 1;
+        if(R[i].x0 == 0 || R[i].x1 == w - 1 || R[i].y == 0 || R[i].y == h - 1) edges[r] = 1;
+        if(r == i) continue;
+        R[r].I += R[i].I; R[r].Ix += R[i].Ix; R[r].Iy += R[i].Iy;
+        R[r].Ix2 += R[i].Ix2; R[r].Iy2 += R[i].Iy2;
+        if(R[i].peak > R[r].peak) R[r].peak = R[i].peak;
+        R[r].saturated |= R[i].saturated;
+    }
+    int nfound = 0;
+    for(int i = 0; i < nruns; ++i){
+        if(R[i].parent != i || npixels[i] < minpix || R[i].I <= 0.) continue;
+        source_t *src = &all[nfound++];
+        double xc = R[i].Ix / R[i].I, yc = R[i].Iy / R[i].I;
+        double sx2 = R[i].Ix2 / R[i].I - xc * xc, sy2 = R[i].Iy2 / R[i].I - yc * yc;
+        src->x = xc; src->y = yc;
+        src->flux = R[i].I;
+        src->peak = R[i].peak;
+        src->fwhm = 2.3548 * sqrt(fmax((sx2 + sy2) / 2., 0.));
+        src->npix = (npixels[i] > 0xffff) ? 0xffff : npixels[i];
+        src->flags = (R[i].saturated ? SOURCE_SATURATED : 0) | (edges[i] ? SOURCE_EDGE : 0);
+    }
+    qsort(all, nfound, sizeof(source_t), fluxcmp);
+    T->ntotal = nfound;
+    T->nsources = (nfound > SOURCES_MAX) ? SOURCES_MAX : nfound;
+    memcpy(T->sources, all, T->nsources * sizeof(source_t));
+    FREE(all); FREE(edges); FREE(npixels); FREE(R);
+    return TRUE;
+}
+#undef FINDRUNS
+#undef CONNECTED
+
+/**
+ * @brief sources_getshm - get shared memory segment with sources table
+ * @param key      - SHM key
+ * @param isserver - create segment (else attach read-only)
+ * @return pointer to table or NULL if failed
+ */
+sourcetable *sources_getshm(key_t key, int isserver){
+    int shmid = shmget(key, isserver ? sizeof(sourcetable) : 0, isserver ? IPC_CREAT | 0666 : 0);
+    if(shmid < 0 && isserver){ // existing segment have other size
+        shmid = shmget(key, 0, 0);
+        if(shmid > -1) shmctl(shmid, IPC_RMID, NULL);
+        shmid = shmget(key, sizeof(sourcetable), IPC_CREAT | 0666);
+    }
+    if(shmid < 0){
+        WARN(_("Can't get shared memory segment %d"), key);
+        return NULL;
+    }
+    sourcetable *T = shmat(shmid, NULL, isserver ? 0 : SHM_RDONLY);
+    if(T == (void*)-1){
+        WARN(_("Can't attach SHM segment %d"), key);
+        return NULL;
+    }
+    if(isserver){
+        bzero(T, sizeof(sourcetable));
+        T->MAGICK = SOURCES_MAGIC;
+    }else if(T->MAGICK != SOURCES_MAGIC){
+        WARNX(_("Shared memory %d isn't a sources table"), key);
+        shmdt(T);
+        return NULL;
+    }
+    return T;
+}
@@ -0,0 +1,60 @@
+/*
+ * This file is part of the CCD_Capture project.
+ * Copyright 2026 Edward V. Emelianov <edward.emelianoff@gmail.com>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "ccdcapture.h"
+
+// max amount of sources in table
+#define SOURCES_MAX         256
+// magick number of sources table in SHM
+#define SOURCES_MAGIC       0x53524353
+// default detection threshold (sigmas over background)
+#define SOURCES_NSIGMA      5.
+// minimal amount of pixels in source
+#define SOURCES_MINPIX      3
+
+// source flags
+#define SOURCE_SATURATED    1   // have saturated pixels
+#define SOURCE_EDGE         2   // touches image edge
+
+// one source: intensity-weighted centroid (image pixels), flux over background, FWHM by second moments
+typedef struct{
+    float x, y;         // centroid
+    float flux;         // sum of (pixel - background)
+    float peak;         // max value over background
+    float fwhm;         // 2.355*sqrt((sigma_x^2 + sigma_y^2)/2)
+    uint16_t npix;      // amount of pixels over threshold (65535 if more)
+    uint16_t flags;     // SOURCE_SATURATED | SOURCE_EDGE
+} source_t;
+
+// table of sources found on one image (sorted by flux decrease)
+typedef struct{
+    uint32_t MAGICK;    // SOURCES_MAGIC
+    size_t imnumber;    // number of image
+    double timestamp;   // its timestamp
+    float background;   // background level
+    float noise;        // background RMS
+    float threshold;    // detection threshold
+    int nsources;       // amount of records in `sources`
+    int ntotal;         // total amount of sources found (could be more than SOURCES_MAX)
+    source_t sources[SOURCES_MAX];
+} sourcetable;
+
+int findsources(cc_IMG *img, double nsigma, int minpix, sourcetable *T);
+sourcetable *sources_getshm(key_t key, int isserver);